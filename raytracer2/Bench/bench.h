@@ -0,0 +1,36 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Calls body(idx) for idx in [0, count) and returns the nanoseconds per call
+template <typename Body>
+double nsPerCall(size_t count, Body body)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t idx = 0; idx != count; ++idx)
+        body(idx);
+    std::chrono::duration<double, std::nano> ns =
+        std::chrono::steady_clock::now() - start;
+    return ns.count() / count;
+}
+
+// Print one result line: name and time per call
+void report(std::string const &name, double ns);
+
+// Keeps results alive so the compiler cannot drop the benchmarked work
+extern volatile double benchSink;
+
+// --- Suites ------------------------------------------------------------------
+
+void benchShapes();
+void benchMath();
+void benchTextures();
+void benchScenes();
+void benchSamplers();
+void benchPathTracer();
+void benchMotion();
+
+#endif
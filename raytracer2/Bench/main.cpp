@@ -0,0 +1,68 @@
+#include "bench.h"
+#include "cpu.h"
+#include "triple.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+volatile double benchSink;
+
+void report(string const &name, double ns)
+{
+    cout << "  " << left << setw(40) << name << right << setw(10)
+         << fixed << setprecision(2) << ns << " ns\n";
+}
+
+namespace
+{
+    struct Suite
+    {
+        char const *name;
+        void (*run)();
+    };
+
+    Suite const suites[] =
+    {
+        {"shapes", benchShapes},
+        {"math", benchMath},
+        {"textures", benchTextures},
+        {"scenes", benchScenes},
+        {"samplers", benchSamplers},
+        {"pathtracer", benchPathTracer},
+        {"motion", benchMotion},
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    cout << "Introduction to Computer Graphics - Raytracer benchmarks ("
+         << (sizeof(Real) == sizeof(float) ? "float" : "double") << ", "
+         << Cpu::isa() << " for " << Cpu::kernels() << ")\n\n";
+
+    bool ranAny = false;
+    for (Suite const &suite : suites)
+    {
+        bool selected = argc < 2;
+        for (int arg = 1; arg < argc; ++arg)
+            selected |= strcmp(argv[arg], suite.name) == 0;
+        if (!selected)
+            continue;
+
+        cout << suite.name << ":\n";
+        suite.run();
+        ranAny = true;
+    }
+
+    if (!ranAny)
+    {
+        cerr << "Usage: " << argv[0] << " [suite...]\nSuites:";
+        for (Suite const &suite : suites)
+            cerr << ' ' << suite.name;
+        cerr << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "bench.h"
+
+#include "fastmath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    size_t const Count = 1 << 20;
+
+    vector<double> uniform(double lo, double hi, unsigned seed)
+    {
+        mt19937 rng(seed);
+        uniform_real_distribution<double> dist(lo, hi);
+        vector<double> values(Count);
+        for (double &value : values)
+            value = dist(rng);
+        return values;
+    }
+
+    // Largest absolute (relative == false) or relative error of fast
+    double maxError(vector<double> const &exact, vector<double> const &fast,
+                    bool relative)
+    {
+        double error = 0;
+        for (size_t idx = 0; idx != exact.size(); ++idx)
+        {
+            double diff = fabs(exact[idx] - fast[idx]);
+            if (relative)
+            {
+                if (fabs(exact[idx]) < DBL_MIN)   // flushed to zero
+                    continue;
+                diff /= fabs(exact[idx]);
+            }
+            error = max(error, diff);
+        }
+        return error;
+    }
+
+    // Times libm, the fast scalar kernel and the fast array version of one
+    // function, and prints the error of the fast version against libm
+    template <typename Libm, typename Fast, typename Array>
+    void benchFunction(string const &name, Libm libm, Fast fast, Array array,
+                       bool relative)
+    {
+        vector<double> exact(Count);
+        vector<double> approx(Count);
+
+        report(name + " libm", nsPerCall(Count, [&](size_t idx)
+        {
+            exact[idx] = libm(idx);
+        }));
+        report(name + " fast", nsPerCall(Count, [&](size_t idx)
+        {
+            approx[idx] = fast(idx);
+        }));
+
+        FastMath::precision = FastMath::Precision::Fast;
+        report(name + " fast array", nsPerCall(1, [&](size_t)
+        {
+            array(approx.data());
+        }) / Count);
+        FastMath::precision = FastMath::Precision::Exact;
+
+        cout << "    max " << (relative ? "relative" : "absolute")
+             << " error " << scientific << maxError(exact, approx, relative)
+             << fixed << '\n';
+        benchSink = approx[Count / 2];
+    }
+}
+
+void benchMath()
+{
+    vector<double> unit = uniform(-1, 1, 1);
+    vector<double> base = uniform(0, 1, 2);
+    vector<double> exponent = uniform(1, 128, 3);
+    vector<double> xs = uniform(-10, 10, 4);
+    vector<double> ys = uniform(-10, 10, 5);
+    vector<double> positive = uniform(1e-3, 1e3, 6);
+
+    benchFunction("pow",
+        [&](size_t idx) { return pow(base[idx], exponent[idx]); },
+        [&](size_t idx) { return FastMath::fastPow(base[idx], exponent[idx]); },
+        [&](double *out) { FastMath::pow(base.data(), exponent.data(), out, Count); },
+        true);
+    benchFunction("atan2",
+        [&](size_t idx) { return atan2(ys[idx], xs[idx]); },
+        [&](size_t idx) { return FastMath::fastAtan2(ys[idx], xs[idx]); },
+        [&](double *out) { FastMath::atan2(ys.data(), xs.data(), out, Count); },
+        false);
+    benchFunction("asin",
+        [&](size_t idx) { return asin(unit[idx]); },
+        [&](size_t idx) { return FastMath::fastAsin(unit[idx]); },
+        [&](double *out) { FastMath::asin(unit.data(), out, Count); },
+        false);
+    benchFunction("acos",
+        [&](size_t idx) { return acos(unit[idx]); },
+        [&](size_t idx) { return FastMath::fastAcos(unit[idx]); },
+        [&](double *out) { FastMath::acos(unit.data(), out, Count); },
+        false);
+    benchFunction("rsqrt",
+        [&](size_t idx) { return 1 / sqrt(positive[idx]); },
+        [&](size_t idx) { return FastMath::fastRsqrt(positive[idx]); },
+        [&](double *out) { FastMath::rsqrt(positive.data(), out, Count); },
+        true);
+}
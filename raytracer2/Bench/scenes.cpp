@@ -0,0 +1,275 @@
+#include "bench.h"
+
+#include "image.h"
+#include "parallel.h"
+#include "raytracer.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    // Texture heavy: a textured sphere, also seen in reflections. Scenes
+    // look up their textures in ../Scenes, so raybench has to run from the
+    // build directory, like ray.
+    char const *const TextureScene = "../Scenes/scene01-texture-ss-reflect-lights-shadows.json";
+
+    // Reads the scene into tracer, without its log
+    bool readScene(json const &scene, Raytracer &tracer)
+    {
+        string const filename = "raybench-scene.json";
+        ofstream(filename) << scene;
+
+        stringstream log;
+        tracer.setLog(log);
+        bool read = tracer.readScene(filename);
+        tracer.setLog(cout);
+        remove(filename.c_str());
+        if (read)
+            tracer.activate();
+        return read;
+    }
+
+    // Renders the scene with every texture set to layout and filter, and
+    // returns the nanoseconds per sample
+    double renderTextureScene(json scene, char const *layout, char const *filter)
+    {
+        for (json &object : scene["Objects"])
+        {
+            json &material = object["material"];
+            if (material.find("texture") == material.end())
+                continue;
+            material["layout"] = layout;
+            material["filter"] = filter;
+        }
+        Raytracer tracer;
+        if (!readScene(scene, tracer))
+            return 0;
+
+        AccumImage img(400, 400);
+        auto start = chrono::steady_clock::now();
+        tracer.getScene().render(img);
+        chrono::duration<double, nano> ns = chrono::steady_clock::now() - start;
+        return ns.count() / tracer.getScene().getStats().primary;
+    }
+
+    // Renders the pixels of crop with the given sampler into img, and
+    // returns the seconds taken
+    double renderCrop(json scene, Tile const &crop, char const *sampler,
+                      unsigned samples, unsigned seed, AccumImage &img)
+    {
+        scene["Sampler"] = sampler;
+        scene["SamplesPerPixel"] = samples;
+        scene["SamplerSeed"] = seed;
+        Raytracer tracer;
+        if (!readScene(scene, tracer))
+            return 0;
+
+        auto start = chrono::steady_clock::now();
+        parallelFor(crop.y1 - crop.y0, [&](size_t first, size_t last)
+        {
+            Tile rows{crop.x0, unsigned(crop.y0 + first), crop.x1, unsigned(crop.y0 + last)};
+            tracer.getScene().renderTile(img, rows);
+        }, 4);
+        chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+        return seconds.count();
+    }
+
+    // Root mean square difference of the pixels of crop, in 8 bit levels
+    double rmse(AccumImage const &img, AccumImage const &reference, Tile const &crop)
+    {
+        double sum = 0;
+        for (unsigned y = crop.y0; y != crop.y1; ++y)
+        {
+            for (unsigned x = crop.x0; x != crop.x1; ++x)
+            {
+                Color difference = img(x, y).mean() - reference(x, y).mean();
+                sum += difference.dot(difference);
+            }
+        }
+        return 255 * sqrt(sum / (3.0 * (crop.x1 - crop.x0) * (crop.y1 - crop.y0)));
+    }
+
+    // Renders the whole film of the scene and returns the nanoseconds per
+    // sample
+    double renderScene(json const &scene, unsigned width, unsigned height)
+    {
+        Raytracer tracer;
+        if (!readScene(scene, tracer))
+            return 0;
+
+        AccumImage img(width, height);
+        auto start = chrono::steady_clock::now();
+        tracer.getScene().render(img);
+        chrono::duration<double, nano> ns = chrono::steady_clock::now() - start;
+        return ns.count() / tracer.getScene().getStats().primary;
+    }
+
+    // A grid of side x side small spheres above a plane, seen from above
+    json sphereGrid(unsigned side, unsigned width, unsigned height)
+    {
+        json scene;
+        scene["Camera"] = {{"eye", {0, -300, 600}}, {"center", {0, 0, 0}}, {"up", {0, 1.5, 0}},
+                           {"viewSize", {width, height}}};
+        scene["Shadows"] = true;
+        scene["Sampler"] = "stratified";
+        scene["SamplesPerPixel"] = 16;
+        scene["Lights"] = {{{"position", {-400, -400, 800}}, {"color", {1, 1, 1}}}};
+        json material = {{"color", {0.8, 0.3, 0.2}}, {"ka", 0.2}, {"kd", 0.7}, {"ks", 0.3},
+                         {"n", 16}};
+        json objects = {{{"type", "plane"}, {"point", {0, 0, -10}}, {"normal", {0, 0, 1}},
+                         {"material", material}}};
+        for (unsigned row = 0; row != side; ++row)
+            for (unsigned column = 0; column != side; ++column)
+                objects.push_back({{"type", "sphere"}, {"radius", 6},
+                                   {"position", {(column - side / 2.0) * 20,
+                                                 (row - side / 2.0) * 20, 0}},
+                                   {"material", material}});
+        scene["Objects"] = objects;
+        return scene;
+    }
+
+    bool readTextureScene(json &scene)
+    {
+        ifstream file(TextureScene);
+        if (!file)
+        {
+            cout << "    " << TextureScene << " not found, run raybench from the build directory\n";
+            return false;
+        }
+        file >> scene;
+        return true;
+    }
+}
+
+void benchScenes()
+{
+    json scene;
+    if (!readTextureScene(scene))
+        return;
+    scene["SuperSamplingFactor"] = 2;
+
+    for (char const *filter : {"nearest", "bilinear"})
+        for (char const *layout : {"linear", "morton"})
+            report(string("texture scene ") + filter + ' ' + layout,
+                   renderTextureScene(scene, layout, filter));
+    cout << "    per sample, 400x400 at 2x2 samples per pixel\n";
+}
+
+// Error of every sampler against a 1024 sample stratified reference, on a
+// crop with the textured sphere, its shadow and reflections
+void benchSamplers()
+{
+    json scene;
+    if (!readTextureScene(scene))
+        return;
+
+    Tile const crop{80, 100, 208, 228};
+    AccumImage reference(400, 400);
+    double seconds = renderCrop(scene, crop, "stratified", 1024, 1000, reference);
+    cout << "    reference " << seconds << " s\n";
+
+    for (char const *sampler : {"regular", "stratified", "halton", "sobol", "bluenoise"})
+    {
+        for (unsigned samples : {1, 4, 16})
+        {
+            AccumImage img(400, 400);
+            seconds = renderCrop(scene, crop, sampler, samples, 0, img);
+            cout << "  " << left << setw(24) << sampler << right << setw(4) << samples
+                 << " spp   rmse " << setw(7) << fixed << setprecision(3)
+                 << rmse(img, reference, crop) << "   " << setw(8) << setprecision(1)
+                 << seconds * 1000 << " ms\n";
+        }
+    }
+    cout << "    rmse in 8 bit levels over " << crop.x1 - crop.x0 << 'x'
+         << crop.y1 - crop.y0 << " pixels\n";
+}
+
+// Convergence of the path tracer against a 256 sample reference, and its
+// samples per second on 1, 2, 4, ... threads
+void benchPathTracer()
+{
+    json scene;
+    if (!readTextureScene(scene))
+        return;
+    scene["Integrator"] = "path";
+
+    Tile const crop{80, 100, 144, 164};
+    unsigned const pixels = (crop.x1 - crop.x0) * (crop.y1 - crop.y0);
+    AccumImage reference(400, 400);
+    double seconds = renderCrop(scene, crop, "sobol", 256, 1000, reference);
+    cout << "    reference " << seconds << " s\n";
+
+    for (unsigned samples : {1, 2, 4, 8, 16, 32, 64})
+    {
+        AccumImage img(400, 400);
+        seconds = renderCrop(scene, crop, "sobol", samples, 0, img);
+        cout << "  " << left << setw(24) << "sobol" << right << setw(4) << samples
+             << " spp   rmse " << setw(7) << fixed << setprecision(3)
+             << rmse(img, reference, crop) << "   " << setw(10) << setprecision(0)
+             << pixels * samples / seconds << " samples/s\n";
+    }
+
+    unsigned const hardware = max(1u, thread::hardware_concurrency());
+    for (unsigned threads = 1; ; threads = min(2 * threads, hardware))
+    {
+        parallelThreadLimit() = threads;
+        AccumImage img(400, 400);
+        seconds = renderCrop(scene, crop, "sobol", 16, 0, img);
+        cout << "  " << left << setw(24) << "threads" << right << setw(4) << threads
+             << "       " << setw(22) << fixed << setprecision(0)
+             << pixels * 16 / seconds << " samples/s\n";
+        if (threads == hardware)
+            break;
+    }
+    parallelThreadLimit() = 0;
+    cout << "    rmse in 8 bit levels over " << crop.x1 - crop.x0 << 'x'
+         << crop.y1 - crop.y0 << " pixels\n";
+}
+
+// Cost of motion blur: the samples of a static grid of spheres against those
+// of the same grid moving, which the hierarchy bounds at the ends of the
+// frame
+void benchMotion()
+{
+    unsigned const width = 200;
+    unsigned const height = 150;
+    json scene = sphereGrid(24, width, height);
+    double still = renderScene(scene, width, height);
+    report("static", still);
+
+    auto moving = [&](char const *name, json const &motion)
+    {
+        json blurred = scene;
+        for (json &object : blurred["Objects"])
+            if (object["type"] == "sphere")
+                object["motion"] = motion;
+        double ns = renderScene(blurred, width, height);
+        report(name, ns);
+        cout << "    " << fixed << setprecision(2) << ns / still << " x static\n";
+    };
+    moving("translate", {{"translate", {15, 10, 0}}});
+    moving("scale", {{"scale", 1.5}});
+    moving("turn about the middle, 10 degrees", {{"rotate", {0, 0, 1}}, {"angle", 10},
+                                                  {"pivot", {0, 0, 0}}});
+
+    json camera = scene;
+    camera["Camera"]["motion"] = {{"eye", {20, -300, 600}}};
+    double ns = renderScene(camera, width, height);
+    report("camera", ns);
+    cout << "    " << fixed << setprecision(2) << ns / still << " x static\n";
+    cout << "    per sample, " << width << 'x' << height << " at 16 samples per pixel, "
+         << 24 * 24 << " spheres\n";
+}
@@ -0,0 +1,84 @@
+#include "bench.h"
+
+#include "shapes/cylinder.h"
+#include "shapes/plane.h"
+#include "shapes/sphere.h"
+#include "shapes/triangle.h"
+#include "texture.h"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    size_t const Count = 1 << 20;
+
+    // Rays from random points around the origin towards random points
+    // inside the unit cube, so that roughly half of them hit the shapes
+    vector<Ray> makeRays()
+    {
+        mt19937 rng(42);
+        uniform_real_distribution<double> around(-4, 4);
+        uniform_real_distribution<double> inside(-1, 1);
+
+        vector<Ray> rays;
+        rays.reserve(Count);
+        for (size_t idx = 0; idx != Count; ++idx)
+        {
+            Point from(around(rng), around(rng), 4 + around(rng));
+            Point to(inside(rng), inside(rng), inside(rng));
+            rays.push_back(Ray(from, (to - from).normalized()));
+        }
+        return rays;
+    }
+
+    void benchIntersect(string const &name, Object &obj, vector<Ray> const &rays)
+    {
+        double sum = 0;
+        report(name + "::intersect", nsPerCall(Count, [&](size_t idx)
+        {
+            Hit hit = obj.intersect(rays[idx]);
+            if (hit.t == hit.t)     // skip NaN misses
+                sum += hit.t;
+        }));
+        benchSink = sum;
+    }
+}
+
+void benchShapes()
+{
+    vector<Ray> rays = makeRays();
+
+    Sphere sphere(Point(0, 0, 0), 1, Vector(0, 1, 0.7), 90);
+    Plane plane(Point(0, 0, 0), Vector(0, 0, 1));
+    Triangle triangle(Point(-1, -1, 0), Point(1, -1, 0), Point(0, 1, 0));
+    Cylinder cylinder(Point(0, -1, 0), 1, 2);
+
+    sphere.material.texture = make_shared<Texture>(1024, 512);
+    sphere.material.textured = true;
+
+    for (Object *obj : {static_cast<Object *>(&sphere), static_cast<Object *>(&plane),
+                        static_cast<Object *>(&triangle), static_cast<Object *>(&cylinder)})
+        obj->prepare();
+
+    benchIntersect("Sphere", sphere, rays);
+    benchIntersect("Plane", plane, rays);
+    benchIntersect("Triangle", triangle, rays);
+    benchIntersect("Cylinder", cylinder, rays);
+
+    // Texture lookups at points on the sphere
+    vector<Point> points;
+    points.reserve(Count);
+    for (Ray const &ray : rays)
+        points.push_back((ray.O - sphere.position).normalized() + sphere.position);
+
+    double sum = 0;
+    report("Sphere::textureColorAt (rotated)", nsPerCall(Count, [&](size_t idx)
+    {
+        sum += sphere.textureColorAt(points[idx], true).r;
+    }));
+    benchSink = sum;
+}
@@ -0,0 +1,145 @@
+#include "bench.h"
+
+#include "texture.h"
+#include "texturecache.h"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    size_t const Count = 1 << 20;
+    unsigned const Size = 2048;
+
+    // Smooth gradients with some noise, like a photographic texture
+    Rgba8Image makeTexels()
+    {
+        mt19937 rng(7);
+        uniform_int_distribution<int> noise(-8, 8);
+        Rgba8Image texels(Size, Size);
+        for (unsigned y = 0; y != Size; ++y)
+        {
+            Rgba8 *row = texels.row(y);
+            for (unsigned x = 0; x != Size; ++x)
+            {
+                auto channel = [&](double value)
+                {
+                    return static_cast<uint8_t>(fmin(fmax(value + noise(rng), 0), 255));
+                };
+                row[x].r = channel(127.5 + 127.5 * sin(x * 0.01));
+                row[x].g = channel(127.5 + 127.5 * cos(y * 0.013));
+                row[x].b = channel((x + y) * 255.0 / (2 * Size));
+            }
+        }
+        return texels;
+    }
+
+    // Root mean square difference of the texels, per 8 bit channel
+    double rmse(Texture const &texture, Rgba8Image const &texels)
+    {
+        double sum = 0;
+        for (unsigned y = 0; y != Size; ++y)
+        {
+            for (unsigned x = 0; x != Size; ++x)
+            {
+                Rgba8 a = texture.texel(x, y);
+                Rgba8 b = texels(x, y);
+                sum += (a.r - b.r) * (a.r - b.r) + (a.g - b.g) * (a.g - b.g)
+                     + (a.b - b.b) * (a.b - b.b);
+            }
+        }
+        return sqrt(sum / (3.0 * Size * Size));
+    }
+}
+
+void benchTextures()
+{
+    Rgba8Image texels = makeTexels();
+
+    mt19937 rng(3);
+    uniform_real_distribution<float> unit(0, 1);
+    vector<float> us(Count);
+    vector<float> vs(Count);
+    for (size_t idx = 0; idx != Count; ++idx)
+    {
+        us[idx] = unit(rng);
+        vs[idx] = unit(rng);
+    }
+
+    // Down the columns, 16 texels apart: in row major order every lookup
+    // is in another cache line
+    vector<float> columnUs(Count);
+    vector<float> columnVs(Count);
+    for (size_t idx = 0; idx != Count; ++idx)
+    {
+        columnUs[idx] = (idx / Size * 16 % Size) / float(Size - 1);
+        columnVs[idx] = (idx % Size) / float(Size - 1);
+    }
+
+    struct Variant
+    {
+        char const *name;
+        Texture::Compression compression;
+        Texture::Layout layout;
+    };
+    for (Variant variant : {Variant{"rgba8", Texture::Compression::None, Texture::Layout::Morton},
+                            Variant{"rgba8 linear", Texture::Compression::None, Texture::Layout::Linear},
+                            Variant{"bc1", Texture::Compression::Bc1, Texture::Layout::Morton}})
+    {
+        Texture texture(texels, variant.compression, false, variant.layout);
+        for (Texture::Filter filter : {Texture::Filter::Nearest, Texture::Filter::Bilinear})
+        {
+            texture.setFilter(filter);
+            string name = string(variant.name) +
+                (filter == Texture::Filter::Nearest ? " nearest" : " bilinear");
+            double sum = 0;
+            report(name, nsPerCall(Count, [&](size_t idx)
+            {
+                sum += texture.colorAt(us[idx], vs[idx]).g;
+            }));
+            report(name + " columns", nsPerCall(Count, [&](size_t idx)
+            {
+                sum += texture.colorAt(columnUs[idx], columnVs[idx]).g;
+            }));
+            benchSink = sum;
+        }
+        cout << "    " << texture.bytes() / 1024 << " KiB for " << Size << 'x'
+             << Size << " texels (" << Size * Size * sizeof(Color) / 1024
+             << " KiB as Colors), rmse " << rmse(texture, texels) << '\n';
+    }
+
+    // Tiled: a random lookup faults a tile in, unless the whole texture fits
+    // the budget; with a small budget nearly every lookup reads from disk,
+    // so fewer lookups are timed
+    string const filename = "raybench-texture.tiles";
+    TiledTexture::write(texels, filename);
+    {
+        Texture texture(make_shared<TiledTexture>(filename));
+        TextureCache &cache = TextureCache::instance();
+        for (size_t budget : {size_t(0), size_t(4) << 20})
+        {
+            cache.setBudget(budget);
+            for (Texture::Filter filter : {Texture::Filter::Nearest, Texture::Filter::Bilinear})
+            {
+                texture.setFilter(filter);
+                string name = string("tiled ") + (budget == 0 ? "" : "4 MiB ") +
+                    (filter == Texture::Filter::Nearest ? "nearest" : "bilinear");
+                double sum = 0;
+                report(name, nsPerCall(budget == 0 ? Count : Count / 64, [&](size_t idx)
+                {
+                    sum += texture.colorAt(us[idx], vs[idx]).g;
+                }));
+                benchSink = sum;
+            }
+        }
+        cout << "    " << cache.faults() << " tiles read, " << cache.evictions()
+             << " evicted, rmse " << rmse(texture, texels) << '\n';
+        cache.setBudget(0);
+    }
+    remove(filename.c_str());
+}
@@ -0,0 +1,117 @@
+#include "batch.h"
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    typedef chrono::steady_clock Clock;
+
+    // A scene read in the background, with the log of reading it
+    struct Loaded
+    {
+        unique_ptr<Raytracer> tracer;
+        unique_ptr<ostringstream> log;
+        bool read = false;
+        double seconds = 0;
+    };
+
+    Loaded load(string const &scene, RenderOverrides const &overrides,
+                shared_ptr<ResourceCache> const &resources)
+    {
+        Loaded loaded;
+        loaded.tracer.reset(new Raytracer);
+        loaded.log.reset(new ostringstream);
+        loaded.tracer->setOverrides(overrides);
+        loaded.tracer->setResources(resources);
+        loaded.tracer->setLog(*loaded.log);
+
+        Clock::time_point start = Clock::now();
+        loaded.read = loaded.tracer->readScene(scene);
+        loaded.seconds = chrono::duration<double>(Clock::now() - start).count();
+        return loaded;
+    }
+}
+
+Batch::Batch(string const &jobFile, RenderOverrides const &overrides)
+:
+    overrides(overrides)
+{
+    ifstream file(jobFile);
+    if (!file)
+        throw runtime_error("Could not open job list " + jobFile + '.');
+
+    string line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream fields(line);
+        Job job;
+        if (!(fields >> job.scene))
+            continue;                       // blank or comment
+        if (!(fields >> job.output))
+            job.output = job.scene.substr(0, job.scene.find_last_of('.')) + ".png";
+        jobs.push_back(job);
+    }
+}
+
+unsigned Batch::run()
+{
+    Clock::time_point start = Clock::now();
+    unsigned failed = 0;
+    unsigned long long rays = 0;
+    unsigned long long samples = 0;
+    double loadSeconds = 0;
+
+    future<Loaded> next;
+    if (!jobs.empty())
+        next = async(launch::async, load, jobs[0].scene, overrides, resources);
+    for (size_t idx = 0; idx != jobs.size(); ++idx)
+    {
+        Loaded current = next.get();
+        if (idx + 1 != jobs.size())
+            next = async(launch::async, load, jobs[idx + 1].scene, overrides, resources);
+
+        cout << "--- Job " << idx + 1 << " of " << jobs.size() << ": "
+             << jobs[idx].scene << '\n' << current.log->str();
+        loadSeconds += current.seconds;
+        if (!current.read)
+        {
+            cerr << "Error: reading scene from " << jobs[idx].scene << " failed.\n";
+            ++failed;
+            continue;
+        }
+
+        Raytracer &tracer = *current.tracer;
+        tracer.setLog(cout);
+        Clock::time_point rendered = Clock::now();
+        tracer.renderToFile(jobs[idx].output);
+        double seconds = chrono::duration<double>(Clock::now() - rendered).count();
+
+        Scene &scene = tracer.getScene();
+        Tile const &crop = scene.getCamera().crop();
+        unsigned long long jobSamples = 1ULL * crop.width() * crop.height()
+                                      * scene.getSamplesPerPixel();
+        rays += scene.getStats().total();
+        samples += jobSamples;
+        cout << "Job " << idx + 1 << ": read in " << current.seconds << " s, rendered in "
+             << seconds << " s, " << scene.getStats().total() / seconds << " rays/s, "
+             << jobSamples / seconds << " samples/s.\n";
+    }
+
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    cout << "--- Batch: " << jobs.size() - failed << " of " << jobs.size()
+         << " jobs in " << seconds << " s (" << loadSeconds
+         << " s reading, overlapped with rendering), "
+         << rays / seconds << " rays/s, " << samples / seconds << " samples/s, "
+         << 60 * jobs.size() / seconds << " jobs/min.\n"
+         << "Resources: " << resources->loads() << " textures and meshes loaded, "
+         << resources->hits() << " shared.\n";
+    return failed;
+}
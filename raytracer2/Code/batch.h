@@ -0,0 +1,37 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "raytracer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renders a list of scenes in one process. The scenes share the textures
+// and meshes they have in common (a ResourceCache) and the ThreadPool, and
+// the next scene is read while the current one renders.
+class Batch
+{
+    struct Job
+    {
+        std::string scene;
+        std::string output;
+    };
+
+    std::vector<Job> jobs;
+    RenderOverrides overrides;
+    std::shared_ptr<ResourceCache> resources = std::make_shared<ResourceCache>();
+
+    public:
+        // The job file has a scene per line, optionally followed by the
+        // output (else the scene with .png); # starts a comment
+        Batch(std::string const &jobFile, RenderOverrides const &overrides);
+
+        // Renders all jobs, reporting the throughput of each and of the
+        // batch; returns the number of jobs that failed
+        unsigned run();
+
+        size_t size() const { return jobs.size(); };
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include "bvh.h"
+
+#include "cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    unsigned const Bins = 16;           // split candidates per axis, plus one
+    unsigned const MaxLeaf = 4;         // objects a leaf may keep
+    unsigned const MaxDepth = 64;       // deeper nodes split at the median
+    unsigned const StackSize = MaxDepth + 64;
+}
+
+// --- Box ---------------------------------------------------------------------
+
+void Bvh::Box::extend(Box const &box)
+{
+    for (int axis = 0; axis != 3; ++axis)
+    {
+        lower.data[axis] = min(lower.data[axis], box.lower.data[axis]);
+        upper.data[axis] = max(upper.data[axis], box.upper.data[axis]);
+    }
+}
+
+Real Bvh::Box::area() const
+{
+    Vector size = upper - lower;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+// --- Bvh ---------------------------------------------------------------------
+
+void Bvh::build(vector<ObjectPtr> const &objects)
+{
+    nodes.clear();
+    order.clear();
+    unbounded.clear();
+
+    // The boxes are padded a little beyond the spheres, so that rounding
+    // in the box test cannot miss a hit the object reports
+    auto box = [](Point const &center, Real radius)
+    {
+        Real slack = (radius + max({fabs(center.x), fabs(center.y), fabs(center.z)}))
+                   * Real(1e-5);
+        Vector extent(radius + slack, radius + slack, radius + slack);
+        return Box{center - extent, center + extent};
+    };
+
+    vector<Item> items;
+    for (uint32_t idx = 0; idx != objects.size(); ++idx)
+    {
+        Point start, end;
+        Real startRadius, endRadius;
+        if (!objects[idx]->boundsAt(0, start, startRadius)
+            || !objects[idx]->boundsAt(1, end, endRadius))
+        {
+            unbounded.push_back(idx);
+            continue;
+        }
+        items.push_back(Item{box(start, startRadius), box(end, endRadius),
+                             (start + end) / 2, idx});
+    }
+    if (items.empty())
+        return;
+
+    nodes.reserve(2 * items.size());
+    order.reserve(items.size());
+    split(items, 0, items.size(), 0);
+}
+
+// Splits the items at the bin boundary of least cost: the swept areas of
+// both sides times their number of objects
+void Bvh::split(vector<Item> &items, size_t begin, size_t end, unsigned depth)
+{
+    size_t const current = nodes.size();
+    nodes.push_back(Node{items[begin].start, items[begin].end, 0, 0, 0});
+    Box centroids{items[begin].centroid, items[begin].centroid};
+    for (size_t idx = begin + 1; idx != end; ++idx)
+    {
+        nodes[current].start.extend(items[idx].start);
+        nodes[current].end.extend(items[idx].end);
+        centroids.extend(Box{items[idx].centroid, items[idx].centroid});
+    }
+
+    size_t const count = end - begin;
+    auto leaf = [&]()
+    {
+        nodes[current].index = order.size();
+        nodes[current].count = count;
+        for (size_t idx = begin; idx != end; ++idx)
+            order.push_back(items[idx].object);
+    };
+    if (count == 1)
+    {
+        leaf();
+        return;
+    }
+
+    Vector spread = centroids.upper - centroids.lower;
+    unsigned axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : spread.y >= spread.z ? 1 : 2;
+    Real const lower = centroids.lower.data[axis];
+    Real const width = spread.data[axis];
+
+    size_t middle = begin;
+    if (width > 0 && depth < MaxDepth)
+    {
+        auto bin = [&](Item const &item)
+        {
+            unsigned slot = unsigned((item.centroid.data[axis] - lower) / width * Bins);
+            return min(slot, Bins - 1);
+        };
+        size_t counts[Bins] = {};
+        Box boxes[Bins];
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            unsigned slot = bin(items[idx]);
+            Box swept = items[idx].start;
+            swept.extend(items[idx].end);
+            if (counts[slot]++ == 0)
+                boxes[slot] = swept;
+            else
+                boxes[slot].extend(swept);
+        }
+
+        // the area and number of objects right of every boundary
+        Real rightArea[Bins];
+        size_t rightCount[Bins];
+        Box right;
+        size_t seen = 0;
+        for (unsigned slot = Bins - 1; slot != 0; --slot)
+        {
+            if (counts[slot] != 0)
+            {
+                if (seen == 0)
+                    right = boxes[slot];
+                else
+                    right.extend(boxes[slot]);
+                seen += counts[slot];
+            }
+            rightArea[slot] = seen == 0 ? 0 : right.area();
+            rightCount[slot] = seen;
+        }
+
+        Real bestCost = numeric_limits<Real>::infinity();
+        unsigned best = 0;
+        Box left;
+        seen = 0;
+        for (unsigned slot = 0; slot + 1 != Bins; ++slot)
+        {
+            if (counts[slot] != 0)
+            {
+                if (seen == 0)
+                    left = boxes[slot];
+                else
+                    left.extend(boxes[slot]);
+                seen += counts[slot];
+            }
+            if (seen == 0 || rightCount[slot + 1] == 0)
+                continue;
+            Real cost = left.area() * seen + rightArea[slot + 1] * rightCount[slot + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                best = slot;
+            }
+        }
+
+        Box whole = nodes[current].start;
+        whole.extend(nodes[current].end);
+        if (count <= MaxLeaf && bestCost >= whole.area() * count)
+        {
+            leaf();
+            return;
+        }
+        if (bestCost < numeric_limits<Real>::infinity())
+            middle = partition(items.begin() + begin, items.begin() + end,
+                               [&](Item const &item) { return bin(item) <= best; })
+                     - items.begin();
+    }
+
+    if (middle == begin || middle == end)
+    {
+        // no boundary separates the centroids: split at the median
+        if (count <= MaxLeaf)
+        {
+            leaf();
+            return;
+        }
+        middle = begin + count / 2;
+        nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+                    [axis](Item const &one, Item const &other)
+                    {
+                        return one.centroid.data[axis] < other.centroid.data[axis];
+                    });
+    }
+
+    nodes[current].axis = axis;
+    split(items, begin, middle, depth + 1);
+    nodes[current].index = nodes.size();
+    split(items, middle, end, depth + 1);
+}
+
+ObjectPtr Bvh::intersect(vector<ObjectPtr> const &objects, Ray const &ray, Hit &min_hit,
+                         unsigned &index, Object const *skip) const
+{
+    return closest(objects, ray, min_hit, index, skip);
+}
+
+RAY_MULTI_ISA
+ObjectPtr Bvh::closest(vector<ObjectPtr> const &objects, Ray const &ray, Hit &min_hit,
+                       unsigned &index, Object const *skip) const
+{
+    ObjectPtr obj = nullptr;
+    auto test = [&](uint32_t idx)
+    {
+        if (objects[idx].get() == skip)
+            return;
+        Hit hit(objects[idx]->intersect(ray));
+        if (hit.t < min_hit.t || (hit.t == min_hit.t && obj && idx < index))
+        {
+            min_hit = hit;
+            obj = objects[idx];
+            index = idx;
+        }
+    };
+
+    for (uint32_t idx : unbounded)
+        test(idx);
+    if (nodes.empty())
+        return obj;
+
+    Real const time = ray.time;
+    Real const inverse[3] = {1 / ray.D.x, 1 / ray.D.y, 1 / ray.D.z};
+
+    // Whether the ray meets the node's box at its time before the closest
+    // hit; a NaN slab (the ray in the plane of a face) does not cut it
+    auto meets = [&](Node const &node)
+    {
+        Real enter = 0;
+        Real exit = min_hit.t;
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            Real lower = node.start.lower.data[axis]
+                       + time * (node.end.lower.data[axis] - node.start.lower.data[axis]);
+            Real upper = node.start.upper.data[axis]
+                       + time * (node.end.upper.data[axis] - node.start.upper.data[axis]);
+            Real near = (lower - ray.O.data[axis]) * inverse[axis];
+            Real far = (upper - ray.O.data[axis]) * inverse[axis];
+            if (near > far)
+                swap(near, far);
+            if (near > enter)
+                enter = near;
+            if (far < exit)
+                exit = far;
+        }
+        return enter <= exit;
+    };
+
+    uint32_t stack[StackSize];
+    unsigned top = 0;
+    uint32_t current = 0;
+    while (true)
+    {
+        Node const &node = nodes[current];
+        if (meets(node))
+        {
+            if (node.count != 0)
+            {
+                for (uint32_t idx = node.index; idx != node.index + node.count; ++idx)
+                    test(order[idx]);
+            }
+            else
+            {
+                // the nearer child first, its hits shorten the other's test
+                uint32_t first = current + 1;
+                uint32_t second = node.index;
+                if (ray.D.data[node.axis] < 0)
+                    swap(first, second);
+                stack[top++] = second;
+                current = first;
+                continue;
+            }
+        }
+        if (top == 0)
+            break;
+        current = stack[--top];
+    }
+    return obj;
+}
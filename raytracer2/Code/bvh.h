@@ -0,0 +1,76 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "object.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the objects of a scene, for rays of any
+// time of the frame. Every node keeps two boxes, around its objects at the
+// start and at the end of the frame; a ray tests the box interpolated to
+// its time, which holds the objects then (their spheres move linearly, see
+// Object::boundsAt). Motion blur thus costs a lerp per box, not a hierarchy
+// per time; for a static scene both boxes are the same.
+//
+// The hierarchy is built with the surface area heuristic on the boxes
+// swept over the frame, and stored depth first: a node's first child
+// follows it, the second is at its index. Unbounded objects (planes) are
+// kept apart and tested by every ray.
+//
+// The closest hit is that of the object with the smallest distance and,
+// among equal distances, the smallest index: the same object the linear
+// search of the objects in order would find.
+class Bvh
+{
+    struct Box
+    {
+        Point lower;
+        Point upper;
+
+        void extend(Box const &box);
+        Real area() const;
+    };
+
+    struct Node
+    {
+        Box start;
+        Box end;
+        uint32_t index;         // second child, or first object of a leaf
+        uint32_t count;         // objects of a leaf, 0 for an inner node
+        uint32_t axis;          // of the split, children in order along it
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;        // object indices, by leaf
+    std::vector<uint32_t> unbounded;
+
+    public:
+        void build(std::vector<ObjectPtr> const &objects);
+
+        // The closest object of objects (those of build) the ray hits,
+        // other than skip, and its index; nullptr if none. min_hit is
+        // that of the closest hit so far.
+        ObjectPtr intersect(std::vector<ObjectPtr> const &objects, Ray const &ray,
+                            Hit &min_hit, unsigned &index, Object const *skip = nullptr) const;
+
+        size_t size() const { return order.size() + unbounded.size(); };
+        size_t nodeCount() const { return nodes.size(); };
+
+    private:
+        struct Item
+        {
+            Box start;
+            Box end;
+            Point centroid;     // of the box halfway
+            uint32_t object;
+        };
+
+        void split(std::vector<Item> &items, size_t begin, size_t end, unsigned depth);
+        // intersect, built per ISA (cpu.h)
+        ObjectPtr closest(std::vector<ObjectPtr> const &objects, Ray const &ray,
+                          Hit &min_hit, unsigned &index, Object const *skip) const;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "camera.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// The center is half a pixel right of and above the middle of the film, so
+// that the samples land where they did before the film had a size
+Camera::Camera(Point const &eye, unsigned width, unsigned height)
+:
+    d_eye(eye),
+    d_center(Real(width) / 2 + Real(0.5), Real(height) / 2 - Real(0.5), 0),
+    d_up(0, 1, 0),
+    d_right(1, 0, 0),
+    d_width(width),
+    d_height(height),
+    d_crop{0, 0, width, height}
+{}
+
+Camera::Camera(Point const &eye, Point const &center, Vector const &up,
+               unsigned width, unsigned height)
+:
+    d_eye(eye),
+    d_center(center),
+    d_up(up),
+    d_width(width),
+    d_height(height),
+    d_crop{0, 0, width, height}
+{
+    Vector view = center - eye;
+    d_right = view.cross(up);
+    if (d_right.length_2() == 0 || width == 0 || height == 0)
+        throw runtime_error("Camera: up may not be parallel to the view and the "
+                            "view size may not be zero.");
+    d_right = d_right.normalized() * up.length();
+
+    // up perpendicular to the view, so pixels are square
+    d_up = d_right.cross(view).normalized() * up.length();
+}
+
+void Camera::resize(unsigned width, unsigned height)
+{
+    if (width == 0 || height == 0)
+        throw runtime_error("Camera: the resolution may not be zero.");
+    Real scale = Real(d_width) / width;
+    d_up *= scale;
+    d_right *= scale;
+    d_endUp *= scale;
+    d_endRight *= scale;
+    d_width = width;
+    d_height = height;
+    d_crop = Tile{0, 0, width, height};
+}
+
+void Camera::setCrop(Tile const &crop)
+{
+    d_crop = Tile{min(crop.x0, d_width), min(crop.y0, d_height),
+                  min(crop.x1, d_width), min(crop.y1, d_height)};
+    if (d_crop.empty())
+        throw runtime_error("Camera: the crop window lies outside the image.");
+}
+
+void Camera::setEnd(Point const &eye, Point const &center)
+{
+    Vector view = center - eye;
+    Vector right = view.cross(d_up);
+    if (right.length_2() == 0)
+        throw runtime_error("Camera: up may not be parallel to the view at the end of the "
+                            "motion.");
+    d_moves = true;
+    d_endEye = eye;
+    d_endCenter = center;
+    d_endRight = right.normalized() * d_up.length();
+    d_endUp = d_endRight.cross(view).normalized() * d_up.length();
+}
@@ -0,0 +1,90 @@
+#ifndef CAMERA_H_
+#define CAMERA_H_
+
+#include "triple.h"
+
+// Block of the image: the pixels [x0, x1) x [y0, y1)
+struct Tile
+{
+    unsigned x0;
+    unsigned y0;
+    unsigned x1;
+    unsigned y1;
+
+    unsigned width() const { return x1 - x0; };
+    unsigned height() const { return y1 - y0; };
+    bool empty() const { return x1 <= x0 || y1 <= y0; };
+};
+
+// The eye and the film it looks through. The film is width x height pixels
+// on the image plane around center; right and up span one pixel (y runs
+// down the film and along up in the scene). Only the pixels of crop are
+// rendered, into an image of the crop's size.
+//
+// A moving camera has a second pose at the end of the frame; at a time in
+// between, the eye and the film are interpolated linearly.
+class Camera
+{
+    Point d_eye;
+    Point d_center;
+    Vector d_up;
+    Vector d_right;
+    bool d_moves = false;
+    Point d_endEye;
+    Point d_endCenter;
+    Vector d_endUp;
+    Vector d_endRight;
+    unsigned d_width;
+    unsigned d_height;
+    Tile d_crop;
+
+    public:
+        // The image plane z = 0 with one unit per pixel, pixel (0, 0) at
+        // the top left; how scenes with only an "Eye" are rendered
+        Camera(Point const &eye = Point(), unsigned width = 400, unsigned height = 400);
+
+        // Looking from eye at center; the length of up is the pixel size
+        Camera(Point const &eye, Point const &center, Vector const &up,
+               unsigned width, unsigned height);
+
+        // Changes the resolution, keeping the width of the view: pixels
+        // grow or shrink accordingly. Resets the crop.
+        void resize(unsigned width, unsigned height);
+        // Clipped to the film
+        void setCrop(Tile const &crop);
+        // Looking from eye at center at the end of the frame, with the
+        // pixel size and up direction of the start
+        void setEnd(Point const &eye, Point const &center);
+
+        // The point of the image plane at film position (x, y), in pixels
+        Point filmPoint(Real x, Real y) const
+        {
+            return d_center + (x - Real(d_width) / 2) * d_right
+                            + (Real(d_height) / 2 - y) * d_up;
+        }
+
+        // The same, at time of the frame
+        Point filmPoint(Real x, Real y, Real time) const
+        {
+            Point start = filmPoint(x, y);
+            if (!d_moves)
+                return start;
+            Point end = d_endCenter + (x - Real(d_width) / 2) * d_endRight
+                                    + (Real(d_height) / 2 - y) * d_endUp;
+            return start + time * (end - start);
+        }
+        Point eye(Real time) const
+        {
+            return d_moves ? d_eye + time * (d_endEye - d_eye) : d_eye;
+        }
+
+        Point const &eye() const { return d_eye; };
+        Vector const &up() const { return d_up; };
+        Vector const &right() const { return d_right; };
+        unsigned width() const { return d_width; };
+        unsigned height() const { return d_height; };
+        Tile const &crop() const { return d_crop; };
+        bool moves() const { return d_moves; };
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "checkpoint.h"
+
+#include "scene.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// --- File format -------------------------------------------------------------
+
+namespace
+{
+    char const Magic[8] = {'R', 'A', 'Y', 'C', 'K', 'P', 'T', '1'};
+    uint32_t const Version = 1;
+
+    // Followed by the samples of every tile (uint32_t) and the pixels
+    // (RgbSum) row by row
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;             // of the image, the crop window
+        uint32_t height;
+        uint32_t samples;           // per pixel, of the finished render
+        uint32_t passSamples;
+        uint32_t tiles;
+        uint64_t fingerprint;
+    };
+}
+
+// --- Checkpoint --------------------------------------------------------------
+
+unsigned const Checkpoint::PassSamples;
+
+Checkpoint::Checkpoint(Scene &scene, string const &filename, uint64_t fingerprint,
+                       CheckpointSettings const &settings)
+:
+    scene(scene),
+    filename(filename),
+    fingerprint(fingerprint),
+    settings(settings)
+{}
+
+Checkpoint::~Checkpoint()
+{
+    {
+        lock_guard<mutex> lock(stateMutex);
+        stop = true;
+    }
+    wake.notify_one();
+    if (writer.joinable())
+        writer.join();
+}
+
+void Checkpoint::render(AccumImage &img)
+{
+    tiles = scene.tiles();
+    crop = scene.getCamera().crop();
+    committed = AccumImage(img.width(), img.height());
+    tileSamples.assign(tiles.size(), 0);
+
+    if (settings.resume)
+    {
+        if (load(img))
+            cout << "Resuming from " << filename << ".\n";
+        else
+            cout << "No checkpoint of this render in " << filename << ", starting over.\n";
+    }
+
+    lastWrite = chrono::steady_clock::now();
+    if (settings.interval > 0)
+        writer = thread(&Checkpoint::writeLoop, this);
+
+    // Tiles that completed a pass before the checkpoint skip it
+    unsigned total = scene.getSamplesPerPixel();
+    for (unsigned first = 0; first < total; first += PassSamples)
+    {
+        unsigned last = min(first + PassSamples, total);
+        vector<Tile> todo;
+        vector<size_t> index;
+        for (size_t idx = 0; idx != tiles.size(); ++idx)
+        {
+            if (tileSamples[idx] < last)
+            {
+                todo.push_back(tiles[idx]);
+                index.push_back(idx);
+            }
+        }
+        scene.renderTiles(img, todo, first, last, Scene::Clock::time_point::max(),
+                          [&](size_t idx)
+                          {
+                              commit(img, index[idx], last);
+                          });
+    }
+}
+
+// Pixels and tile samples of a checkpoint of this render, false if there is
+// none
+bool Checkpoint::load(AccumImage &img)
+{
+    ifstream file(filename, ios::binary);
+    Header header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || !equal(Magic, Magic + 8, header.magic) || header.version != Version
+        || header.width != img.width() || header.height != img.height()
+        || header.samples != scene.getSamplesPerPixel()
+        || header.passSamples != PassSamples || header.tiles != tiles.size()
+        || header.fingerprint != fingerprint)
+        return false;
+
+    vector<uint32_t> samples(tiles.size());
+    AccumImage pixels(img.width(), img.height());
+    if (!file.read(reinterpret_cast<char *>(samples.data()), samples.size() * sizeof(uint32_t))
+        || !file.read(reinterpret_cast<char *>(pixels.row(0)), pixels.size() * sizeof(RgbSum)))
+        return false;
+    for (uint32_t count : samples)
+        if (count % PassSamples != 0 && count != header.samples)
+            return false;
+
+    tileSamples = samples;
+    committed = pixels;
+    img = pixels;
+    return true;
+}
+
+// Called by the render thread that finished a pass of the tile
+void Checkpoint::commit(AccumImage const &img, size_t tile, unsigned samples)
+{
+    Tile const &rect = tiles[tile];
+    lock_guard<mutex> lock(stateMutex);
+    for (unsigned y = rect.y0; y != rect.y1; ++y)
+    {
+        RgbSum const *row = img.row(y - crop.y0) + (rect.x0 - crop.x0);
+        copy(row, row + rect.width(), committed.row(y - crop.y0) + (rect.x0 - crop.x0));
+    }
+    tileSamples[tile] = samples;
+
+    auto now = chrono::steady_clock::now();
+    if (settings.interval > 0
+        && chrono::duration<double>(now - lastWrite).count() >= settings.interval)
+    {
+        lastWrite = now;
+        pending = true;
+        wake.notify_one();
+    }
+}
+
+// Writes the checkpoint next to the file and renames it, so an interrupted
+// write leaves the previous checkpoint intact
+void Checkpoint::write(vector<uint32_t> const &samples, AccumImage const &pixels) const
+{
+    Header header = {};
+    copy(Magic, Magic + 8, header.magic);
+    header.version = Version;
+    header.width = pixels.width();
+    header.height = pixels.height();
+    header.samples = scene.getSamplesPerPixel();
+    header.passSamples = PassSamples;
+    header.tiles = samples.size();
+    header.fingerprint = fingerprint;
+
+    string temporary = filename + ".tmp";
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(samples.data()), samples.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<char const *>(pixels.row(0)), pixels.size() * sizeof(RgbSum));
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0)
+    {
+        cerr << "Could not write checkpoint " << filename << ".\n";
+        return;
+    }
+
+    double done = 0;
+    for (uint32_t count : samples)
+        done += count;
+    cout << "Wrote checkpoint " << filename << ", "
+         << int(100 * done / (samples.size() * double(header.samples))) << "% done.\n";
+}
+
+// The state is copied while the render threads wait, the file is written
+// while they continue
+void Checkpoint::writeLoop()
+{
+    unique_lock<mutex> lock(stateMutex);
+    while (true)
+    {
+        wake.wait(lock, [&]{ return pending || stop; });
+        if (stop)
+            return;
+        pending = false;
+        vector<uint32_t> samples = tileSamples;
+        AccumImage pixels = committed;
+        lock.unlock();
+        write(samples, pixels);
+        lock.lock();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "camera.h"
+#include "image.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Scene;
+
+// When checkpoints are written and whether an earlier one is continued
+struct CheckpointSettings
+{
+    double interval = 0;            // seconds between checkpoints
+    bool resume = false;
+
+    bool enabled() const { return interval > 0 || resume; };
+};
+
+// Renders the scene in passes of PassSamples samples per pixel and
+// periodically saves the state of the render: the accumulated pixels (which
+// hold their sample counts), the samples every tile has completed and the
+// sampler's samples per pixel. The samplers are stateless, a sample depends
+// only on its pixel, index and the seed, which the fingerprint of the scene
+// covers. A resumed render adds the remaining samples of every pixel in the
+// same order, so its result is identical to that of an uninterrupted one.
+//
+// A tile that finishes a pass is copied into the committed image; a
+// background thread copies that and writes it to disk, so the render
+// threads never wait for the file system.
+class Checkpoint
+{
+    Scene &scene;
+    std::string filename;
+    uint64_t fingerprint;           // of the scene and its settings
+    CheckpointSettings settings;
+
+    std::vector<Tile> tiles;
+    Tile crop;
+
+    std::mutex stateMutex;          // guards the members below
+    std::condition_variable wake;
+    AccumImage committed;           // tiles as of their last completed pass
+    std::vector<uint32_t> tileSamples;
+    bool pending = false;           // a checkpoint is due
+    bool stop = false;
+    std::chrono::steady_clock::time_point lastWrite;
+    std::thread writer;
+
+    public:
+        static unsigned const PassSamples = 16;
+
+        Checkpoint(Scene &scene, std::string const &filename, uint64_t fingerprint,
+                   CheckpointSettings const &settings);
+        ~Checkpoint();
+
+        Checkpoint(Checkpoint const &) = delete;
+        Checkpoint &operator=(Checkpoint const &) = delete;
+
+        // Renders into img (of the size of the crop window), first loading
+        // the checkpoint when resuming
+        void render(AccumImage &img);
+
+    private:
+        bool load(AccumImage &img);
+        void commit(AccumImage const &img, size_t tile, unsigned samples);
+        void write(std::vector<uint32_t> const &samples, AccumImage const &pixels) const;
+        void writeLoop();
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include "cpu.h"
+
+// Mirrors the choice of the target_clones resolver: the highest level
+// the CPU supports.
+char const *Cpu::isa()
+{
+#ifdef RAY_MULTI_ISA_ENABLED
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4"))
+        return "x86-64-v4 (AVX-512)";
+    if (__builtin_cpu_supports("x86-64-v3"))
+        return "x86-64-v3 (AVX2)";
+    return "x86-64 (SSE2)";
+#else
+    return "baseline";
+#endif
+}
+
+char const *Cpu::kernels()
+{
+    return "BVH and shape intersection, Scene::shade, Texture::bilinear, "
+           "FastMath arrays";
+}
@@ -0,0 +1,34 @@
+#ifndef CPU_H_
+#define CPU_H_
+
+// Kernels marked RAY_MULTI_ISA are compiled for several instruction set
+// levels (x86-64-v4: AVX-512, x86-64-v3: AVX2 and FMA, and the baseline);
+// the loader selects one through CPUID when the program starts. This is
+// GCC function multiversioning, other compilers get the baseline only.
+// Virtual functions cannot be multiversioned, and with LTO a clone called
+// from another translation unit does not link, so such functions forward
+// to a RAY_MULTI_ISA member in their own file (one indirect call more).
+// Floating point contraction is off (CMakeLists.txt), so the FMA of the
+// higher levels does not change a result. RAY_BASELINE builds the baseline
+// only, for the tests comparing the levels.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__) \
+    && !defined(RAY_BASELINE)
+#define RAY_MULTI_ISA_ENABLED
+#define RAY_MULTI_ISA \
+    __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define RAY_MULTI_ISA
+#endif
+
+class Cpu
+{
+    public:
+        // Instruction set level the RAY_MULTI_ISA kernels run with,
+        // e.g. "x86-64-v3 (AVX2)"
+        static char const *isa();
+
+        // The RAY_MULTI_ISA kernels, for messages
+        static char const *kernels();
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef DIFFERENTIAL_H_
+#define DIFFERENTIAL_H_
+
+#include "ray.h"
+#include "triple.h"
+
+#include <cmath>
+
+// Ray differentials (Igehy, "Tracing Ray Differentials", 1999): how the
+// origin and direction of a ray change from one sample to the next, in x
+// and in y. At a hit they give the footprint of the sample on the surface,
+// from which textures select their mip level.
+struct RayDifferential
+{
+    Vector dOdx;
+    Vector dOdy;
+    Vector dDdx;
+    Vector dDdy;
+
+    // Primary ray through eye + d, with normalized direction; dx and dy
+    // are the distances between neighbouring samples on the image plane
+    static RayDifferential primary(Vector const &d, Vector const &dx, Vector const &dy)
+    {
+        RayDifferential diff;
+        Real len2 = d.length_2();
+        Real invLen3 = 1 / (len2 * std::sqrt(len2));
+        diff.dDdx = (len2 * dx - d.dot(dx) * d) * invLen3;
+        diff.dDdy = (len2 * dy - d.dot(dy) * d) * invLen3;
+        return diff;
+    }
+
+    // Differentials of the hit point ray.at(t) on a surface with normal N
+    void transfer(Ray const &ray, Real t, Vector const &N,
+                  Vector &dPdx, Vector &dPdy) const
+    {
+        Real DN = ray.D.dot(N);
+        dPdx = dOdx + t * dDdx;
+        dPdy = dOdy + t * dDdy;
+        if (DN != 0)
+        {
+            dPdx -= (dPdx.dot(N) / DN) * ray.D;
+            dPdy -= (dPdy.dot(N) / DN) * ray.D;
+        }
+    }
+
+    // Differentials of the mirror reflection of ray at a hit point with
+    // differentials dPdx, dPdy and normal N, changing by dNdx, dNdy
+    RayDifferential reflect(Ray const &ray, Vector const &N,
+                            Vector const &dPdx, Vector const &dPdy,
+                            Vector const &dNdx, Vector const &dNdy) const
+    {
+        RayDifferential diff;
+        Real DN = ray.D.dot(N);
+        diff.dOdx = dPdx;
+        diff.dOdy = dPdy;
+        diff.dDdx = dDdx - 2 * (DN * dNdx + (dDdx.dot(N) + ray.D.dot(dNdx)) * N);
+        diff.dDdy = dDdy - 2 * (DN * dNdy + (dDdy.dot(N) + ray.D.dot(dNdy)) * N);
+        return diff;
+    }
+};
+
+#endif
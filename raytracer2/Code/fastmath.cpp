@@ -0,0 +1,74 @@
+#include "fastmath.h"
+#include "cpu.h"
+
+FastMath::Precision FastMath::precision = FastMath::Precision::Exact;
+
+// The precision is checked once per array, the loops themselves are free
+// of branches and calls so that they can be vectorized (this file is built
+// with -fno-trapping-math -fno-math-errno, see CMakeLists.txt). They are
+// built for every ISA level of RAY_MULTI_ISA.
+
+RAY_MULTI_ISA
+void FastMath::pow(double const *x, double const *n, double *out, size_t count)
+{
+    if (precision == Precision::Exact)
+    {
+        for (size_t idx = 0; idx != count; ++idx)
+            out[idx] = std::pow(x[idx], n[idx]);
+        return;
+    }
+    for (size_t idx = 0; idx != count; ++idx)
+        out[idx] = fastPow(x[idx], n[idx]);
+}
+
+RAY_MULTI_ISA
+void FastMath::atan2(double const *y, double const *x, double *out, size_t count)
+{
+    if (precision == Precision::Exact)
+    {
+        for (size_t idx = 0; idx != count; ++idx)
+            out[idx] = std::atan2(y[idx], x[idx]);
+        return;
+    }
+    for (size_t idx = 0; idx != count; ++idx)
+        out[idx] = fastAtan2(y[idx], x[idx]);
+}
+
+RAY_MULTI_ISA
+void FastMath::asin(double const *x, double *out, size_t count)
+{
+    if (precision == Precision::Exact)
+    {
+        for (size_t idx = 0; idx != count; ++idx)
+            out[idx] = std::asin(x[idx]);
+        return;
+    }
+    for (size_t idx = 0; idx != count; ++idx)
+        out[idx] = fastAsin(x[idx]);
+}
+
+RAY_MULTI_ISA
+void FastMath::acos(double const *x, double *out, size_t count)
+{
+    if (precision == Precision::Exact)
+    {
+        for (size_t idx = 0; idx != count; ++idx)
+            out[idx] = std::acos(x[idx]);
+        return;
+    }
+    for (size_t idx = 0; idx != count; ++idx)
+        out[idx] = fastAcos(x[idx]);
+}
+
+RAY_MULTI_ISA
+void FastMath::rsqrt(double const *x, double *out, size_t count)
+{
+    if (precision == Precision::Exact)
+    {
+        for (size_t idx = 0; idx != count; ++idx)
+            out[idx] = 1 / std::sqrt(x[idx]);
+        return;
+    }
+    for (size_t idx = 0; idx != count; ++idx)
+        out[idx] = fastRsqrt(x[idx]);
+}
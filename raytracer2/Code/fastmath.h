@@ -0,0 +1,191 @@
+#ifndef FASTMATH_H_
+#define FASTMATH_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Approximations of the libm functions used while shading and texturing.
+// The precision setting selects between libm (Exact, the default) and the
+// polynomial approximations below (Fast). Every Fast kernel is branch free,
+// so the array versions compile to SIMD loops when optimizing.
+//
+// Error bounds of the Fast kernels (measured by raybench math):
+//   atan2   absolute error < 2e-8 rad      (A&S 4.4.49 on [0, 1])
+//   asin    absolute error < 3e-8 rad      (A&S 4.4.46)
+//   acos    absolute error < 3e-8 rad      (A&S 4.4.46)
+//   pow     relative error < 1e-10         (x >= 0, n * log2(x) < 1023;
+//                                           results below 2^-1022 are 0)
+//   rsqrt   relative error < 5e-11         (x > 0, 3 Newton steps)
+// Outside the documented domains the results are unspecified.
+class FastMath
+{
+    public:
+        enum class Precision
+        {
+            Exact,      // libm
+            Fast        // the approximations below
+        };
+
+        static Precision precision;
+
+// --- Scalar functions (dispatch on precision) --------------------------------
+
+        static double pow(double x, double n)
+        {
+            return precision == Precision::Exact ? std::pow(x, n) : fastPow(x, n);
+        }
+
+        static double atan2(double y, double x)
+        {
+            return precision == Precision::Exact ? std::atan2(y, x) : fastAtan2(y, x);
+        }
+
+        static double asin(double x)
+        {
+            return precision == Precision::Exact ? std::asin(x) : fastAsin(x);
+        }
+
+        static double acos(double x)
+        {
+            return precision == Precision::Exact ? std::acos(x) : fastAcos(x);
+        }
+
+        static double rsqrt(double x)   // 1 / sqrt(x)
+        {
+            return precision == Precision::Exact ? 1 / std::sqrt(x) : fastRsqrt(x);
+        }
+
+// --- Array functions: out[i] = f(in[i]) --------------------------------------
+
+        static void pow(double const *x, double const *n, double *out, size_t count);
+        static void atan2(double const *y, double const *x, double *out, size_t count);
+        static void asin(double const *x, double *out, size_t count);
+        static void acos(double const *x, double *out, size_t count);
+        static void rsqrt(double const *x, double *out, size_t count);
+
+// --- Fast kernels ------------------------------------------------------------
+
+        static double fastLog2(double x)    // x > 0
+        {
+            double const Sqrt2 = 1.41421356237309504880;
+            double const TwoTo52 = 4503599627370496.0;
+            uint64_t bits = toBits(x);
+
+            // The biased exponent is put in the mantissa of 2^52, which
+            // avoids an integer to double conversion (not vectorizable)
+            double e = fromBits(bits >> 52 | 0x4330000000000000ULL) - (TwoTo52 + 1023);
+            double m = fromBits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+
+            // m in [sqrt(1/2), sqrt(2)), so |t| <= 0.1716 below
+            double big = m > Sqrt2;
+            m *= 1 - 0.5 * big;
+            e += big;
+
+            // log2(m) = 2 / ln(2) * atanh(t), t = (m - 1) / (m + 1)
+            double t = (m - 1) / (m + 1);
+            double t2 = t * t;
+            double series = 2.88539008177792681 + t2 * (0.961796693925975604
+                          + t2 * (0.577078016355585363 + t2 * (0.412198583111132402
+                          + t2 * (0.320598897975325202 + t2 * (0.262308189252538802
+                          + t2 * 0.221953083213686679)))));
+            return e + t * series;
+        }
+
+        static double fastExp2(double y)    // flushes results below 2^-1022
+        {
+            double const Round = 6755399441055744.0;   // 1.5 * 2^52
+            double clamped = y < -1022 ? -1022 : (y > 1023 ? 1023 : y);
+
+            // y = i + f with i integer and |f| <= 1/2; the low bits of
+            // shifted hold i
+            double shifted = clamped + Round;
+            double i = shifted - Round;
+            double f = clamped - i;
+
+            // Taylor series of e^(f ln 2), truncated after f^10
+            double const Ln2 = 0.693147180559945309;
+            double g = f * Ln2;
+            double poly = 1 + g * (1 + g * (1.0 / 2 + g * (1.0 / 6 + g * (1.0 / 24
+                        + g * (1.0 / 120 + g * (1.0 / 720 + g * (1.0 / 5040
+                        + g * (1.0 / 40320 + g * (1.0 / 362880
+                        + g * (1.0 / 3628800))))))))));
+
+            double scale = fromBits((toBits(shifted) + 1023) << 52);
+            return y < -1022 ? 0 : poly * scale;
+        }
+
+        static double fastPow(double x, double n)     // x >= 0
+        {
+            double result = fastExp2(n * fastLog2(x));
+            double zero = n == 0 ? 1 : 0;               // 0^0 = 1, 0^n = 0
+            return x > 0 ? result : zero;
+        }
+
+        static double fastAtan(double a)    // a in [0, 1]
+        {
+            double a2 = a * a;
+            return a * (1 + a2 * (-0.3333314528 + a2 * (0.1999355085
+                      + a2 * (-0.1420889944 + a2 * (0.1065626393
+                      + a2 * (-0.0752896400 + a2 * (0.0429096138
+                      + a2 * (-0.0161657367 + a2 * 0.0028662257))))))));
+        }
+
+        static double fastAtan2(double y, double x)
+        {
+            double const Pi = 3.14159265358979323846;
+            double ax = std::fabs(x);
+            double ay = std::fabs(y);
+            double hi = ax > ay ? ax : ay;
+            double lo = ax > ay ? ay : ax;
+            double r = fastAtan(hi > 0 ? lo / hi : 0);
+            r = ay > ax ? Pi / 2 - r : r;
+            r = x < 0 ? Pi - r : r;
+            return fromBits(toBits(r) | (toBits(y) & 0x8000000000000000ULL));
+        }
+
+        static double fastAcos(double x)    // x in [-1, 1]
+        {
+            double const Pi = 3.14159265358979323846;
+            double ax = std::fabs(x);
+            double poly = 1.5707963050 + ax * (-0.2145988016 + ax * (0.0889789874
+                        + ax * (-0.0501743046 + ax * (0.0308918810
+                        + ax * (-0.0170881256 + ax * (0.0066700901
+                        + ax * -0.0012624911))))));
+            double r = std::sqrt(1 - ax) * poly;
+            return x < 0 ? Pi - r : r;
+        }
+
+        static double fastAsin(double x)    // x in [-1, 1]
+        {
+            double const Pi = 3.14159265358979323846;
+            return Pi / 2 - fastAcos(x);
+        }
+
+        static double fastRsqrt(double x)   // x > 0
+        {
+            double r = fromBits(0x5fe6eb50c7b537a9ULL - (toBits(x) >> 1));
+            r *= 1.5 - 0.5 * x * r * r;
+            r *= 1.5 - 0.5 * x * r * r;
+            r *= 1.5 - 0.5 * x * r * r;
+            return r;
+        }
+
+    private:
+        static uint64_t toBits(double value)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            return bits;
+        }
+
+        static double fromBits(uint64_t bits)
+        {
+            double value;
+            std::memcpy(&value, &bits, sizeof value);
+            return value;
+        }
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include "gbuffer.h"
+
+#include "fastmath.h"
+#include "hash.h"
+#include "parallel.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <typeinfo>
+
+using namespace std;
+
+// --- File format -------------------------------------------------------------
+
+namespace
+{
+    char const Magic[8] = {'R', 'A', 'Y', 'G', 'B', 'U', 'F', '1'};
+    uint32_t const Version = 1;
+
+    // Followed by the light positions (Point) and the samples, pixel by
+    // pixel of the crop window
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t lights;
+        uint64_t samples;
+        uint64_t fingerprint;
+    };
+
+    bool same(Point const &lhs, Point const &rhs)
+    {
+        return lhs.x == rhs.x && lhs.y == rhs.y && lhs.z == rhs.z;
+    }
+}
+
+// --- GBuffer -----------------------------------------------------------------
+
+uint32_t const GBuffer::NoObject;
+
+GBuffer::GBuffer(Scene &scene, string const &filename)
+:
+    scene(scene),
+    filename(filename)
+{}
+
+bool GBuffer::render(AccumImage &img)
+{
+    if (scene.wavefront || scene.integrator != Scene::Integrator::Whitted)
+    {
+        cout << "The G-buffer needs the recursive Whitted renderer, rendering without it.\n";
+        scene.render(img);
+        return false;
+    }
+
+    hashScene();
+    vector<Tile> tiles = scene.tiles();
+    vector<LightPtr> const &current = scene.lights;
+
+    if (load())
+    {
+        // shadows of the point lights at their captured positions are known
+        // (those of area lights are not kept)
+        uint32_t keep = 0;
+        unsigned kept = 0;
+        unsigned areas = 0;
+        size_t masked = min<size_t>(current.size(), 32);
+        for (size_t idx = 0; idx != min(masked, lights.size()); ++idx)
+        {
+            if (current[idx]->isArea())
+                ++areas;
+            else if (same(lights[idx], current[idx]->position))
+            {
+                keep |= uint32_t(1) << idx;
+                ++kept;
+            }
+        }
+
+        parallelFor(tiles.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t idx = begin; idx != end; ++idx)
+            {
+                reshade(img, tiles[idx], keep);
+                scene.addCounts();
+            }
+        }, 1);
+        cout << "G-buffer: re-shaded from " << filename << ", the shadows of " << kept
+             << " of " << current.size() << " lights reused.\n";
+
+        // the shadows of the moved lights are known now too
+        if (kept + areas != masked || lights.size() != current.size())
+        {
+            lights.clear();
+            for (LightPtr const &light : current)
+                lights.push_back(light->position);
+            write();
+        }
+        return true;
+    }
+
+    Tile const &crop = scene.camera.crop();
+    samples.assign(size_t(crop.width()) * crop.height() * scene.getSamplesPerPixel(), Sample());
+    lights.clear();
+    for (LightPtr const &light : current)
+        lights.push_back(light->position);
+    parallelFor(tiles.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            capture(img, tiles[idx]);
+            scene.addCounts();
+        }
+    }, 1);
+    write();
+    cout << "G-buffer: captured to " << filename << ".\n";
+    return false;
+}
+
+// What the primary hits depend on: the geometry, camera and sampler
+void GBuffer::hashScene()
+{
+    Camera const &camera = scene.camera;
+    Tile const &crop = camera.crop();
+    Sampler const &sampler = *scene.sampler;
+    Hasher hash;
+    hash.add(Version).add(sizeof(Real)).add(FastMath::precision);
+    hash.add(camera.eye()).add(camera.right()).add(camera.up()).add(camera.filmPoint(0, 0))
+        .add(crop);
+    if (camera.moves())
+        hash.add(camera.eye(1)).add(camera.filmPoint(0, 0, 1)).add(camera.filmPoint(1, 1, 1));
+    hash.add(string(typeid(sampler).name())).add(sampler.samples).add(sampler.seed);
+    hash.add(scene.objects.size());
+    for (ObjectPtr const &obj : scene.objects)
+    {
+        hash.add(string(typeid(*obj).name()));
+        obj->hashGeometry(hash);
+    }
+    fingerprint = hash.value();
+}
+
+// Renders the tile as Scene::renderTile does, keeping the first hits
+void GBuffer::capture(AccumImage &img, Tile const &tile)
+{
+    Tile const &crop = scene.camera.crop();
+    Vector dx, dy;
+    scene.sampleSpacing(dx, dy);
+    unsigned spp = scene.getSamplesPerPixel();
+    for (unsigned y = tile.y0; y != tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x != tile.x1; ++x)
+        {
+            for (unsigned idx = 0; idx != spp; ++idx)
+            {
+                Vector toPixel;
+                Ray ray = scene.primaryRay(x, y, idx, toPixel);
+                ++Scene::counts().primary;
+
+                Sample &sample = samples[sampleIndex(x, y, idx)];
+                Hit min_hit(numeric_limits<double>::infinity(), Vector());
+                unsigned objIdx = 0;
+                ObjectPtr obj = scene.intersect(ray, min_hit, objIdx);
+                Color col(0, 0, 0);
+                ShadowMask mask;
+                if (obj)
+                    col = scene.shade(ray, min_hit, obj, 0, 1.0,
+                                      scene.differentials
+                                          ? RayDifferential::primary(toPixel, dx, dy)
+                                          : RayDifferential(),
+                                      &mask);
+                sample = Sample{min_hit.t, min_hit.N, obj ? objIdx : NoObject,
+                                mask.known, mask.lit};
+                col.clamp();
+                img(x - crop.x0, y - crop.y0).add(col);
+            }
+        }
+    }
+}
+
+// Shades the captured hits, the shadows of the lights in keep are reused
+void GBuffer::reshade(AccumImage &img, Tile const &tile, uint32_t keep)
+{
+    Tile const &crop = scene.camera.crop();
+    Vector dx, dy;
+    scene.sampleSpacing(dx, dy);
+    unsigned spp = scene.getSamplesPerPixel();
+    for (unsigned y = tile.y0; y != tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x != tile.x1; ++x)
+        {
+            for (unsigned idx = 0; idx != spp; ++idx)
+            {
+                Sample &sample = samples[sampleIndex(x, y, idx)];
+                Color col(0, 0, 0);
+                if (sample.object != NoObject)
+                {
+                    Vector toPixel;
+                    Ray ray = scene.primaryRay(x, y, idx, toPixel);
+                    ShadowMask mask;
+                    mask.known = sample.known & keep;
+                    mask.lit = sample.lit & keep;
+                    col = scene.shade(ray, Hit(sample.t, sample.N), scene.objects[sample.object],
+                                      0, 1.0,
+                                      scene.differentials
+                                          ? RayDifferential::primary(toPixel, dx, dy)
+                                          : RayDifferential(),
+                                      &mask);
+                    sample.known = mask.known;
+                    sample.lit = mask.lit;
+                }
+                col.clamp();
+                img(x - crop.x0, y - crop.y0).add(col);
+            }
+        }
+    }
+}
+
+size_t GBuffer::sampleIndex(unsigned x, unsigned y, unsigned index) const
+{
+    Tile const &crop = scene.camera.crop();
+    size_t pixel = size_t(y - crop.y0) * crop.width() + (x - crop.x0);
+    return pixel * scene.getSamplesPerPixel() + index;
+}
+
+// The lights and samples of a buffer of this scene, false if there is none
+bool GBuffer::load()
+{
+    Tile const &crop = scene.camera.crop();
+    size_t count = size_t(crop.width()) * crop.height() * scene.getSamplesPerPixel();
+
+    ifstream file(filename, ios::binary);
+    Header header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || !equal(Magic, Magic + 8, header.magic) || header.version != Version
+        || header.fingerprint != fingerprint || header.samples != count)
+        return false;
+
+    vector<Point> positions(header.lights);
+    vector<Sample> captured(count);
+    if (!file.read(reinterpret_cast<char *>(positions.data()), positions.size() * sizeof(Point))
+        || !file.read(reinterpret_cast<char *>(captured.data()), captured.size() * sizeof(Sample)))
+        return false;
+    for (Sample const &sample : captured)
+        if (sample.object != NoObject && sample.object >= scene.objects.size())
+            return false;
+
+    lights.swap(positions);
+    samples.swap(captured);
+    return true;
+}
+
+// Writes the buffer next to the file and renames it, so an interrupted
+// write leaves the previous buffer intact
+void GBuffer::write() const
+{
+    Header header = {};
+    copy(Magic, Magic + 8, header.magic);
+    header.version = Version;
+    header.lights = lights.size();
+    header.samples = samples.size();
+    header.fingerprint = fingerprint;
+
+    string temporary = filename + ".tmp";
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(lights.data()), lights.size() * sizeof(Point));
+    file.write(reinterpret_cast<char const *>(samples.data()), samples.size() * sizeof(Sample));
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0)
+        cerr << "Could not write G-buffer " << filename << ".\n";
+}
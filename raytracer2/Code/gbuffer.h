@@ -0,0 +1,65 @@
+#ifndef GBUFFER_H_
+#define GBUFFER_H_
+
+#include "image.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Scene;
+struct Tile;
+
+// The first hits of all samples of a render, so that edits of the lights
+// (color, position) and of the materials (color, ka, kd, ks, n) can be
+// re-shaded without tracing the primary rays again.
+//
+// Per sample the buffer holds the distance of the hit, from which the
+// position (and the texture coordinates the object derives from it)
+// follow, the normal, the object (and so its material) and which lights
+// reached the hit. A re-shade casts the shadow rays of lights that moved
+// or were added only, and the reflections of reflecting materials; the
+// image is identical to a full render. The buffer is valid for the
+// geometry, camera and sampler it was captured with, which its
+// fingerprint covers.
+class GBuffer
+{
+    public:
+        static uint32_t const NoObject = UINT32_MAX;
+
+        struct Sample
+        {
+            Real t;
+            Vector N;
+            uint32_t object;            // index in the scene, or NoObject
+            uint32_t known;             // ShadowMask
+            uint32_t lit;
+        };
+
+    private:
+        Scene &scene;
+        std::string filename;
+        uint64_t fingerprint = 0;
+        std::vector<Point> lights;      // positions the shadows are known for
+        std::vector<Sample> samples;    // per pixel of the crop window
+
+    public:
+        GBuffer(Scene &scene, std::string const &filename);
+
+        // Re-shades img (the crop window) from the buffer if it matches the
+        // scene, and otherwise renders it and captures the buffer; returns
+        // whether it re-shaded
+        bool render(AccumImage &img);
+
+    private:
+        void hashScene();
+        void capture(AccumImage &img, Tile const &tile);
+        void reshade(AccumImage &img, Tile const &tile, uint32_t keep);
+        size_t sampleIndex(unsigned x, unsigned y, unsigned index) const;
+
+        bool load();
+        void write() const;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+// 64 bit FNV-1a hash of a sequence of values, for content addressing (not
+// for security). Values are hashed by their bytes: 0.0 and -0.0 differ.
+class Hasher
+{
+    uint64_t d_value = 0xcbf29ce484222325ULL;
+
+    public:
+        Hasher &add(void const *data, size_t bytes)
+        {
+            unsigned char const *byte = static_cast<unsigned char const *>(data);
+            for (size_t idx = 0; idx != bytes; ++idx)
+                d_value = (d_value ^ byte[idx]) * 0x100000001b3ULL;
+            return *this;
+        }
+
+        template <typename T>
+        Hasher &add(T const &value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "hashed by its bytes");
+            return add(&value, sizeof(T));
+        }
+
+        Hasher &add(std::string const &text)
+        {
+            add(text.size());
+            return add(text.data(), text.size());
+        }
+
+        uint64_t value() const { return d_value; };
+};
+
+#endif
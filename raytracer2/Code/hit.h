@@ -4,26 +4,37 @@
 #include "triple.h"
 #include <limits>
 
-class Hit
+template <typename T>
+class HitT
 {
     public:
-        double t;   // distance of hit
-        Vector N;   // Normal at hit
+        T t;            // distance of hit
+        TripleT<T> N;   // Normal at hit
 
-        Hit(double time, Vector const &normal)
+        HitT(T time, TripleT<T> const &normal)
         :
             t(time),
             N(normal)
         {}
 
-        static Hit const NO_HIT()
+        // Distance a hit point is moved back along the ray, so that rays
+        // leaving it do not hit the same surface again. Float needs a much
+        // larger offset at the scale of the scenes.
+        static T offset()
         {
-            static Hit no_hit(std::numeric_limits<double>::quiet_NaN(),
-                              Vector(std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN()));
+            return sizeof(T) == sizeof(float) ? T(1e-2) : T(1e-10);
+        }
+
+        static HitT const NO_HIT()
+        {
+            static HitT no_hit(std::numeric_limits<T>::quiet_NaN(),
+                               TripleT<T>(std::numeric_limits<T>::quiet_NaN(),
+                                          std::numeric_limits<T>::quiet_NaN(),
+                                          std::numeric_limits<T>::quiet_NaN()));
             return no_hit;
         }
 };
 
+typedef HitT<Real> Hit;
+
 #endif
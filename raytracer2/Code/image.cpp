@@ -1,99 +1,133 @@
 #include "image.h"
 
 #include "lode/lodepng.h"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
 using namespace std;
 
-Image::Image(unsigned width, unsigned height)
-:
-    d_pixels(width * height),
-    d_width(width),
-    d_height(height)
-{}
+// --- Pixel conversion --------------------------------------------------------
 
-Image::Image(string const &filename)
+namespace
 {
-    read_png(filename);
-}
-
-// normal accessors
-void Image::put_pixel(unsigned x, unsigned y, Color const &c)
-{
-    (*this)(x, y) = c;
-}
-Color Image::get_pixel(unsigned x, unsigned y) const
-{
-    return (*this)(x, y);
-}
+    uint8_t quantize(double value)
+    {
+        return static_cast<uint8_t>(min(max(value, 0.0), 1.0) * 255.0);
+    }
 
-// Handier accessors
-// Usage: color = img(x,y);
-//        img(x,y) = color;
-Color const&Image::operator()(unsigned x, unsigned y) const
-{
-    return d_pixels.at(index(x, y));
-}
-Color &Image::operator()(unsigned x, unsigned y)
-{
-    return d_pixels.at(index(x, y));
-}
+    template <typename T>
+    Rgba8 toRgba8(TripleT<T> const &pixel)
+    {
+        Rgba8 rgba;
+        rgba.r = quantize(pixel.r);
+        rgba.g = quantize(pixel.g);
+        rgba.b = quantize(pixel.b);
+        return rgba;                // alpha is always 1
+    }
 
-unsigned Image::width() const
-{
-    return d_width;
-}
+    Rgba8 toRgba8(Rgba8 const &pixel)
+    {
+        return pixel;
+    }
 
-unsigned Image::height() const
-{
-    return d_height;
-}
+    template <typename T>
+    void fromRgba8(Rgba8 const &rgba, TripleT<T> &pixel)
+    {
+        // Ignore Alpha
+        pixel.set(rgba.r / T(255), rgba.g / T(255), rgba.b / T(255));
+    }
 
-unsigned Image::size() const
-{
-    return d_width * d_height;
+    void fromRgba8(Rgba8 const &rgba, Rgba8 &pixel)
+    {
+        pixel = rgba;
+    }
 }
 
-// Normalized accessors, unsignederval is (0...1, 0...1)
-// usefull for texture access
-Color const &Image::colorAt(float x, float y) const
-{
-    return d_pixels.at(findex(x, y));
-}
+// --- PNG IO ------------------------------------------------------------------
 
-void Image::write_png(std::string const &filename) const
+template <typename Pixel>
+void ImageT<Pixel>::write_png(std::string const &filename) const
 {
     vector<unsigned char> image;
     image.reserve(size() * 4);  // reserves size (less allocations)
-    for (Color pixel : d_pixels)
+    for (Pixel const &pixel : d_pixels)
     {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
-        image.push_back(255);   // alpha is always 1
+        Rgba8 rgba = toRgba8(pixel);
+        image.push_back(rgba.r);
+        image.push_back(rgba.g);
+        image.push_back(rgba.b);
+        image.push_back(rgba.a);
     }
 
     lodepng::encode(filename, image, d_width, d_height);
 }
 
-void Image::read_png(std::string const &filename)
+template <typename Pixel>
+void ImageT<Pixel>::read_png(std::string const &filename)
 {
     vector<unsigned char> image;
     lodepng::decode(image, d_width, d_height, filename);
-    d_pixels.reserve(size());
+    d_pixels.resize(size());
 
-    auto imgIter = image.begin();
-    while (imgIter != image.end())
+    for (size_t idx = 0; idx != d_pixels.size(); ++idx)
     {
-        double r = (*imgIter) / 255.0;
-        ++imgIter;
-        double g = (*imgIter) / 255.0;
-        ++imgIter;
-        double b = (*imgIter) / 255.0;
-        ++imgIter;
-        // Ignore Alpha
-        ++imgIter;
-        d_pixels.push_back(Color(r, g, b));
+        Rgba8 rgba;
+        rgba.r = image[4 * idx];
+        rgba.g = image[4 * idx + 1];
+        rgba.b = image[4 * idx + 2];
+        rgba.a = image[4 * idx + 3];
+        fromRgba8(rgba, d_pixels[idx]);
+    }
+}
+
+template void ImageT<TripleT<float>>::write_png(string const &filename) const;
+template void ImageT<TripleT<float>>::read_png(string const &filename);
+template void ImageT<TripleT<double>>::write_png(string const &filename) const;
+template void ImageT<TripleT<double>>::read_png(string const &filename);
+template void ImageT<Rgba8>::write_png(string const &filename) const;
+template void ImageT<Rgba8>::read_png(string const &filename);
+
+// --- Resolve -----------------------------------------------------------------
+
+Rgba8Image resolve(AccumImage const &img)
+{
+    Rgba8Image out(img.width(), img.height());
+    for (unsigned y = 0; y != img.height(); ++y)
+    {
+        RgbSum const *in = img.row(y);
+        Rgba8 *pixel = out.row(y);
+        for (unsigned x = 0; x != img.width(); ++x)
+            pixel[x] = toRgba8(in[x].mean());
+    }
+    return out;
+}
+
+// Next level of a mip pyramid: every texel is the mean of 2x2 texels,
+// repeating the last row and column of odd sizes
+Rgba8Image downsample(Rgba8Image const &texels)
+{
+    unsigned width = texels.width();
+    unsigned height = texels.height();
+    Rgba8Image half(max(width / 2, 1u), max(height / 2, 1u));
+    for (unsigned y = 0; y != half.height(); ++y)
+    {
+        unsigned y0 = min(2 * y, height - 1);
+        unsigned y1 = min(2 * y + 1, height - 1);
+        for (unsigned x = 0; x != half.width(); ++x)
+        {
+            unsigned x0 = min(2 * x, width - 1);
+            unsigned x1 = min(2 * x + 1, width - 1);
+            Rgba8 const &a = texels(x0, y0);
+            Rgba8 const &b = texels(x1, y0);
+            Rgba8 const &c = texels(x0, y1);
+            Rgba8 const &d = texels(x1, y1);
+            Rgba8 &mean = half(x, y);
+            mean.r = (a.r + b.r + c.r + d.r + 2) / 4;
+            mean.g = (a.g + b.g + c.g + d.g + 2) / 4;
+            mean.b = (a.b + b.b + c.b + d.b + 2) / 4;
+            mean.a = (a.a + b.a + c.a + d.a + 2) / 4;
+        }
     }
+    return half;
 }
@@ -3,36 +3,119 @@
 
 #include "triple.h"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
-class Image
+// --- Pixel formats -----------------------------------------------------------
+
+// Sum of the samples of a pixel and their number, rendered into
+struct RgbSum
+{
+    float r = 0;
+    float g = 0;
+    float b = 0;
+    unsigned samples = 0;
+
+    void add(Color const &c)
+    {
+        r += c.r;
+        g += c.g;
+        b += c.b;
+        ++samples;
+    }
+
+    Color mean() const
+    {
+        return samples == 0 ? Color() : Color(r, g, b) / samples;
+    }
+};
+
+// Packed 8 bit color, as written to png
+struct Rgba8
+{
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+    uint8_t a = 255;
+};
+
+// --- Image -------------------------------------------------------------------
+
+// A width x height array of pixels, stored row by row. The accessors are
+// defined in this header so that they can be inlined; the png IO is
+// instantiated in image.cpp for the pixel formats that have one.
+template <typename Pixel>
+class ImageT
 {
-    std::vector<Color> d_pixels;
+    std::vector<Pixel> d_pixels;
     unsigned d_width;
     unsigned d_height;
 
     public:
-        Image(unsigned width = 0, unsigned height = 0);
-        Image(std::string const &filename);
+        ImageT(unsigned width = 0, unsigned height = 0)
+        :
+            d_pixels(width * height),
+            d_width(width),
+            d_height(height)
+        {}
 
-        // normal accessors
-        void put_pixel(unsigned x, unsigned y, Color const &c);
-        Color get_pixel(unsigned x, unsigned y) const;
+        ImageT(std::string const &filename)
+        {
+            read_png(filename);
+        }
 
-        // Handier accessors
+        // normal accessors (bounds checked)
+        void put_pixel(unsigned x, unsigned y, Pixel const &c)
+        {
+            d_pixels.at(index(x, y)) = c;
+        }
+        Pixel get_pixel(unsigned x, unsigned y) const
+        {
+            return d_pixels.at(index(x, y));
+        }
+
+        // Handier accessors (unchecked)
         // Usage: color = img(x,y);
         //        img(x,y) = color;
-        Color const &operator()(unsigned x, unsigned y) const;
-        Color &operator()(unsigned x, unsigned y);
+        Pixel const &operator()(unsigned x, unsigned y) const
+        {
+            return d_pixels[index(x, y)];
+        }
+        Pixel &operator()(unsigned x, unsigned y)
+        {
+            return d_pixels[index(x, y)];
+        }
 
-        unsigned width() const;
-        unsigned height() const;
-        unsigned size() const;
+        // First pixel of row y (unchecked), the row holds width() pixels
+        Pixel const *row(unsigned y) const
+        {
+            return d_pixels.data() + index(0, y);
+        }
+        Pixel *row(unsigned y)
+        {
+            return d_pixels.data() + index(0, y);
+        }
+
+        unsigned width() const
+        {
+            return d_width;
+        }
+        unsigned height() const
+        {
+            return d_height;
+        }
+        unsigned size() const
+        {
+            return d_width * d_height;
+        }
 
         // Normalized accessors, unsignederval is (0...1, 0...1)
         // usefull for texture access
-        Color const &colorAt(float x, float y) const;
+        Pixel const &colorAt(float x, float y) const
+        {
+            return d_pixels.at(findex(x, y));
+        }
 
         void write_png(std::string const &filename) const;
         void read_png(std::string const &filename);
@@ -52,4 +135,15 @@ class Image
 
 };
 
+typedef ImageT<Color> Image;            // colors
+typedef ImageT<RgbSum> AccumImage;      // render target
+typedef ImageT<Rgba8> Rgba8Image;       // output
+
+// The mean of every pixel, clamped to [0, 1] and quantized
+Rgba8Image resolve(AccumImage const &img);
+
+// The next level of a mip pyramid: half the size, every pixel the mean of
+// 2x2 pixels
+Rgba8Image downsample(Rgba8Image const &img);
+
 #endif
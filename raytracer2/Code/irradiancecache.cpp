@@ -0,0 +1,478 @@
+#include "irradiancecache.h"
+
+#include "fastmath.h"
+#include "hash.h"
+#include "hit.h"
+#include "material.h"
+#include "parallel.h"
+#include "photonmap.h"
+#include "random.h"
+#include "scene.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <typeinfo>
+
+using namespace std;
+
+namespace
+{
+    double const Pi = 3.14159265358979323846;
+    unsigned const MaxDepth = 24;       // of the octree
+
+    char const Magic[8] = {'R', 'A', 'Y', 'I', 'R', 'R', 'C', '1'};
+    uint32_t const Version = 1;
+
+    // Followed by the records
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t records;
+        uint64_t fingerprint;
+    };
+
+    // Whether the point lies in the cube of the given half size around center
+    bool inside(Point const &point, Point const &center, Real half)
+    {
+        return fabs(point.x - center.x) <= half && fabs(point.y - center.y) <= half
+            && fabs(point.z - center.z) <= half;
+    }
+
+    Point childCenter(Point const &center, Real half, unsigned child)
+    {
+        Real quarter = half / 2;
+        return center + Vector(child & 1 ? quarter : -quarter, child & 2 ? quarter : -quarter,
+                               child & 4 ? quarter : -quarter);
+    }
+
+    unsigned childIndex(Point const &point, Point const &center)
+    {
+        return (point.x >= center.x ? 1 : 0) | (point.y >= center.y ? 2 : 0)
+             | (point.z >= center.z ? 4 : 0);
+    }
+}
+
+// --- Node --------------------------------------------------------------------
+
+IrradianceCache::Node::Node()
+{
+    for (atomic<Node *> &child : children)
+        child.store(nullptr, memory_order_relaxed);
+    entries.store(nullptr, memory_order_relaxed);
+}
+
+IrradianceCache::Node::~Node()
+{
+    for (atomic<Node *> &child : children)
+        delete child.load(memory_order_relaxed);
+    Entry *entry = entries.load(memory_order_relaxed);
+    while (entry)
+    {
+        Entry *next = entry->next;
+        delete entry;
+        entry = next;
+    }
+}
+
+// --- IrradianceCache ---------------------------------------------------------
+
+// The root node holds the bounded objects, the eye, the film and the
+// lights, and much of the space around them, where hits on unbounded
+// objects (planes) lie; records outside it stay in the root
+IrradianceCache::IrradianceCache(Scene &scene, IrradianceSettings const &settings)
+:
+    scene(scene),
+    settings(settings)
+{
+    Real const Inf = numeric_limits<Real>::infinity();
+    Point lower(Inf, Inf, Inf);
+    Point upper(-Inf, -Inf, -Inf);
+    auto extend = [&](Point const &point, Real radius)
+    {
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            lower.data[axis] = min(lower.data[axis], point.data[axis] - radius);
+            upper.data[axis] = max(upper.data[axis], point.data[axis] + radius);
+        }
+    };
+    for (ObjectPtr const &obj : scene.objects)
+    {
+        Point sphereCenter;
+        Real radius;
+        if (obj->bounds(sphereCenter, radius))
+            extend(sphereCenter, radius);
+    }
+    Camera const &camera = scene.camera;
+    extend(camera.eye(), 0);
+    extend(camera.filmPoint(0, 0), 0);
+    extend(camera.filmPoint(camera.width(), camera.height()), 0);
+    for (LightPtr const &light : scene.lights)
+        extend(light->position, light->extent());
+
+    center = (lower + upper) / 2;
+    Vector extent = upper - lower;
+    halfSize = max({extent.x, extent.y, extent.z, Real(1)}) * 32;
+
+    Point filmCenter = camera.filmPoint(camera.width() / Real(2), camera.height() / Real(2));
+    pixelAngle = camera.up().length() / (filmCenter - camera.eye()).length();
+
+    hashScene();
+}
+
+IrradianceCache::~IrradianceCache()
+{
+    Stored *owner = stored.load(memory_order_relaxed);
+    while (owner)
+    {
+        Stored *next = owner->next;
+        delete owner;
+        owner = next;
+    }
+}
+
+Color IrradianceCache::at(Point const &point, Vector const &normal)
+{
+    Vector N = normal.normalized();
+    Color irradiance;
+    if (interpolate(point, N, irradiance))
+    {
+        ++interpolated;
+        return irradiance;
+    }
+    ++computed;
+    Record record = compute(point, N);
+    insert(record);
+    return record.irradiance;
+}
+
+void IrradianceCache::precompute(unsigned spacing)
+{
+    Camera const &camera = scene.camera;
+    Tile const &crop = camera.crop();
+    unsigned columns = (crop.width() + spacing - 1) / spacing;
+    unsigned rows = (crop.height() + spacing - 1) / spacing;
+    parallelFor(size_t(columns) * rows, [&](size_t begin, size_t end)
+    {
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            unsigned x = crop.x0 + unsigned(idx % columns) * spacing;
+            unsigned y = crop.y0 + unsigned(idx / columns) * spacing;
+            Point pixel = camera.filmPoint(x + Real(0.5), y + Real(0.5));
+            Ray ray(camera.eye(), (pixel - camera.eye()).normalized());
+            ++Scene::counts().primary;
+
+            Hit min_hit(numeric_limits<double>::infinity(), Vector());
+            unsigned objIdx = 0;
+            if (!scene.intersect(ray, min_hit, objIdx))
+                continue;
+            Vector N = min_hit.N;
+            if (N.dot(ray.D) > 0)
+                N = -N;
+            at(ray.at(min_hit.t - Hit::offset()), N);
+        }
+        scene.addCounts();
+    }, 16);
+}
+
+// The weighted mean of the records valid at the point, false if there are
+// none; the nodes containing the point hold every record that may be
+bool IrradianceCache::interpolate(Point const &point, Vector const &normal,
+                                  Color &irradiance) const
+{
+    Real const accuracy = Real(settings.accuracy);
+    Color sum(0, 0, 0);
+    Real weights = 0;
+
+    Node const *node = &root;
+    Point nodeCenter = center;
+    Real half = halfSize;
+    while (node)
+    {
+        for (Entry const *entry = node->entries.load(memory_order_acquire); entry;
+             entry = entry->next)
+        {
+            Record const &record = *entry->record;
+            Vector offset = point - record.position;
+            Real cosine = min(Real(1), normal.dot(record.normal));
+            Real error = offset.length() / record.radius + sqrt(1 - cosine);
+            if (error >= accuracy)
+                continue;
+            // the point may not lie in front of the record
+            if (offset.dot(normal + record.normal) < -Real(0.02) * record.radius)
+                continue;
+
+            Color value = record.irradiance;
+            if (settings.gradients)
+            {
+                Vector rotation = record.normal.cross(normal);
+                for (int channel = 0; channel != 3; ++channel)
+                    value.data[channel] += rotation.dot(record.rotational[channel])
+                                         + offset.dot(record.translational[channel]);
+                value = Color(max(value.r, Real(0)), max(value.g, Real(0)),
+                              max(value.b, Real(0)));
+            }
+            Real weight = 1 / max(error, Real(1e-6)) - 1 / accuracy;
+            sum += weight * value;
+            weights += weight;
+        }
+
+        if (!inside(point, nodeCenter, half))
+            break;
+        unsigned child = childIndex(point, nodeCenter);
+        node = node->children[child].load(memory_order_acquire);
+        nodeCenter = childCenter(nodeCenter, half, child);
+        half /= 2;
+    }
+
+    if (weights <= 0)
+        return false;
+    irradiance = sum / weights;
+    return true;
+}
+
+// Casts M x N rays over strata of equal solid angle weighted by the
+// cosine, M = sqrt(rays / pi) rings and N = pi M sectors
+IrradianceCache::Record IrradianceCache::compute(Point const &point, Vector const &normal) const
+{
+    unsigned rings = max(1u, unsigned(lround(sqrt(settings.rays / Pi))));
+    unsigned sectors = max(3u, unsigned(lround(double(settings.rays) / rings)));
+
+    Vector helper = fabs(normal.x) > Real(0.9) ? Vector(0, 1, 0) : Vector(1, 0, 0);
+    Vector u = helper.cross(normal).normalized();
+    Vector v = normal.cross(u);
+
+    vector<Color> radiance(rings * sectors);
+    vector<Real> distance(rings * sectors);
+    Random jitter(Hasher().add(point).value());   // the same for every run
+    for (unsigned j = 0; j != rings; ++j)
+    {
+        for (unsigned k = 0; k != sectors; ++k)
+        {
+            double sine = sqrt((j + jitter.next()) / rings);
+            double cosine = sqrt(max(0.0, 1 - sine * sine));
+            double phi = 2 * Pi * (k + jitter.next()) / sectors;
+            Vector direction = Real(cos(phi) * sine) * u + Real(sin(phi) * sine) * v
+                             + Real(cosine) * normal;
+            Ray ray(point, direction.normalized());
+            ++Scene::counts().indirect;
+
+            Hit min_hit(numeric_limits<double>::infinity(), Vector());
+            unsigned objIdx = 0;
+            ObjectPtr obj = scene.intersect(ray, min_hit, objIdx);
+            size_t idx = j * sectors + k;
+            distance[idx] = obj ? min_hit.t : numeric_limits<Real>::infinity();
+            // shaded without reflections or indirect light of its own
+            radiance[idx] = obj ? scene.shade(ray, min_hit, obj, scene.recursionDepth + 1, 1.0,
+                                              RayDifferential())
+                                : Color(0, 0, 0);
+        }
+    }
+
+    Record record;
+    record.position = point;
+    record.normal = normal;
+    Color sum(0, 0, 0);
+    Real inverseDistances = 0;
+    for (size_t idx = 0; idx != radiance.size(); ++idx)
+    {
+        sum += radiance[idx];
+        inverseDistances += 1 / distance[idx];
+    }
+    Real scale = Real(Pi / (rings * sectors));
+    record.irradiance = scale * sum;
+
+    for (int channel = 0; channel != 3; ++channel)
+        record.rotational[channel] = record.translational[channel] = Vector(0, 0, 0);
+    for (unsigned k = 0; k != sectors; ++k)
+    {
+        double phi = 2 * Pi * (k + 0.5) / sectors;
+        double phiMinus = 2 * Pi * k / sectors;
+        Vector uk = Real(cos(phi)) * u + Real(sin(phi)) * v;
+        Vector vk = Real(-sin(phi)) * u + Real(cos(phi)) * v;
+        Vector vkMinus = Real(-sin(phiMinus)) * u + Real(cos(phiMinus)) * v;
+        unsigned previous = (k + sectors - 1) % sectors;
+        for (unsigned j = 0; j != rings; ++j)
+        {
+            Color const &L = radiance[j * sectors + k];
+            double sine = sqrt((j + 0.5) / rings);
+            double cosine = sqrt(1 - sine * sine);
+
+            // tilting the normal towards a ray weighs it by its tangent
+            Real tangent = Real(sine / cosine) * scale;
+            for (int channel = 0; channel != 3; ++channel)
+                record.rotational[channel] += tangent * L.data[channel] * vk;
+
+            // translation moves the boundaries between the rings ...
+            if (j != 0)
+            {
+                double boundary = j / double(rings);    // sin^2 of its angle
+                Real closest = min(distance[j * sectors + k], distance[(j - 1) * sectors + k]);
+                Real factor = Real(2 * Pi / sectors * sqrt(boundary) * (1 - boundary)) / closest;
+                Color difference = L - radiance[(j - 1) * sectors + k];
+                for (int channel = 0; channel != 3; ++channel)
+                    record.translational[channel] += factor * difference.data[channel] * uk;
+            }
+            // ... and between the sectors
+            Real closest = min(distance[j * sectors + k], distance[j * sectors + previous]);
+            Real factor = Real(sqrt((j + 1) / double(rings)) - sqrt(j / double(rings))) / closest;
+            Color difference = L - radiance[j * sectors + previous];
+            for (int channel = 0; channel != 3; ++channel)
+                record.translational[channel] += factor * difference.data[channel] * vkMinus;
+        }
+    }
+
+    // Harmonic mean distance, no further than the gradient allows, clamped
+    // to the spacings in pixels at the record's distance from the eye
+    Real radius = inverseDistances > 0 ? rings * sectors / inverseDistances
+                                       : numeric_limits<Real>::infinity();
+    if (settings.gradients)
+    {
+        for (int channel = 0; channel != 3; ++channel)
+        {
+            Real gradient = record.translational[channel].length();
+            if (gradient > 0 && record.irradiance.data[channel] > 0)
+                radius = min(radius, record.irradiance.data[channel] / gradient);
+        }
+    }
+    Real pixel = (point - scene.camera.eye()).length() * pixelAngle;
+    record.radius = min(max(radius, Real(settings.minSpacing) * pixel),
+                        Real(settings.maxSpacing) * pixel);
+    return record;
+}
+
+void IrradianceCache::insert(Record const &record)
+{
+    Stored *owner = new Stored{record, stored.load(memory_order_relaxed)};
+    while (!stored.compare_exchange_weak(owner->next, owner, memory_order_release,
+                                         memory_order_relaxed))
+        ;
+    ++records;
+    insert(root, center, halfSize, 0, owner->record, Real(settings.accuracy) * record.radius);
+}
+
+// Into the children its validity box overlaps while they are at least as
+// large as the validity radius; a record outside them stays in the node
+void IrradianceCache::insert(Node &node, Point const &nodeCenter, Real half, unsigned depth,
+                             Record const &record, Real validity)
+{
+    bool stays = depth == MaxDepth || half / 2 < validity;
+    if (!stays)
+    {
+        stays = true;
+        for (unsigned child = 0; child != 8; ++child)
+        {
+            Point next = childCenter(nodeCenter, half, child);
+            Vector distance = record.position - next;
+            if (fabs(distance.x) > half / 2 + validity || fabs(distance.y) > half / 2 + validity
+                || fabs(distance.z) > half / 2 + validity)
+                continue;
+
+            Node *existing = node.children[child].load(memory_order_acquire);
+            if (!existing)
+            {
+                Node *created = new Node;
+                if (node.children[child].compare_exchange_strong(existing, created,
+                                                                  memory_order_acq_rel))
+                    existing = created;
+                else
+                    delete created;         // another thread was first
+            }
+            insert(*existing, next, half / 2, depth + 1, record, validity);
+            stays = false;
+        }
+    }
+    if (!stays)
+        return;
+
+    Entry *entry = new Entry{&record, node.entries.load(memory_order_relaxed)};
+    while (!node.entries.compare_exchange_weak(entry->next, entry, memory_order_release,
+                                               memory_order_relaxed))
+        ;
+}
+
+// What the records depend on: the geometry, materials and lights of the
+// scene and the settings of the records, not the camera
+void IrradianceCache::hashScene()
+{
+    Hasher hash;
+    hash.add(Version).add(sizeof(Real)).add(FastMath::precision);
+    hash.add(settings.rays).add(settings.minSpacing).add(settings.maxSpacing)
+        .add(settings.gradients);
+    hash.add(scene.shadows);
+    if (scene.photons)
+    {
+        // the gathered hits add the photons' indirect light
+        PhotonSettings const &photons = scene.photons->getSettings();
+        hash.add(photons.caustics).add(photons.indirect).add(photons.nearest).add(photons.radius);
+    }
+    for (LightPtr const &light : scene.lights)
+        light->hash(hash);
+
+    map<Texture const *, uint64_t> digests;
+    hash.add(scene.objects.size());
+    for (ObjectPtr const &obj : scene.objects)
+    {
+        hash.add(string(typeid(*obj).name()));
+        obj->hashGeometry(hash);
+        Material const &mat = obj->material;
+        hash.add(mat.color).add(mat.textured).add(mat.ka).add(mat.kd).add(mat.ks).add(mat.n);
+        if (mat.textured)
+        {
+            auto digest = digests.find(mat.texture.get());
+            if (digest == digests.end())
+                digest = digests.emplace(mat.texture.get(), mat.texture->digest()).first;
+            hash.add(digest->second);
+        }
+    }
+    fingerprint = hash.value();
+}
+
+bool IrradianceCache::load(string const &filename)
+{
+    ifstream file(filename, ios::binary);
+    Header header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || !equal(Magic, Magic + 8, header.magic) || header.version != Version
+        || header.recordSize != sizeof(Record) || header.fingerprint != fingerprint)
+        return false;
+
+    vector<Record> loaded(header.records);
+    if (!file.read(reinterpret_cast<char *>(loaded.data()), loaded.size() * sizeof(Record)))
+        return false;
+    for (Record const &record : loaded)
+        insert(record);
+    return true;
+}
+
+// Writes the records next to the file and renames it, so an interrupted
+// write leaves the previous file intact
+void IrradianceCache::save(string const &filename) const
+{
+    vector<Record> saved;
+    for (Stored const *owner = stored.load(memory_order_acquire); owner; owner = owner->next)
+        saved.push_back(owner->record);
+
+    Header header = {};
+    copy(Magic, Magic + 8, header.magic);
+    header.version = Version;
+    header.recordSize = sizeof(Record);
+    header.records = saved.size();
+    header.fingerprint = fingerprint;
+
+    string temporary = filename + ".tmp";
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(saved.data()), saved.size() * sizeof(Record));
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0)
+        cerr << "Could not write irradiance cache " << filename << ".\n";
+}
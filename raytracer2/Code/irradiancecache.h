@@ -0,0 +1,125 @@
+#ifndef IRRADIANCECACHE_H_
+#define IRRADIANCECACHE_H_
+
+#include "triple.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Scene;
+
+// "IrradianceCache" of the scene file; its presence turns diffuse
+// interreflection on
+struct IrradianceSettings
+{
+    bool enabled = false;
+    double accuracy = 0.2;          // largest interpolation error, "a" of Ward
+    unsigned rays = 256;            // hemisphere rays per record
+    double minSpacing = 10;         // clamps of a record's radius, in pixels
+    double maxSpacing = 100;        // of the camera that computes it
+    bool gradients = true;          // interpolate with gradients
+    unsigned precompute = 0;        // pixel spacing of the first pass, 0: none
+    std::string file;               // loaded if valid and saved, if set
+};
+
+// Irradiance cache (Ward et al. 1988) of the indirect diffuse light: the
+// irradiance of a point is interpolated from the records nearby, and only
+// computed, by casting a stratified hemisphere of rays, where none is close
+// enough. A record is valid within accuracy times the harmonic mean
+// distance of its rays' hits (limited by its gradient and clamped to the
+// spacings, which are in pixels projected to the record); the
+// rotational and translational gradients (Ward and Heckbert 1992) extrapolate
+// it to the point and normal looked up.
+//
+// Records are kept in an octree, in every node of the size of their
+// validity radius they overlap, so a lookup only visits the nodes
+// containing its point. Threads insert nodes and records with
+// compare-and-swap and never remove any, so lookups run without locks while
+// others insert.
+// The records are stored in world space: a file of them stays valid when
+// only the camera changes, which its fingerprint (geometry, materials,
+// lights and settings) ignores. The result of a render depends on the order
+// in which the threads add records.
+class IrradianceCache
+{
+    public:
+        struct Record
+        {
+            Point position;
+            Vector normal;
+            Color irradiance;
+            Real radius;                // harmonic mean distance, clamped
+            Vector rotational[3];       // gradients, per color channel
+            Vector translational[3];
+        };
+
+    private:
+        // Records are owned by a list of all of them, the nodes refer to
+        // them
+        struct Stored
+        {
+            Record record;
+            Stored *next;
+        };
+
+        struct Entry
+        {
+            Record const *record;
+            Entry *next;
+        };
+
+        struct Node
+        {
+            std::atomic<Node *> children[8];
+            std::atomic<Entry *> entries;
+
+            Node();
+            ~Node();
+        };
+
+        Scene &scene;
+        IrradianceSettings settings;
+        uint64_t fingerprint = 0;
+        Node root;
+        std::atomic<Stored *> stored{nullptr};
+        Point center;                   // of the root node
+        Real halfSize;
+        Real pixelAngle;                // size of a pixel per unit of distance
+        std::atomic<size_t> records{0};
+        std::atomic<size_t> computed{0};      // lookups that added a record
+        std::atomic<size_t> interpolated{0};
+
+    public:
+        IrradianceCache(Scene &scene, IrradianceSettings const &settings);
+        ~IrradianceCache();
+
+        IrradianceCache(IrradianceCache const &) = delete;
+        IrradianceCache &operator=(IrradianceCache const &) = delete;
+
+        // Irradiance of the point with the given normal (facing the viewer)
+        Color at(Point const &point, Vector const &normal);
+
+        // Fills the cache at the primary hits of every spacing-th pixel of
+        // the crop window
+        void precompute(unsigned spacing);
+
+        // The records of a file of the same scene and settings
+        bool load(std::string const &filename);
+        void save(std::string const &filename) const;
+
+        size_t size() const { return records; };
+        size_t computedLookups() const { return computed; };
+        size_t interpolatedLookups() const { return interpolated; };
+
+    private:
+        bool interpolate(Point const &point, Vector const &normal, Color &irradiance) const;
+        Record compute(Point const &point, Vector const &normal) const;
+        void insert(Record const &record);
+        void insert(Node &node, Point const &nodeCenter, Real half, unsigned depth,
+                    Record const &record, Real validity);
+        void hashScene();
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "light.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    double const Pi = 3.14159265358979323846;
+
+    // Orthonormal u, v perpendicular to the unit vector w
+    void basis(Vector const &w, Vector &u, Vector &v)
+    {
+        Vector helper = fabs(w.x) > Real(0.9) ? Vector(0, 1, 0) : Vector(1, 0, 0);
+        u = helper.cross(w).normalized();
+        v = w.cross(u);
+    }
+}
+
+Point Light::sample(Point const &from, double u, double v) const
+{
+    switch (shape.type)
+    {
+        case LightShape::Rect:
+            return position + Real(u - 0.5) * shape.edge1 + Real(v - 0.5) * shape.edge2;
+
+        case LightShape::Disk:
+        {
+            // concentric map (Shirley and Chiu), which keeps the strata
+            // compact
+            double a = 2 * u - 1;
+            double b = 2 * v - 1;
+            double r = 0;
+            double phi = 0;
+            if (a * a > b * b)
+            {
+                r = a;
+                phi = Pi / 4 * (b / a);
+            }
+            else if (b != 0)
+            {
+                r = b;
+                phi = Pi / 2 - Pi / 4 * (a / b);
+            }
+            Vector s, t;
+            basis(shape.normal.normalized(), s, t);
+            return position + Real(r * cos(phi)) * shape.radius * s
+                            + Real(r * sin(phi)) * shape.radius * t;
+        }
+
+        case LightShape::Sphere:
+        {
+            Vector toCenter = position - from;
+            double distance = toCenter.length();
+            Vector w, s, t;
+            double cosMax = -1;          // all of it, from inside
+            if (distance > shape.radius)
+            {
+                w = toCenter / Real(distance);
+                cosMax = sqrt(1 - (shape.radius / distance) * (shape.radius / distance));
+            }
+            else
+                w = Vector(0, 0, 1);
+            basis(w, s, t);
+            double cosine = 1 - u * (1 - cosMax);
+            double sine = sqrt(max(0.0, 1 - cosine * cosine));
+            Vector D = Real(cos(2 * Pi * v) * sine) * s + Real(sin(2 * Pi * v) * sine) * t
+                     + Real(cosine) * w;
+            if (cosMax == -1)
+                return position + shape.radius * D;
+
+            // the closer intersection of the ray from from in D
+            double along = distance * cosine;
+            double across2 = distance * distance - along * along;
+            double t0 = along - sqrt(max(0.0, shape.radius * shape.radius - across2));
+            return from + Real(t0) * D;
+        }
+
+        default:
+            return position;
+    }
+}
+
+// The area samples, turned into solid angle at from: distance^2 / (area
+// cos); a sphere seen from outside is sampled uniformly in its cone
+double Light::pdf(Point const &from, Point const &point) const
+{
+    Vector toPoint = point - from;
+    double distance2 = toPoint.length_2();
+    Vector normal;
+    double area = 0;
+    switch (shape.type)
+    {
+        case LightShape::Rect:
+            normal = shape.edge1.cross(shape.edge2);
+            area = normal.length();
+            break;
+
+        case LightShape::Disk:
+            normal = shape.normal;
+            area = Pi * shape.radius * shape.radius;
+            break;
+
+        case LightShape::Sphere:
+        {
+            double distance = (position - from).length();
+            if (distance > shape.radius)
+            {
+                double sine = shape.radius / distance;
+                return 1 / (2 * Pi * (1 - sqrt(1 - sine * sine)));
+            }
+            normal = point - position;
+            area = 4 * Pi * shape.radius * shape.radius;
+            break;
+        }
+
+        default:
+            return 0;
+    }
+    double cosine = fabs(normal.normalized().dot(toPoint)) / sqrt(distance2);
+    return cosine > 0 && area > 0 ? distance2 / (area * cosine) : 0;
+}
+
+Real Light::intersect(Point const &origin, Vector const &direction) const
+{
+    Real const none = numeric_limits<Real>::infinity();
+    switch (shape.type)
+    {
+        case LightShape::Rect:
+        case LightShape::Disk:
+        {
+            Vector normal = shape.type == LightShape::Rect ? shape.edge1.cross(shape.edge2)
+                                                           : shape.normal;
+            Real facing = direction.dot(normal);
+            if (facing == 0)
+                return none;
+            Real t = (position - origin).dot(normal) / facing;
+            if (!(t > 0))
+                return none;
+            Vector offset = origin + t * direction - position;
+            if (shape.type == LightShape::Disk)
+                return offset.length_2() <= shape.radius * shape.radius ? t : none;
+
+            // the coordinates of offset along the edges, in [-1/2, 1/2]
+            Real area2 = normal.length_2();
+            Real u = offset.cross(shape.edge2).dot(normal) / area2;
+            Real v = shape.edge1.cross(offset).dot(normal) / area2;
+            return fabs(u) <= Real(0.5) && fabs(v) <= Real(0.5) ? t : none;
+        }
+
+        case LightShape::Sphere:
+        {
+            // the nearer root from outside, the farther one from inside
+            Vector L = origin - position;
+            Real a = direction.dot(direction);
+            Real b = L.dot(direction);
+            Real c = L.dot(L) - shape.radius * shape.radius;
+            Real discriminant = b * b - a * c;
+            if (discriminant < 0)
+                return none;
+            Real root = sqrt(discriminant);
+            Real t = c > 0 ? (-b - root) / a : (-b + root) / a;
+            return t > 0 ? t : none;
+        }
+
+        default:
+            return none;
+    }
+}
+
+Real Light::extent() const
+{
+    switch (shape.type)
+    {
+        case LightShape::Rect:
+            return (shape.edge1.length() + shape.edge2.length()) / 2;
+        case LightShape::Disk:
+        case LightShape::Sphere:
+            return shape.radius;
+        default:
+            return 0;
+    }
+}
+
+// A point light adds its position and color only, as before there were
+// area lights
+void Light::hash(Hasher &hash) const
+{
+    hash.add(position).add(color);
+    if (isArea())
+        hash.add(shape.type).add(shape.edge1).add(shape.edge2).add(shape.normal)
+            .add(shape.radius).add(grid).add(probes);
+}
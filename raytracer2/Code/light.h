@@ -8,17 +8,77 @@
 class Light;
 typedef std::shared_ptr<Light> LightPtr;
 
+class Hasher;
+
+// The surface of an area light, around the light's position
+struct LightShape
+{
+    enum Type
+    {
+        Point,
+        Rect,           // sides edge1 and edge2, centered on the position
+        Disk,           // facing normal
+        Sphere
+    };
+
+    Type type = Point;
+    Vector edge1;
+    Vector edge2;
+    Vector normal;
+    Real radius = 0;    // of a disk or sphere
+};
+
+// A point light, or an area light: the mean of samples points on its
+// shape, each shading like a point light of its color. The samples are
+// stratified on a grid; the shadow rays of a few of them (the probes,
+// spread over the grid) decide whether a point is fully lit or shadowed,
+// only points where they disagree (the penumbra) trace them all.
 class Light
 {
     public:
         Point const position;
         Color const color;
+        LightShape const shape;
+        unsigned const grid;        // samples per side, grid * grid samples
+        unsigned const probes;      // per side, 0 traces every sample
 
         Light(Point const &pos, Color const &c)
         :
             position(pos),
-            color(c)
+            color(c),
+            grid(1),
+            probes(0)
         {}
+
+        Light(Point const &pos, Color const &c, LightShape const &shape, unsigned grid,
+              unsigned probes)
+        :
+            position(pos),
+            color(c),
+            shape(shape),
+            grid(grid),
+            probes(probes)
+        {}
+
+        bool isArea() const { return shape.type != LightShape::Point; };
+
+        // A point of the light for (u, v) in [0, 1)^2, area preserving so
+        // strata of the square are strata of the light; a sphere is
+        // sampled in the cone of directions it covers, seen from from
+        Point sample(Point const &from, double u, double v) const;
+
+        // The density, per solid angle seen from from, of sample()
+        // returning point (on the light); 0 for a point light
+        double pdf(Point const &from, Point const &point) const;
+
+        // The distance along the ray to the light's surface (the side a
+        // sample would be on), infinity if it misses or the light is a point
+        Real intersect(Point const &origin, Vector const &direction) const;
+
+        // a sphere around the light
+        Real extent() const;
+
+        void hash(Hasher &hash) const;
 };
 
 #endif
@@ -1,39 +1,187 @@
+#include "batch.h"
 #include "raytracer.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <vector>
 
 using namespace std;
 
+namespace
+{
+    // Whether all of text is a number in [min, max], stored in value
+    bool parse(char const *text, long long min, long long max, long long &value)
+    {
+        char *end;
+        errno = 0;
+        value = strtoll(text, &end, 10);
+        return end != text && *end == '\0' && errno == 0 && value >= min && value <= max;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     cout << "Introduction to Computer Graphics - Raytracer\n\n";
 
-    if (argc < 2 || argc > 3)
+    // options, the in file and optionally the out file
+    ProgressiveSettings progressive;
+    RenderOverrides overrides;
+    CheckpointSettings checkpoint;
+    string tileCache;
+    string gbuffer;
+    string jobFile;
+    vector<string> files;
+    bool unknownOption = false;
+    long long value = 0;
+    for (int arg = 1; arg < argc; ++arg)
+    {
+        string option = argv[arg];
+        bool hasValue = arg + 1 < argc;
+        if (option == "--time-budget" && hasValue)
+            progressive.timeBudget = atof(argv[++arg]);
+        else if (option == "--snapshot-interval" && hasValue)
+            progressive.snapshotInterval = atof(argv[++arg]);
+        else if (option == "--converge" && hasValue)
+            progressive.convergence = atof(argv[++arg]);
+        else if (option == "--resolution" && hasValue)
+        {
+            // WxH, or W keeping the aspect ratio
+            unsigned width = 0;
+            unsigned height = 0;
+            if (sscanf(argv[++arg], "%ux%u", &width, &height) < 1 || width == 0)
+                unknownOption = true;
+            overrides.width = width;
+            overrides.height = height;
+        }
+        else if (option == "--spp" && hasValue)
+        {
+            if (parse(argv[++arg], 1, numeric_limits<unsigned>::max(), value))
+                overrides.samples = value;
+            else
+                unknownOption = true;
+        }
+        else if (option == "--depth" && hasValue)
+        {
+            if (parse(argv[++arg], 0, numeric_limits<int>::max(), value))
+                overrides.recursionDepth = value;
+            else
+                unknownOption = true;
+        }
+        else if (option == "--shadows" && hasValue)
+        {
+            string value = argv[++arg];
+            overrides.shadows = value == "on" ? 1 : value == "off" ? 0 : -1;
+            unknownOption = unknownOption || overrides.shadows < 0;
+        }
+        else if (option == "--threads" && hasValue)
+        {
+            if (parse(argv[++arg], 0, 1024, value))
+                overrides.threads = value;
+            else
+                unknownOption = true;
+        }
+        else if (option == "--crop" && hasValue)
+        {
+            Tile &crop = overrides.crop;
+            if (sscanf(argv[++arg], "%u,%u,%u,%u", &crop.x0, &crop.y0, &crop.x1, &crop.y1) != 4
+                || crop.empty())
+                unknownOption = true;
+        }
+        else if (option == "--checkpoint" && hasValue)
+            checkpoint.interval = atof(argv[++arg]);
+        else if (option == "--resume")
+            checkpoint.resume = true;
+        else if (option == "--tile-cache" && hasValue)
+            tileCache = argv[++arg];
+        else if (option == "--gbuffer" && hasValue)
+            gbuffer = argv[++arg];
+        else if (option == "--batch" && hasValue)
+            jobFile = argv[++arg];
+        else if (option.compare(0, 2, "--") == 0)
+            unknownOption = true;
+        else
+            files.push_back(option);
+    }
+
+    if (checkpoint.resume && checkpoint.interval == 0)
+        checkpoint.interval = 60;
+
+    bool batch = !jobFile.empty();
+    // at most one of the ways of rendering
+    bool cached = !tileCache.empty();
+    bool reshading = !gbuffer.empty();
+    if (unknownOption
+        || checkpoint.enabled() + progressive.enabled() + cached + reshading > 1
+        || (batch ? !files.empty() || checkpoint.enabled() || progressive.enabled() || cached
+                    || reshading
+                  : files.size() < 1 || files.size() > 2))
+    {
+        cerr << "Usage: " << argv[0] << " [options] in-file [out-file.png]\n"
+             << "       " << argv[0] << " [options] --batch job-file\n"
+             << "The job file lists a scene per line, optionally followed by its out-file.\n"
+             << "Options replacing the settings of the scene:\n"
+             << "  --resolution WxH            film size, W alone keeps the aspect ratio\n"
+             << "  --crop x0,y0,x1,y1          render only these pixels [x0, x1) x [y0, y1)\n"
+             << "  --spp samples               samples per pixel, at least 1\n"
+             << "  --depth levels              maximum recursion depth, 0 or more\n"
+             << "  --shadows on|off\n"
+             << "  --threads count             at most 1024, 0 is all hardware threads\n"
+             << "Options rendering progressively (not in batches):\n"
+             << "  --time-budget seconds       stop rendering after this time\n"
+             << "  --snapshot-interval seconds write out-file-snapshot.png this often\n"
+             << "  --converge levels           stop at this estimated rmse (8 bit)\n"
+             << "Options checkpointing a render (not progressively, not in batches):\n"
+             << "  --checkpoint seconds        save the render to out-file.checkpoint this often\n"
+             << "  --resume                    continue from out-file.checkpoint (every 60 s\n"
+             << "                              unless --checkpoint is given)\n"
+             << "Options caching tiles (on their own, not in batches):\n"
+             << "  --tile-cache directory      reuse the tiles of earlier renders a change of\n"
+             << "                              the scene does not affect\n"
+             << "Options re-shading (on its own, not in batches):\n"
+             << "  --gbuffer file              re-shade light and material edits from the first\n"
+             << "                              hits in file, or render and capture them there\n";
+        return 1;
+    }
+
+    if (batch)
+    try
+    {
+        return Batch(jobFile, overrides).run() == 0 ? 0 : 1;
+    }
+    catch (exception const &ex)
     {
-        cerr << "Usage: " << argv[0] << "in-file [out-file.png]\n";
+        cerr << ex.what() << '\n';
         return 1;
     }
 
     Raytracer raytracer;
+    raytracer.setOverrides(overrides);
+    raytracer.setProgressive(progressive);
+    raytracer.setCheckpoint(checkpoint);
+    raytracer.setTileCache(tileCache);
+    raytracer.setGBuffer(gbuffer);
 
     // read the scene
-    if (!raytracer.readScene(argv[1]))
+    if (!raytracer.readScene(files[0]))
     {
-        cerr << "Error: reading scene from " << argv[1] <<
+        cerr << "Error: reading scene from " << files[0] <<
             " failed - no output generated.\n";
         return 1;
     }
 
     // determine output name
     string ofname;
-    if (argc >= 3)
+    if (files.size() == 2)
     {
-        ofname = argv[2];   // use the provided name
+        ofname = files[1];  // use the provided name
     }
     else
     {
-        ofname = argv[1];   // replace .json with .png
+        ofname = files[0];  // replace .json with .png
         ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
         ofname += ".png";
     }
@@ -2,13 +2,13 @@
 #define MATERIAL_H_
 
 #include "triple.h"
-#include "image.h"
+#include "texture.h"
 
 class Material
 {
     public:
         Color color;        // base color
-        Image texture;        // base texture
+        TexturePtr texture;   // base texture
         bool textured = false;
         double ka;          // ambient intensity
         double kd;          // diffuse intensity
@@ -25,10 +25,10 @@ class Material
             ks(ks),
             n(n)
         {}
-        Material(std::string const &filename, double ka, double kd, double ks, double n)
+        Material(TexturePtr const &texture, double ka, double kd, double ks, double n)
         :
             color(Color()),
-            texture(filename),
+            texture(texture),
             textured(true),
             ka(ka),
             kd(kd),
@@ -0,0 +1,23 @@
+#ifndef MORTON_H_
+#define MORTON_H_
+
+#include <cstdint>
+
+// Z-order (Morton) index of (x, y) for x, y < 2^16: the bits of x and y
+// interleaved, x in the even bits. Texels that are near in both directions
+// get near indices, so a 64 byte cache line holds a 4x4 block of RGBA8
+// texels instead of a 16x1 row.
+inline uint32_t mortonIndex(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t value)
+    {
+        value = (value | value << 8) & 0x00ff00ff;
+        value = (value | value << 4) & 0x0f0f0f0f;
+        value = (value | value << 2) & 0x33333333;
+        value = (value | value << 1) & 0x55555555;
+        return value;
+    };
+    return spread(x) | spread(y) << 1;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "motion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <typeinfo>
+
+using namespace std;
+
+namespace
+{
+    double const Pi = 3.14159265358979323846;
+}
+
+// --- Motion ------------------------------------------------------------------
+
+bool Motion::moves() const
+{
+    return translation.length_2() != 0 || angle != 0 || scale != 1;
+}
+
+Point Motion::at(Point const &point, Real time) const
+{
+    Real factor = 1 + time * (scale - 1);
+    return pivot + factor * turn(point - pivot, time) + time * translation;
+}
+
+Point Motion::atRest(Point const &point, Real time) const
+{
+    Real factor = 1 + time * (scale - 1);
+    return pivot + turn(point - pivot - time * translation, -time) / factor;
+}
+
+// Rodrigues' rotation formula; without an angle the vector is kept exactly
+Vector Motion::turn(Vector const &vector, Real time) const
+{
+    if (angle == 0)
+        return vector;
+    double radians = time * angle * Pi / 180;
+    Real cosine = Real(cos(radians));
+    Real sine = Real(sin(radians));
+    return cosine * vector + sine * axis.cross(vector)
+         + (1 - cosine) * axis.dot(vector) * axis;
+}
+
+void Motion::hash(Hasher &hash) const
+{
+    hash.add(translation).add(axis).add(angle).add(scale).add(pivot);
+}
+
+// --- MovingObject ------------------------------------------------------------
+
+MovingObject::MovingObject(ObjectPtr const &object, Motion const &motion)
+:
+    d_object(object),
+    d_motion(motion)
+{
+    material = object->material;
+}
+
+// A point at distance d from the pivot, turning by an angle below 2 pi
+// while scaling, strays at most d (max(1, scale) (1 - cos(angle / 2))
+// + |scale - 1| sin(angle / 2) / 2) from the line between its ends (the
+// first term is the sagitta of the arc)
+void MovingObject::prepare()
+{
+    d_object->prepare();
+
+    Point center;
+    Real radius;
+    d_sweep = 0;
+    if (d_motion.angle != 0 && d_object->bounds(center, radius))
+    {
+        double half = fabs(double(d_motion.angle)) * Pi / 360;
+        double larger = max(1.0, double(d_motion.scale));
+        double stray = half < Pi ? larger * (1 - cos(half))
+                                   + fabs(d_motion.scale - 1) * sin(half) / 2
+                                 : 2 * larger;
+        d_sweep = Real(stray * (center - d_motion.pivot).length());
+    }
+}
+
+Hit MovingObject::intersect(Ray const &ray)
+{
+    Real factor = 1 + ray.time * (d_motion.scale - 1);
+    Ray local(d_motion.atRest(ray.O, ray.time), d_motion.turn(ray.D, -ray.time) / factor,
+              ray.time);
+    Hit hit = d_object->intersect(local);
+    hit.N = d_motion.turn(hit.N, ray.time);
+    return hit;
+}
+
+Color MovingObject::textureColorAt(Point point, bool rotate)
+{
+    return d_object->textureColorAt(point, rotate);
+}
+
+Color MovingObject::textureColorAt(Point point, Vector const &dPdx, Vector const &dPdy,
+                                   bool rotate)
+{
+    return d_object->textureColorAt(point, dPdx, dPdy, rotate);
+}
+
+Vector MovingObject::normalDifferential(Point const &point, Vector const &dP)
+{
+    return d_object->normalDifferential(point, dP);
+}
+
+bool MovingObject::isRotated()
+{
+    return d_object->isRotated();
+}
+
+Vector MovingObject::rotate(Point point)
+{
+    return d_object->rotate(point);
+}
+
+void MovingObject::hashGeometry(Hasher &hash) const
+{
+    hash.add(string(typeid(*d_object).name()));
+    d_object->hashGeometry(hash);
+    d_motion.hash(hash);
+}
+
+// The sphere around those at both ends, widened by the sweep
+bool MovingObject::bounds(Point &center, Real &radius) const
+{
+    Point start, end;
+    Real startRadius, endRadius;
+    if (!boundsAt(0, start, startRadius) || !boundsAt(1, end, endRadius))
+        return false;
+    center = (start + end) / 2;
+    radius = (end - start).length() / 2 + max(startRadius, endRadius);
+    return true;
+}
+
+bool MovingObject::boundsAt(Real time, Point &center, Real &radius) const
+{
+    Point rest;
+    Real restRadius;
+    if (!d_object->bounds(rest, restRadius))
+        return false;
+    Point end = d_motion.at(rest, 1);
+    center = rest + time * (end - rest);
+    radius = restRadius * (1 + time * (d_motion.scale - 1)) + d_sweep;
+    return true;
+}
+
+Point MovingObject::atRest(Point const &point, Real time) const
+{
+    return d_motion.atRest(point, time);
+}
@@ -0,0 +1,65 @@
+#ifndef MOTION_H_
+#define MOTION_H_
+
+#include "object.h"
+
+// The "motion" of an object during the frame: at time 0 it is where the
+// scene puts it, at time 1 it is scaled by scale and turned by angle degrees
+// around axis, both about the pivot, and moved by translation. In between
+// all three are interpolated linearly.
+struct Motion
+{
+    Vector translation;
+    Vector axis{0, 1, 0};       // unit length
+    Real angle = 0;             // degrees
+    Real scale = 1;
+    Point pivot;
+
+    bool moves() const;
+
+    // Where the point of the object at rest is at time, and back
+    Point at(Point const &point, Real time) const;
+    Point atRest(Point const &point, Real time) const;
+
+    // The vector turned as the object is at time (not scaled)
+    Vector turn(Vector const &vector, Real time) const;
+
+    void hash(Hasher &hash) const;
+};
+
+// An object following a Motion. A ray is moved to the object at rest by the
+// inverse of the motion at the ray's time (its direction scaled along, so
+// the distances of the hits stay those of the ray), the normal of the hit
+// is turned back.
+class MovingObject: public Object
+{
+    ObjectPtr d_object;
+    Motion d_motion;
+    // how far the center of the object's sphere strays from the line
+    // between its ends while turning, set by prepare()
+    Real d_sweep = 0;
+
+    public:
+        // takes the object's material
+        MovingObject(ObjectPtr const &object, Motion const &motion);
+
+        virtual void prepare();
+        virtual Hit intersect(Ray const &ray);
+
+        // the point at rest, see Object::atRest
+        virtual Color textureColorAt(Point point, bool rotate);
+        virtual Color textureColorAt(Point point, Vector const &dPdx,
+                                     Vector const &dPdy, bool rotate);
+        virtual Vector normalDifferential(Point const &point, Vector const &dP);
+        virtual bool isRotated();
+        virtual Vector rotate(Point point);
+
+        virtual void hashGeometry(Hasher &hash) const;
+        virtual bool bounds(Point &center, Real &radius) const;
+
+        virtual bool isMoving() const { return true; };
+        virtual bool boundsAt(Real time, Point &center, Real &radius) const;
+        virtual Point atRest(Point const &point, Real time) const;
+};
+
+#endif
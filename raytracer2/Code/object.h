@@ -1,6 +1,8 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include "differential.h"
+#include "hash.h"
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
@@ -19,12 +21,56 @@ class Object
 
         virtual ~Object() = default;
 
+        // precompute data derived from the parameters, called once after
+        // the scene is loaded and before any intersect or texture call
+        virtual void prepare() {};
+
         virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
                                                     // in derived class
         virtual Color textureColorAt(Point point, bool rotate) = 0;
+
+        // texture color of the footprint spanned by dPdx and dPdy at point,
+        // for textures that filter by level of detail
+        virtual Color textureColorAt(Point point, Vector const &dPdx,
+                                     Vector const &dPdy, bool rotate)
+        {
+            return textureColorAt(point, rotate);
+        }
+
+        // change of the normal at point when moving by dP on the surface;
+        // flat surfaces have none
+        virtual Vector normalDifferential(Point const &point, Vector const &dP)
+        {
+            return Vector();
+        }
         virtual bool isRotated() = 0;
         virtual Vector rotate(Point point) = 0;
 
+        // adds the parameters that decide where and how the object is hit
+        // (its material aside), for the TileCache
+        virtual void hashGeometry(Hasher &hash) const = 0;
+
+        // a sphere around the object; false if it is unbounded
+        virtual bool bounds(Point &center, Real &radius) const
+        {
+            return false;
+        }
+
+        // Motion blur: an object that moves during the frame is hit by rays
+        // of a time in [0, 1). Its sphere at a time lies within the linear
+        // interpolation of those at times 0 and 1 (bounds holds them all),
+        // and atRest maps a hit at a time to the object at time 0, where
+        // its texture is looked up.
+        virtual bool isMoving() const { return false; };
+        virtual bool boundsAt(Real time, Point &center, Real &radius) const
+        {
+            return bounds(center, radius);
+        }
+        virtual Point atRest(Point const &point, Real time) const
+        {
+            return point;
+        }
+
 };
 
 #endif
@@ -0,0 +1,86 @@
+#include "parallel.h"
+
+using namespace std;
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool()
+{
+    unsigned threads = max({1u, thread::hardware_concurrency(), parallelThreadLimit()});
+    for (unsigned idx = 1; idx != threads; ++idx)
+        d_workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_stop = true;
+    }
+    d_work.notify_all();
+    for (thread &worker : d_workers)
+        worker.join();
+}
+
+void ThreadPool::run(size_t count, function<void(size_t)> const &task)
+{
+    Job job;
+    job.task = &task;
+    job.count = count;
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_jobs.push_back(&job);
+    }
+    d_work.notify_all();
+
+    execute(job);
+
+    // Once the job is out of the queue no worker takes it any more; the
+    // ones that did may still be looking at it
+    unique_lock<mutex> lock(d_mutex);
+    auto queued = find(d_jobs.begin(), d_jobs.end(), &job);
+    if (queued != d_jobs.end())
+        d_jobs.erase(queued);
+    d_finished.wait(lock, [&]{ return job.done == job.count && job.users == 0; });
+}
+
+void ThreadPool::execute(Job &job)
+{
+    for (size_t idx = job.next++; idx < job.count; idx = job.next++)
+    {
+        (*job.task)(idx);
+        if (++job.done == job.count)
+        {
+            lock_guard<mutex> lock(d_mutex);
+            d_finished.notify_all();
+        }
+    }
+}
+
+void ThreadPool::work()
+{
+    unique_lock<mutex> lock(d_mutex);
+    while (true)
+    {
+        d_work.wait(lock, [&]{ return d_stop || !d_jobs.empty(); });
+        if (d_stop)
+            return;
+
+        Job *job = d_jobs.front();
+        if (job->next >= job->count)    // all taken, the owner removes it
+        {
+            d_jobs.pop_front();
+            continue;
+        }
+        ++job->users;
+        lock.unlock();
+        execute(*job);
+        lock.lock();
+        --job->users;
+        d_finished.notify_all();
+    }
+}
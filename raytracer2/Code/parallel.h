@@ -0,0 +1,84 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads parallelFor may use, 0 (the default) is all hardware
+// threads; set before rendering
+inline unsigned &parallelThreadLimit()
+{
+    static unsigned limit = 0;
+    return limit;
+}
+
+// Worker threads shared by every parallelFor of the process, so that a
+// render (or a batch of them) starts its threads once instead of for every
+// tile pass or wavefront stage. Started on first use, with a thread per
+// hardware thread (or the thread limit, if that is larger); several threads
+// may run tasks at the same time.
+class ThreadPool
+{
+    struct Job
+    {
+        std::function<void(size_t)> const *task;
+        size_t count;
+        std::atomic<size_t> next{0};    // first index not yet taken
+        std::atomic<size_t> done{0};
+        unsigned users = 0;             // workers that took the job
+    };
+
+    std::mutex d_mutex;                 // guards d_jobs, users and d_stop
+    std::condition_variable d_work;
+    std::condition_variable d_finished;
+    std::deque<Job *> d_jobs;
+    std::vector<std::thread> d_workers;
+    bool d_stop = false;
+
+    public:
+        static ThreadPool &instance();
+
+        ~ThreadPool();
+
+        // Workers plus the calling thread
+        unsigned threads() const { return d_workers.size() + 1; };
+
+        // Runs task(index) for every index in [0, count) on the workers and
+        // the calling thread; returns when all are done
+        void run(size_t count, std::function<void(size_t)> const &task);
+
+    private:
+        ThreadPool();
+        void execute(Job &job);
+        void work();
+};
+
+// Runs body(begin, end) over [0, count), split into contiguous chunks
+// of at least grain items which are processed on all hardware threads.
+template <typename Body>
+void parallelFor(size_t count, Body body, size_t grain = 1024)
+{
+    size_t threads = parallelThreadLimit() != 0
+        ? parallelThreadLimit() : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (count + grain - 1) / grain);
+    if (threads <= 1)
+    {
+        body(size_t(0), count);
+        return;
+    }
+
+    size_t chunk = (count + threads - 1) / threads;
+    ThreadPool::instance().run((count + chunk - 1) / chunk, [&](size_t idx)
+    {
+        body(idx * chunk, std::min((idx + 1) * chunk, count));
+    });
+}
+
+#endif
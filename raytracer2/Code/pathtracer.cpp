@@ -0,0 +1,211 @@
+#include "pathtracer.h"
+
+#include "fastmath.h"
+#include "hash.h"
+#include "hit.h"
+#include "material.h"
+#include "random.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    double const Pi = 3.14159265358979323846;
+    unsigned const RouletteDepth = 3;       // hits before Russian roulette
+
+    // Orthonormal u, v perpendicular to the unit vector w
+    void basis(Vector const &w, Vector &u, Vector &v)
+    {
+        Vector helper = fabs(w.x) > Real(0.9) ? Vector(0, 1, 0) : Vector(1, 0, 0);
+        u = helper.cross(w).normalized();
+        v = w.cross(u);
+    }
+
+    // Direction around the unit vector w with the given polar cosine
+    Vector around(Vector const &w, double cosine, double phi)
+    {
+        Vector u, v;
+        basis(w, u, v);
+        double sine = sqrt(max(0.0, 1 - cosine * cosine));
+        return (Real(cos(phi) * sine) * u + Real(sin(phi) * sine) * v + Real(cosine) * w)
+            .normalized();
+    }
+
+    double average(Color const &color)
+    {
+        return (color.r + color.g + color.b) / 3;
+    }
+
+    // The chance that the diffuse lobe is sampled, by albedo
+    double diffuseChance(Color const &diffuse, double ks)
+    {
+        double diffuseWeight = average(diffuse);
+        return diffuseWeight + ks > 0 ? diffuseWeight / (diffuseWeight + ks) : 0;
+    }
+
+    // The density of the lobe sampling in radiance() choosing wi
+    double lobePdf(Vector const &N, Vector const &wo, Vector const &wi, double chance,
+                   double n)
+    {
+        Vector reflected = 2 * N.dot(wo) * N - wo;
+        double specularCosine = max(0.0, double(reflected.dot(wi)));
+        return chance * max(0.0, double(N.dot(wi))) / Pi
+             + (1 - chance) * (n + 1) / (2 * Pi) * FastMath::pow(specularCosine, n);
+    }
+}
+
+PathTracer::PathTracer(Scene &scene)
+:
+    scene(scene)
+{}
+
+Color PathTracer::radiance(Ray const &primary, unsigned x, unsigned y, unsigned index)
+{
+    Random random(Hasher().add(x).add(y).add(index).add(scene.sampler->seed).value());
+    Color radiance(0, 0, 0);
+    Color throughput(1, 1, 1);
+    Ray ray = primary;
+    bool const areaLights = any_of(scene.lights.begin(), scene.lights.end(),
+                                   [](LightPtr const &light) { return light->isArea(); });
+    double pdf = 0;         // of the lobe sampling that chose ray, 0 for the camera
+    for (unsigned length = 0; ; ++length)
+    {
+        // past the last hit only the area lights the last ray reaches count
+        if (length == scene.maxPathLength && (pdf == 0 || !areaLights))
+            break;
+        Hit min_hit(numeric_limits<double>::infinity(), Vector());
+        unsigned objIdx = 0;
+        ObjectPtr obj = scene.intersect(ray, min_hit, objIdx);
+        if (pdf != 0 && areaLights)
+            radiance += throughput * emitted(ray, min_hit.t, pdf);
+        if (!obj || length == scene.maxPathLength)
+            break;          // the background is black
+
+        Material const &material = obj->material;
+        Point point = ray.at(min_hit.t - Hit::offset());
+        Vector wo = -ray.D;
+        Vector N = min_hit.N.normalized();
+        if (N.dot(wo) < 0)
+            N = -N;
+        Color surface = material.textured
+                      ? obj->textureColorAt(obj->atRest(point, ray.time), obj->isRotated())
+                      : material.color;
+        Color diffuse = surface * material.kd;
+
+        radiance += throughput * direct(point, N, wo, obj, diffuse, ray.time, random);
+
+        // Pick a lobe by its albedo, then weigh the direction by the pdf of
+        // both
+        if (average(diffuse) + material.ks <= 0)
+            break;
+        double chance = diffuseChance(diffuse, material.ks);
+        Vector reflected = 2 * N.dot(wo) * N - wo;
+        double u1 = random.next();
+        double u2 = random.next();
+        Vector wi = random.next() < chance
+            ? around(N, sqrt(u1), 2 * Pi * u2)
+            : around(reflected, pow(u1, 1 / (material.n + 1)), 2 * Pi * u2);
+        double cosine = N.dot(wi);
+        if (cosine <= 0)
+            break;      // a specular direction below the surface
+        pdf = lobePdf(N, wo, wi, chance, material.n);
+        throughput = throughput * brdf(N, wo, wi, diffuse, material.ks, material.n)
+                   * Real(cosine / pdf);
+
+        if (length + 1 >= RouletteDepth)
+        {
+            double survival = min(0.95, double(max({throughput.r, throughput.g, throughput.b})));
+            if (random.next() >= survival)
+                break;
+            throughput /= Real(survival);
+        }
+
+        ray = Ray(point, wi, ray.time);
+        ++Scene::counts().reflected;
+    }
+    return radiance;
+}
+
+// Light reaching the point from every light that sees it, reflected towards
+// wo; the shadow rays run from the point to the lights, at the path's time.
+// The sample of an area light has the balance heuristic weight against the
+// lobe sampling finding the same point (see emitted).
+Color PathTracer::direct(Point const &point, Vector const &N, Vector const &wo,
+                         ObjectPtr const &obj, Color const &diffuse, Real time,
+                         Random &random)
+{
+    Material const &material = obj->material;
+    double chance = diffuseChance(diffuse, material.ks);
+    Color sum(0, 0, 0);
+    for (LightPtr const &light : scene.lights)
+    {
+        // one sample of an area light per hit, the samples average it
+        Point position = light->isArea() ? light->sample(point, random.next(), random.next())
+                                         : light->position;
+        Vector toLight = position - point;
+        Real distance = toLight.length();
+        Vector wi = toLight / distance;
+        double cosine = N.dot(wi);
+        if (cosine <= 0)
+            continue;
+
+        if (scene.shadows)
+        {
+            ++Scene::counts().shadow;
+            Hit min_hit(numeric_limits<double>::infinity(), Vector());
+            unsigned objIdx = 0;
+            if (scene.intersect(Ray(point, wi, time), min_hit, objIdx) && min_hit.t < distance)
+                continue;
+        }
+        double weight = 1;
+        if (light->isArea())
+        {
+            double lightPdf = light->pdf(point, position);
+            double pdf = average(diffuse) + material.ks > 0
+                       ? lobePdf(N, wo, wi, chance, material.n) : 0;
+            weight = lightPdf / (lightPdf + pdf);
+        }
+        sum += brdf(N, wo, wi, diffuse, material.ks, material.n) * light->color
+             * Real(Pi * cosine * weight);
+    }
+    return sum;
+}
+
+// The area lights the lobe sampled ray reaches before distance (the closest
+// hit; with shadows off, any distance), weighed against their samples in
+// direct. A light delivers pi times its color per unit of the density of its
+// samples (see Light::pdf), which is the radiance that makes both strategies
+// estimate the same light. Lights do not block the ray, as they do not block
+// shadow rays.
+Color PathTracer::emitted(Ray const &ray, Real distance, double pdf) const
+{
+    Color sum(0, 0, 0);
+    for (LightPtr const &light : scene.lights)
+    {
+        if (!light->isArea())
+            continue;
+        Real t = light->intersect(ray.O, ray.D);
+        if (t == numeric_limits<Real>::infinity() || (scene.shadows && !(t < distance)))
+            continue;
+        double lightPdf = light->pdf(ray.O, ray.at(t));
+        if (lightPdf <= 0)
+            continue;
+        sum += light->color * Real(Pi * lightPdf * pdf / (lightPdf + pdf));
+    }
+    return sum;
+}
+
+// Diffuse plus normalized Phong: kd c / pi + ks (n + 2) / (2 pi) cos^n
+Color PathTracer::brdf(Vector const &N, Vector const &wo, Vector const &wi,
+                       Color const &diffuse, double ks, double n) const
+{
+    Vector reflected = 2 * N.dot(wo) * N - wo;
+    double specular = ks * (n + 2) / (2 * Pi)
+                    * FastMath::pow(max(0.0, double(reflected.dot(wi))), n);
+    return diffuse * Real(1 / Pi) + Color(1, 1, 1) * Real(specular);
+}
@@ -0,0 +1,54 @@
+#ifndef PATHTRACER_H_
+#define PATHTRACER_H_
+
+#include "object.h"
+#include "ray.h"
+#include "triple.h"
+
+#include <cstdint>
+
+class Random;
+class Scene;
+
+// Unidirectional path tracer, the "path" integrator. A material is a
+// diffuse lobe (kd times its color) plus a normalized Phong lobe (ks,
+// exponent n); ka is ignored, the indirect light is traced instead.
+//
+// At every hit the lights are sampled directly (next-event estimation) and
+// the path continues in a direction drawn from one of the two lobes, chosen
+// by their albedo; the direction is weighted by the pdf of both lobes
+// (multiple importance sampling with the balance heuristic, one-sample), so
+// neither a dull nor a shiny lobe is sampled badly. An area light is
+// sampled at one point per hit and is also found by the sampled directions
+// that reach it; both get the balance heuristic weight of the light's and
+// the lobes' pdf, so glossy reflections of large lights are not noisy.
+// Lights are not seen by the camera and do not block rays.
+// A light's color is the irradiance it delivers, divided by pi, facing it
+// (no falloff, as in the Whitted shading): a white diffuse surface facing a
+// light of color c reflects kd c, as it does with the Whitted shading.
+// Paths end at MaxPathLength hits or, from the third hit on, by Russian
+// roulette.
+//
+// The random numbers of a sample depend only on its pixel, index and the
+// seed, so paths are the same whatever the thread or tile that traces them,
+// and progressive and checkpointed renders add up to the same image.
+class PathTracer
+{
+    Scene &scene;
+
+    public:
+        explicit PathTracer(Scene &scene);
+
+        // Radiance along the primary ray of sample index of pixel (x, y)
+        Color radiance(Ray const &ray, unsigned x, unsigned y, unsigned index);
+
+    private:
+        Color direct(Point const &point, Vector const &N, Vector const &wo,
+                     ObjectPtr const &obj, Color const &diffuse, Real time,
+                     Random &random);
+        Color brdf(Vector const &N, Vector const &wo, Vector const &wi,
+                   Color const &diffuse, double ks, double n) const;
+        Color emitted(Ray const &ray, Real distance, double pdf) const;
+};
+
+#endif
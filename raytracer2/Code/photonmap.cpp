@@ -0,0 +1,427 @@
+#include "photonmap.h"
+
+#include "hash.h"
+#include "hit.h"
+#include "material.h"
+#include "parallel.h"
+#include "random.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace std;
+
+namespace
+{
+    double const Pi = 3.14159265358979323846;
+    size_t const BatchSize = 1024;      // photons emitted by a task
+    size_t const MaxEmitted = 64;       // photons emitted per stored, at most
+    unsigned const MaxBounces = 16;
+
+    // Direction around the unit vector w with the given polar cosine
+    Vector around(Vector const &w, double cosine, double phi)
+    {
+        Vector helper = fabs(w.x) > Real(0.9) ? Vector(0, 1, 0) : Vector(1, 0, 0);
+        Vector u = helper.cross(w).normalized();
+        Vector v = w.cross(u);
+        double sine = sqrt(max(0.0, 1 - cosine * cosine));
+        return (Real(cos(phi) * sine) * u + Real(sin(phi) * sine) * v + Real(cosine) * w)
+            .normalized();
+    }
+
+    double average(Color const &color)
+    {
+        return (color.r + color.g + color.b) / 3;
+    }
+
+    // A search range of the tree, and the squared distance of the point
+    // to the range's side of its parent's split plane
+    struct Pending
+    {
+        size_t begin;
+        size_t end;
+        float distance2;
+    };
+
+    // Photons found by a search, a max-heap on the distance
+    thread_local vector<pair<float, uint32_t>> found;
+}
+
+// --- Tree --------------------------------------------------------------------
+
+void PhotonMap::Tree::build(vector<Photon> &&stored, size_t emittedPhotons)
+{
+    photons = move(stored);
+    photons.shrink_to_fit();
+    emitted = emittedPhotons;
+
+    // A level's ranges are split at once; the nodes are their medians
+    vector<pair<size_t, size_t>> level;
+    if (!photons.empty())
+        level.emplace_back(0, photons.size());
+    while (!level.empty())
+    {
+        parallelFor(level.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t idx = begin; idx != end; ++idx)
+                split(level[idx].first, level[idx].second);
+        }, 1);
+
+        vector<pair<size_t, size_t>> next;
+        for (pair<size_t, size_t> const &range : level)
+        {
+            size_t mid = range.first + (range.second - range.first) / 2;
+            if (mid != range.first)
+                next.emplace_back(range.first, mid);
+            if (mid + 1 != range.second)
+                next.emplace_back(mid + 1, range.second);
+        }
+        level.swap(next);
+    }
+}
+
+// Moves the median along the longest axis of the range's bounds to its
+// middle, the smaller photons before it
+void PhotonMap::Tree::split(size_t begin, size_t end)
+{
+    float lower[3] = {numeric_limits<float>::infinity(), numeric_limits<float>::infinity(),
+                      numeric_limits<float>::infinity()};
+    float upper[3] = {-lower[0], -lower[1], -lower[2]};
+    for (size_t idx = begin; idx != end; ++idx)
+    {
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            lower[axis] = min(lower[axis], photons[idx].position[axis]);
+            upper[axis] = max(upper[axis], photons[idx].position[axis]);
+        }
+    }
+    uint32_t axis = 0;
+    for (uint32_t candidate = 1; candidate != 3; ++candidate)
+        if (upper[candidate] - lower[candidate] > upper[axis] - lower[axis])
+            axis = candidate;
+
+    size_t mid = begin + (end - begin) / 2;
+    nth_element(photons.begin() + begin, photons.begin() + mid, photons.begin() + end,
+                [axis](Photon const &lhs, Photon const &rhs)
+                {
+                    return lhs.position[axis] < rhs.position[axis];
+                });
+    photons[mid].axis = axis;
+}
+
+// Cone filtered estimate (Jensen's k = 1) of the nearest photons, of those
+// that arrived at the front of the surface
+Color PhotonMap::Tree::irradiance(Point const &point, Vector const &normal,
+                                  unsigned nearest, double radius) const
+{
+    if (photons.empty() || nearest == 0)
+        return Color(0, 0, 0);
+
+    float const x[3] = {float(point.x), float(point.y), float(point.z)};
+    float const N[3] = {float(normal.x), float(normal.y), float(normal.z)};
+    float maxDistance2 = radius > 0 ? float(radius * radius)
+                                    : numeric_limits<float>::infinity();
+    found.clear();
+
+    Pending stack[128];
+    size_t top = 0;
+    stack[top++] = Pending{0, photons.size(), 0};
+    while (top != 0)
+    {
+        Pending range = stack[--top];
+        if (range.distance2 >= maxDistance2)
+            continue;
+
+        size_t mid = range.begin + (range.end - range.begin) / 2;
+        Photon const &photon = photons[mid];
+        if (range.end - range.begin > 1)
+        {
+            float delta = x[photon.axis] - photon.position[photon.axis];
+            Pending below{range.begin, mid, 0};
+            Pending above{mid + 1, range.end, 0};
+            Pending &far = delta < 0 ? above : below;
+            far.distance2 = delta * delta;
+            if (far.begin != far.end)
+                stack[top++] = far;
+            Pending const &near = delta < 0 ? below : above;
+            if (near.begin != near.end)
+                stack[top++] = near;
+        }
+
+        float distance2 = 0;
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            float delta = photon.position[axis] - x[axis];
+            distance2 += delta * delta;
+        }
+        if (distance2 >= maxDistance2)
+            continue;
+
+        found.emplace_back(distance2, uint32_t(mid));
+        push_heap(found.begin(), found.end());
+        if (found.size() > nearest)
+        {
+            pop_heap(found.begin(), found.end());
+            found.pop_back();
+        }
+        if (found.size() == nearest)
+            maxDistance2 = found.front().first;
+    }
+    if (found.empty())
+        return Color(0, 0, 0);
+
+    // the disc of the estimate reaches the farthest photon, or the radius
+    // if there are fewer
+    float radius2 = found.size() == nearest || radius <= 0 ? found.front().first
+                                                           : float(radius * radius);
+    if (radius2 <= 0)
+        return Color(0, 0, 0);
+    double sum[3] = {0, 0, 0};
+    for (pair<float, uint32_t> const &entry : found)
+    {
+        Photon const &photon = photons[entry.second];
+        float facing = photon.direction[0] * N[0] + photon.direction[1] * N[1]
+                     + photon.direction[2] * N[2];
+        if (facing >= 0)
+            continue;       // arrived at the back of the surface
+        double weight = 1 - sqrt(entry.first / radius2);
+        for (int channel = 0; channel != 3; ++channel)
+            sum[channel] += weight * photon.power[channel];
+    }
+    // the cone filter keeps a third of the power of a uniform density
+    double scale = 3 / (Pi * radius2);
+    return Color(Real(sum[0] * scale), Real(sum[1] * scale), Real(sum[2] * scale));
+}
+
+// --- PhotonMap ---------------------------------------------------------------
+
+PhotonMap::PhotonMap(Scene &scene, PhotonSettings const &settings)
+:
+    scene(scene),
+    settings(settings)
+{}
+
+void PhotonMap::build()
+{
+    vector<Source> everywhere;
+    vector<Source> specular;
+    for (size_t light = 0; light != scene.lights.size(); ++light)
+    {
+        double brightness = average(scene.lights[light]->color);
+        everywhere.push_back(Source{light, nullptr, Point(), 0, brightness});
+        for (ObjectPtr const &obj : scene.objects)
+        {
+            if (obj->material.ks <= 0)
+                continue;
+            Point center;
+            Real radius;
+            if (!obj->bounds(center, radius))
+            {
+                // up to half the directions, at the distance of the eye
+                double distance = (scene.camera.eye() - scene.lights[light]->position).length();
+                specular.push_back(Source{light, obj, Point(), numeric_limits<Real>::infinity(),
+                                          brightness * distance * distance});
+                continue;
+            }
+            // the power towards the sphere, as if it were hit at its center
+            double distance = (center - scene.lights[light]->position).length();
+            double cone = distance > radius ? 1 - sqrt(1 - pow(radius / distance, 2)) : 2;
+            specular.push_back(Source{light, obj, center, radius,
+                                      brightness * cone * pow(max(distance, double(radius)), 2)});
+        }
+    }
+    emit(specular, true, settings.caustics, caustic);
+    emit(everywhere, false, settings.indirect, global);
+}
+
+Color PhotonMap::caustics(Point const &point, Vector const &normal) const
+{
+    return caustic.irradiance(point, normal, settings.nearest, settings.radius);
+}
+
+Color PhotonMap::indirect(Point const &point, Vector const &normal) const
+{
+    return global.irradiance(point, normal, settings.nearest, settings.radius);
+}
+
+// Emits batches of photons, the batches of a round in parallel, until the
+// budget is stored (or too many photons were emitted), and builds the tree
+// of the batches that fit the budget
+void PhotonMap::emit(vector<Source> const &sources, bool causticPaths, size_t budget,
+                     Tree &tree)
+{
+    if (budget == 0 || sources.empty())
+        return;
+
+    // Batches go to the sources in proportion to their power, so the
+    // photons of all carry about the same
+    vector<double> cumulative;
+    double total = 0;
+    for (Source const &source : sources)
+        cumulative.push_back(total += source.power);
+    if (total <= 0)
+        return;
+    auto sourceOf = [&](size_t batch)
+    {
+        double position = fmod((batch + 0.5) * 0.6180339887498949, 1.0) * total;
+        return size_t(upper_bound(cumulative.begin(), cumulative.end() - 1, position)
+                      - cumulative.begin());
+    };
+
+    size_t const batchSize = min(BatchSize, budget);
+    size_t const maxBatches = (MaxEmitted * budget + batchSize - 1) / batchSize;
+    size_t const round = 4 * max<size_t>(1, ThreadPool::instance().threads());
+    vector<vector<Photon>> batches;
+    size_t stored = 0;
+    while (stored < budget && batches.size() < maxBatches)
+    {
+        size_t first = batches.size();
+        batches.resize(min(first + round, maxBatches));
+        parallelFor(batches.size() - first, [&](size_t begin, size_t end)
+        {
+            for (size_t idx = first + begin; idx != first + end; ++idx)
+            {
+                emitBatch(sources[sourceOf(idx)], causticPaths, batchSize,
+                          Hasher().add(causticPaths).add(idx).value(), batches[idx]);
+                scene.addCounts();
+            }
+        }, 1);
+        for (size_t idx = first; idx != batches.size(); ++idx)
+            stored += batches[idx].size();
+    }
+
+    size_t kept = 0;
+    stored = 0;
+    while (kept != batches.size() && stored + batches[kept].size() <= budget)
+        stored += batches[kept++].size();
+
+    // a source's photons share the power it emitted
+    vector<size_t> emitted(sources.size(), 0);
+    for (size_t idx = 0; idx != kept; ++idx)
+        emitted[sourceOf(idx)] += batchSize;
+    vector<Photon> photons;
+    photons.reserve(stored);
+    for (size_t idx = 0; idx != kept; ++idx)
+    {
+        float scale = 1.0f / emitted[sourceOf(idx)];
+        for (Photon photon : batches[idx])
+        {
+            for (float &channel : photon.power)
+                channel *= scale;
+            photons.push_back(photon);
+        }
+        vector<Photon>().swap(batches[idx]);
+    }
+    tree.build(move(photons), kept * batchSize);
+}
+
+// Emits a batch from the source; a photon towards a target only counts if
+// the target is the first object it hits, so the cones of the targets do
+// not emit into the same direction twice
+void PhotonMap::emitBatch(Source const &source, bool causticPaths, size_t count,
+                          uint64_t seed, vector<Photon> &stored) const
+{
+    Random random(seed);
+    Light const &light = *scene.lights[source.light];
+    bool separateCaustics = settings.caustics != 0;
+
+    // the cone of directions from origin towards the target
+    Vector axis;
+    double cosMax;
+    auto aim = [&](Point const &origin)
+    {
+        axis = Vector(0, 0, 1);
+        cosMax = -1;
+        if (!source.target)
+            return;
+        Vector toCenter = source.center - origin;
+        Real distance = toCenter.length();
+        if (distance > source.radius)
+        {
+            axis = toCenter / distance;
+            cosMax = sqrt(1 - double(source.radius / distance) * (source.radius / distance));
+        }
+    };
+    aim(light.position);
+
+    for (size_t emitted = 0; emitted != count; ++emitted)
+    {
+        // a photon of a moving scene flies at a time of its own; an area
+        // light emits from a point of it, facing the target
+        Real time = scene.motion ? Real(random.next()) : 0;
+        Point origin = light.position;
+        if (light.isArea())
+        {
+            origin = light.sample(source.target ? source.center : light.position,
+                                  random.next(), random.next());
+            aim(origin);
+        }
+        double pdf = 1 / (2 * Pi * (1 - cosMax));
+        Ray ray(origin, around(axis, 1 - random.next() * (1 - cosMax), 2 * Pi * random.next()),
+                time);
+        Hit min_hit(numeric_limits<double>::infinity(), Vector());
+        unsigned objIdx = 0;
+        ++Scene::counts().photon;
+        ObjectPtr obj = scene.intersect(ray, min_hit, objIdx);
+        if (!obj || (source.target && obj != source.target))
+            continue;
+
+        Color power = light.color * Real(Pi * min_hit.t * min_hit.t / pdf);
+        bool mirrored = true;           // only mirrors so far
+        for (unsigned bounce = 0; ; ++bounce)
+        {
+            Material const &material = obj->material;
+            Point point = ray.at(min_hit.t - Hit::offset());
+            Vector N = min_hit.N.normalized();
+            if (N.dot(ray.D) > 0)
+                N = -N;
+
+            if (bounce != 0 && material.kd > 0
+                && (causticPaths || !mirrored || !separateCaustics))
+            {
+                stored.push_back(Photon{{float(point.x), float(point.y), float(point.z)},
+                                        {float(power.r), float(power.g), float(power.b)},
+                                        {float(ray.D.x), float(ray.D.y), float(ray.D.z)}, 0});
+            }
+            if (bounce + 1 == MaxBounces)
+                break;
+
+            // Russian roulette between the mirror, the diffuse lobe and
+            // absorption, by their reflectance; caustic paths end at a
+            // diffuse surface
+            Color diffuse(0, 0, 0);
+            if (!causticPaths && material.kd > 0)
+                diffuse = (material.textured
+                               ? obj->textureColorAt(obj->atRest(point, time), obj->isRotated())
+                               : material.color) * material.kd;
+            double mirror = material.ks * material.ks;
+            double diffuseChance = average(diffuse);
+            double scale = max(1.0, mirror + diffuseChance);
+            double choice = random.next() * scale;
+            Vector D;
+            if (choice < mirror)
+            {
+                D = (ray.D - 2 * N.dot(ray.D) * N).normalized();
+                power *= Real(scale);
+            }
+            else if (choice < mirror + diffuseChance)
+            {
+                D = around(N, sqrt(random.next()), 2 * Pi * random.next());
+                power = power * diffuse * Real(scale / diffuseChance);
+                mirrored = false;
+            }
+            else
+                break;
+
+            ray = Ray(point, D, time);
+            min_hit = Hit(numeric_limits<double>::infinity(), Vector());
+            ++Scene::counts().photon;
+            obj = scene.intersect(ray, min_hit, objIdx);
+            if (!obj)
+                break;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef PHOTONMAP_H_
+#define PHOTONMAP_H_
+
+#include "object.h"
+#include "triple.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Scene;
+
+// "PhotonMap" of the scene file; its presence turns the photon maps on
+struct PhotonSettings
+{
+    bool enabled = false;
+    size_t caustics = 100000;       // photons stored at most, 0: no map
+    size_t indirect = 100000;
+    unsigned nearest = 50;          // photons of an estimate
+    double radius = 0;              // largest search radius, 0: unlimited
+};
+
+// Photon maps (Jensen 1996) of the light the recursive renderer misses:
+// caustics, the light mirrored by specular surfaces onto diffuse ones,
+// and the indirect light of the diffuse surfaces. Photons are emitted from
+// the lights, caustic photons only towards the bounding spheres of the
+// specular objects; they are reflected like the recursive renderer
+// reflects (the mirror by ks squared, the diffuse lobe by kd times the
+// color) and stored where they land on a diffuse surface. The caustic map
+// holds the paths that only met mirrors, the indirect map those that were
+// reflected diffusely (or all, without a caustic map). The irradiance of a
+// point is estimated from its nearest photons with a cone filter.
+//
+// A light delivers the same irradiance at any distance (as with the
+// Whitted shading), so a photon's power is that of its first hit's
+// distance: pi c d^2 per steradian.
+//
+// Threads emit batches of photons, each from its own random numbers, until
+// the budget of the map is reached; the map keeps the first batches that
+// fit it, so it does not depend on the number of threads. The photons are
+// then sorted into a balanced kd-tree in place: the median of a range is
+// its node and the halves on either side its subtrees, so the tree needs
+// no pointers and a search walks contiguous memory. Every level of the
+// tree is split in parallel.
+class PhotonMap
+{
+    public:
+        struct Photon
+        {
+            float position[3];
+            float power[3];
+            float direction[3];     // of travel
+            uint32_t axis;          // of the split at this node
+        };
+
+        // The photons of one map, in kd-tree order
+        class Tree
+        {
+            std::vector<Photon> photons;
+            size_t emitted = 0;
+
+            public:
+                void build(std::vector<Photon> &&stored, size_t emittedPhotons);
+
+                // Irradiance at the point (facing the normal) from at most
+                // nearest photons within radius
+                Color irradiance(Point const &point, Vector const &normal,
+                                 unsigned nearest, double radius) const;
+
+                size_t size() const { return photons.size(); };
+                size_t emittedPhotons() const { return emitted; };
+                size_t bytes() const { return photons.capacity() * sizeof(Photon); };
+
+            private:
+                void split(size_t begin, size_t end);
+        };
+
+    private:
+        Scene &scene;
+        PhotonSettings settings;
+        Tree caustic;
+        Tree global;
+
+    public:
+        PhotonMap(Scene &scene, PhotonSettings const &settings);
+
+        // Emits the photons of both maps and builds their trees
+        void build();
+
+        // Irradiance at the point with the given normal (facing the viewer)
+        Color caustics(Point const &point, Vector const &normal) const;
+        Color indirect(Point const &point, Vector const &normal) const;
+
+        PhotonSettings const &getSettings() const { return settings; };
+        Tree const &causticMap() const { return caustic; };
+        Tree const &indirectMap() const { return global; };
+
+    private:
+        // Where photons are emitted: a light, towards the bounding sphere
+        // of a target or (without one) in all directions
+        struct Source
+        {
+            size_t light;
+            ObjectPtr target;
+            Point center;
+            Real radius;
+            double power;           // estimate, relative to the others
+        };
+
+        void emit(std::vector<Source> const &sources, bool causticPaths, size_t budget,
+                  Tree &tree);
+        void emitBatch(Source const &source, bool causticPaths, size_t count, uint64_t seed,
+                       std::vector<Photon> &stored) const;
+};
+
+#endif
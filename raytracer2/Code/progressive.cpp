@@ -0,0 +1,118 @@
+#include "progressive.h"
+
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    // Root mean square difference of the clamped pixel means and before,
+    // in 8 bit levels; before is updated to the current means
+    double change(AccumImage const &img, vector<Color> &before)
+    {
+        double sum = 0;
+        for (unsigned y = 0; y != img.height(); ++y)
+        {
+            RgbSum const *row = img.row(y);
+            for (unsigned x = 0; x != img.width(); ++x)
+            {
+                Color mean = row[x].mean();
+                mean.clamp();
+                Color &previous = before[y * img.width() + x];
+                Color difference = mean - previous;
+                sum += difference.dot(difference);
+                previous = mean;
+            }
+        }
+        return 255 * sqrt(sum / (3.0 * img.size()));
+    }
+}
+
+unsigned const Progressive::MaxPass;
+
+Progressive::Progressive(Scene &scene, ProgressiveSettings const &settings)
+:
+    scene(scene),
+    settings(settings)
+{}
+
+unsigned Progressive::render(AccumImage &img,
+                             function<void(AccumImage const &)> const &snapshot)
+{
+    typedef Scene::Clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = Clock::time_point::max();
+    if (settings.timeBudget > 0)
+        deadline = start + chrono::duration_cast<Clock::duration>(
+            chrono::duration<double>(settings.timeBudget));
+    Clock::time_point lastSnapshot = start;
+
+    // Snapshots are taken as tiles finish, so a long pass does not hold
+    // them back. They show a copy of the image to which every finished tile
+    // is copied: the tiles still being rendered are not read, they are
+    // shown as they were after the previous pass.
+    AccumImage shown(img);
+    mutex snapshotMutex;
+    Tile const &crop = scene.getCamera().crop();
+    vector<Tile> tiles = scene.tiles();
+    auto tileDone = [&](size_t idx)
+    {
+        if (settings.snapshotInterval <= 0)
+            return;
+        lock_guard<mutex> lock(snapshotMutex);
+        Tile const &tile = tiles[idx];
+        for (unsigned y = tile.y0 - crop.y0; y != tile.y1 - crop.y0; ++y)
+        {
+            RgbSum const *row = img.row(y);
+            copy(row + (tile.x0 - crop.x0), row + (tile.x1 - crop.x0),
+                 shown.row(y) + (tile.x0 - crop.x0));
+        }
+        double elapsed = chrono::duration<double>(Clock::now() - lastSnapshot).count();
+        if (elapsed >= settings.snapshotInterval)
+        {
+            snapshot(shown);
+            lastSnapshot = Clock::now();
+        }
+    };
+
+    unsigned total = scene.getSamplesPerPixel();
+    vector<Color> means(img.size());
+    unsigned done = 0;
+    for (unsigned pass = 1; done != total; ++pass)
+    {
+        unsigned count = min(max(done, 1u), min(MaxPass, total - done));
+        bool complete = scene.renderTiles(img, tiles, done, done + count, deadline, tileDone);
+        double seconds = chrono::duration<double>(Clock::now() - start).count();
+        if (!complete)
+        {
+            cout << "Time budget reached in pass " << pass << " after "
+                 << seconds << " s.\n";
+            break;
+        }
+
+        double error = change(img, means) * sqrt(double(done) / count);
+        done += count;
+        cout << "Pass " << pass << ": " << done << " samples per pixel";
+        if (done != count)
+            cout << ", error " << error;
+        cout << ", " << seconds << " s.\n";
+
+        if (settings.convergence > 0 && done != count && error <= settings.convergence)
+        {
+            cout << "Converged after " << done << " samples per pixel.\n";
+            break;
+        }
+        if (Clock::now() >= deadline)
+        {
+            cout << "Time budget reached after pass " << pass << ".\n";
+            break;
+        }
+    }
+    return done;
+}
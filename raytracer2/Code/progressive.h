@@ -0,0 +1,48 @@
+#ifndef PROGRESSIVE_H_
+#define PROGRESSIVE_H_
+
+#include "image.h"
+
+#include <functional>
+
+class Scene;
+
+// When a progressive render stops and what it writes meanwhile; a zero
+// value disables the limit
+struct ProgressiveSettings
+{
+    double timeBudget = 0;          // seconds of rendering
+    double snapshotInterval = 0;    // seconds between snapshots
+    double convergence = 0;         // estimated rmse, in 8 bit levels
+
+    bool enabled() const
+    {
+        return timeBudget > 0 || snapshotInterval > 0 || convergence > 0;
+    }
+};
+
+// Renders all pixels in passes of 1, 1, 2, 4, ... (at most MaxPass)
+// samples, up to the samples per pixel of the scene. After every pass the
+// error of the image is estimated from how much it changed: if J is the
+// mean of the K new samples and I the mean of the N before, the image is
+// (N I + K J) / (N + K) and its error is about rmse(old, new) * sqrt(N / K).
+// A pass that is cut short by the time budget leaves some pixels with fewer
+// samples, but every pixel is still the mean of its own samples.
+class Progressive
+{
+    Scene &scene;
+    ProgressiveSettings settings;
+
+    public:
+        static unsigned const MaxPass = 64;
+
+        Progressive(Scene &scene, ProgressiveSettings const &settings);
+
+        // Renders into img, calling snapshot with it (as of the tiles that
+        // finished) at the interval, from the thread that finished a tile;
+        // returns the samples per pixel that all pixels have
+        unsigned render(AccumImage &img,
+                        std::function<void(AccumImage const &)> const &snapshot);
+};
+
+#endif
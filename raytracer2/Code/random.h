@@ -0,0 +1,29 @@
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <cstdint>
+
+// splitmix64 stream of uniform numbers in [0, 1); seeded from a hash of
+// what the numbers are for (a pixel sample, a point), so they do not depend
+// on the thread that draws them
+class Random
+{
+    uint64_t state;
+
+    public:
+        explicit Random(uint64_t seed)
+        :
+            state(seed)
+        {}
+
+        double next()
+        {
+            uint64_t hash = (state += 0x9e3779b97f4a7c15ULL);
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+            hash ^= hash >> 31;
+            return (hash >> 11) * (1.0 / (1ULL << 53));
+        }
+};
+
+#endif
@@ -3,25 +3,30 @@
 
 #include "triple.h"
 
-class Ray
+template <typename T>
+class RayT
 {
     public:
-        Point O;        // origin
-        Vector D;       // direction of the ray
-        Ray()
-        : O(Point()), D(Vector())
+        TripleT<T> O;   // origin
+        TripleT<T> D;   // direction of the ray
+        T time;         // in the frame, [0, 1); moving objects are there
+        RayT()
+        : O(TripleT<T>()), D(TripleT<T>()), time(0)
         {
         }
-        Ray(Point const &from, Vector const &dir)
+        RayT(TripleT<T> const &from, TripleT<T> const &dir, T when = 0)
         :
             O(from),
-            D(dir)
+            D(dir),
+            time(when)
         {}
 
-        Point at(double t) const
+        TripleT<T> at(T t) const
         {
             return O + t * D;
         }
 };
 
+typedef RayT<Real> Ray;
+
 #endif
@@ -0,0 +1,87 @@
+#include "raysorter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+using namespace std;
+
+namespace
+{
+    unsigned const CellBits = 4;
+
+    // Spread the low CellBits bits of v to every third bit
+    uint32_t spread(uint32_t v)
+    {
+        uint32_t result = 0;
+        for (unsigned bit = 0; bit != CellBits; ++bit)
+            result |= ((v >> bit) & 1) << (3 * bit);
+        return result;
+    }
+
+    uint32_t cell(double v, double lo, double scale)
+    {
+        double const maxCell = (1 << CellBits) - 1;
+        return static_cast<uint32_t>(min(maxCell, (v - lo) * scale));
+    }
+}
+
+RaySorter::RaySorter(size_t batchSize)
+:
+    d_batchSize(batchSize)
+{}
+
+void RaySorter::order(vector<unsigned> &order,
+                      vector<Real> const &ox,
+                      vector<Real> const &oy,
+                      vector<Real> const &oz,
+                      vector<Real> const &dx,
+                      vector<Real> const &dy,
+                      vector<Real> const &dz) const
+{
+    size_t count = ox.size();
+    order.resize(count);
+    iota(order.begin(), order.end(), 0);
+    if (d_batchSize <= 1)
+        return;
+
+    vector<uint64_t> keys;
+    for (size_t begin = 0; begin < count; begin += d_batchSize)
+    {
+        size_t end = min(begin + d_batchSize, count);
+
+        Real lo[3] = {ox[begin], oy[begin], oz[begin]};
+        Real hi[3] = {ox[begin], oy[begin], oz[begin]};
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            lo[0] = min(lo[0], ox[idx]);
+            lo[1] = min(lo[1], oy[idx]);
+            lo[2] = min(lo[2], oz[idx]);
+            hi[0] = max(hi[0], ox[idx]);
+            hi[1] = max(hi[1], oy[idx]);
+            hi[2] = max(hi[2], oz[idx]);
+        }
+        double scale[3];
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            double extent = hi[axis] - lo[axis];
+            scale[axis] = extent > 0 ? (1 << CellBits) / extent : 0;
+        }
+
+        // key: octant | morton code of the origin cell | queue position
+        keys.clear();
+        for (size_t idx = begin; idx != end; ++idx)
+        {
+            uint64_t octant = (dx[idx] < 0) | (dy[idx] < 0) << 1 | (dz[idx] < 0) << 2;
+            uint64_t morton = spread(cell(ox[idx], lo[0], scale[0]))
+                            | spread(cell(oy[idx], lo[1], scale[1])) << 1
+                            | spread(cell(oz[idx], lo[2], scale[2])) << 2;
+            keys.push_back((octant << (3 * CellBits) | morton) << 32 | idx);
+        }
+        sort(keys.begin(), keys.end());
+
+        for (size_t idx = begin; idx != end; ++idx)
+            order[idx] = static_cast<unsigned>(keys[idx - begin]);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef RAYSORTER_H_
+#define RAYSORTER_H_
+
+#include "triple.h"
+
+#include <cstddef>
+#include <vector>
+
+// Orders batches of rays so that rays leaving the same region of space in
+// the same direction octant are intersected one after another. Rays are
+// binned per batch on a 16x16x16 grid over the bounds of their origins;
+// the octant is the major key, the Morton code of the cell the minor key.
+// Only the wavefront renderer sorts (its queues are the batches); the
+// recursive tile renderer traces every secondary ray as it is spawned.
+class RaySorter
+{
+    size_t d_batchSize;
+
+    public:
+        RaySorter(size_t batchSize = 0);    // 0: keep rays in queue order
+
+        bool sorts() const { return d_batchSize > 1; };
+
+        // Fill order with the processing order of the rays given by their
+        // origins and directions
+        void order(std::vector<unsigned> &order,
+                   std::vector<Real> const &ox,
+                   std::vector<Real> const &oy,
+                   std::vector<Real> const &oz,
+                   std::vector<Real> const &dx,
+                   std::vector<Real> const &dy,
+                   std::vector<Real> const &dz) const;
+};
+
+#endif
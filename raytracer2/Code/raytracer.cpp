@@ -1,8 +1,18 @@
 #include "raytracer.h"
 
+#include "checkpoint.h"
+#include "cpu.h"
+#include "fastmath.h"
+#include "gbuffer.h"
+#include "hash.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
+#include "motion.h"
+#include "parallel.h"
+#include "texture.h"
+#include "texturecache.h"
+#include "tilecache.h"
 #include "triple.h"
 
 // =============================================================================
@@ -21,11 +31,23 @@
 // -- End of shape includes ----------------------------------------------------
 // =============================================================================
 
+#include "samplers/bluenoise.h"
+#include "samplers/halton.h"
+#include "samplers/regular.h"
+#include "samplers/sobol.h"
+#include "samplers/stratified.h"
+
 #include "json/json.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
@@ -75,6 +97,48 @@ bool Raytracer::parseObjectNode(json const &node)
 		double h(node["height"]);
 		obj = ObjectPtr(new Cylinder(p, r, h));
 	}
+	else if (node["type"] == "mesh")
+	{
+		// The triangles of an OBJ model (shared through the resources),
+		// scaled and moved to position
+		string const file = node["model"];
+		ResourceCache::MeshPtr mesh = resources->mesh("../Scenes/" + file);
+		if (mesh->size() < 3)
+			throw runtime_error("Could not load model " + file + '.');
+		Point pos(node["position"]);
+		double scale = node.find("scale") != node.end() ? node["scale"].get<double>() : 1.0;
+		Material material = parseMaterialNode(node["material"]);
+
+		auto place = [&](Vertex const &vertex)
+		{
+			return pos + scale * Point(vertex.x, vertex.y, vertex.z);
+		};
+
+		// a moving model turns about the middle of its box, as a whole
+		Motion motion;
+		if (node.find("motion") != node.end())
+		{
+			Point lower = place((*mesh)[0]);
+			Point upper = lower;
+			for (Vertex const &vertex : *mesh)
+			{
+				Point point = place(vertex);
+				lower = Point(min(lower.x, point.x), min(lower.y, point.y), min(lower.z, point.z));
+				upper = Point(max(upper.x, point.x), max(upper.y, point.y), max(upper.z, point.z));
+			}
+			motion = parseMotionNode(node["motion"], (lower + upper) / 2);
+		}
+		for (size_t idx = 0; idx + 2 < mesh->size(); idx += 3)
+		{
+			ObjectPtr triangle(new Triangle(place((*mesh)[idx]), place((*mesh)[idx + 1]),
+			                                place((*mesh)[idx + 2])));
+			triangle->material = material;
+			if (motion.moves())
+				triangle = make_shared<MovingObject>(triangle, motion);
+			scene.addObject(triangle);
+		}
+		return true;
+	}
 	else
 	{
 		cerr << "Unknown object type: " << node["type"] << ".\n";
@@ -87,17 +151,138 @@ bool Raytracer::parseObjectNode(json const &node)
 	if (!obj)
 		return false;
 
-	// Parse material and add object to the scene
+	// Parse material and motion and add object to the scene; the object
+	// turns about the center of its bounds (an unbounded one about the
+	// origin)
 	obj->material = parseMaterialNode(node["material"]);
+	if (node.find("motion") != node.end())
+	{
+		Point center;
+		Real radius;
+		if (!obj->bounds(center, radius))
+			center = Point();
+		Motion motion = parseMotionNode(node["motion"], center);
+		if (motion.moves())
+			obj = make_shared<MovingObject>(obj, motion);
+	}
 	scene.addObject(obj);
 	return true;
 }
 
+// "motion": {"translate", "rotate" (the axis), "angle" (degrees), "scale",
+// "pivot"}, all optional: the change of the object over the frame
+Motion Raytracer::parseMotionNode(json const &node, Point const &pivot) const
+{
+	Motion motion;
+	motion.pivot = pivot;
+	if (node.find("translate") != node.end())
+		motion.translation = Vector(node["translate"]);
+	if (node.find("rotate") != node.end())
+		motion.axis = Vector(node["rotate"]);
+	if (node.find("pivot") != node.end())
+		motion.pivot = Point(node["pivot"]);
+	motion.angle = node.value("angle", 0.0);
+	motion.scale = node.value("scale", 1.0);
+	if (motion.axis.length_2() == 0)
+		throw runtime_error("A motion needs a rotation axis.");
+	if (motion.scale <= 0)
+		throw runtime_error("A motion needs a positive scale.");
+	motion.axis.normalize();
+	return motion;
+}
+
+SamplerPtr Raytracer::makeSampler(string const &type, unsigned samples, uint32_t seed) const
+{
+	if (samples == 0)
+		throw runtime_error("A pixel needs at least one sample.");
+	if (type == "regular")
+		return make_shared<RegularSampler>(samples, seed);
+	if (type == "stratified")
+		return make_shared<StratifiedSampler>(samples, seed);
+	if (type == "halton")
+		return make_shared<HaltonSampler>(samples, seed);
+	if (type == "sobol")
+		return make_shared<SobolSampler>(samples, seed);
+	if (type == "bluenoise")
+		return make_shared<BlueNoiseSampler>(samples, seed);
+	throw runtime_error("Unknown sampler: " + type + '.');
+}
+
+// "Camera": {"eye", "center", "up", "viewSize": [width, height]}, the length
+// of up being the size of a pixel, or just an "Eye" above the plane z = 0;
+// the resolution and crop window of the overrides are applied. A "motion":
+// {"eye", "center"} of the Camera is where it is at the end of the frame.
+Camera Raytracer::parseCamera(json const &jsonscene) const
+{
+	Camera camera;
+	if (jsonscene.find("Camera") != jsonscene.end())
+	{
+		json const &node = jsonscene["Camera"];
+		unsigned width = node["viewSize"][0];
+		unsigned height = node["viewSize"][1];
+		camera = Camera(Point(node["eye"]), Point(node["center"]), Vector(node["up"]),
+		                width, height);
+		if (node.find("motion") != node.end())
+		{
+			json const &end = node["motion"];
+			camera.setEnd(Point(end.find("eye") != end.end() ? end["eye"] : node["eye"]),
+			              Point(end.find("center") != end.end() ? end["center"] : node["center"]));
+		}
+	}
+	else
+		camera = Camera(Point(jsonscene["Eye"]));
+
+	if (overrides.width != 0)
+	{
+		unsigned height = overrides.height;
+		if (height == 0)    // keep the aspect ratio
+			height = max(1.0, round(double(overrides.width) * camera.height() / camera.width()));
+		camera.resize(overrides.width, height);
+	}
+	if (!overrides.crop.empty())
+		camera.setCrop(overrides.crop);
+	return camera;
+}
+
+// An area light has a "shape": "rect" ("edge1" and "edge2"), "disk"
+// ("normal" and "radius") or "sphere" ("radius"), "samples" (rounded up to
+// a square, default 16) and "probes" (default 4, 0 traces every sample)
 Light Raytracer::parseLightNode(json const &node) const
 {
 	Point pos(node["position"]);
 	Color col(node["color"]);
-	return Light(pos, col);
+	string type = node.value("shape", "point");
+	if (type == "point")
+		return Light(pos, col);
+
+	LightShape shape;
+	if (type == "rect")
+	{
+		shape.type = LightShape::Rect;
+		shape.edge1 = Vector(node["edge1"]);
+		shape.edge2 = Vector(node["edge2"]);
+	}
+	else if (type == "disk")
+	{
+		shape.type = LightShape::Disk;
+		shape.normal = Vector(node["normal"]);
+		shape.radius = node["radius"];
+		if (shape.normal.length() == 0)
+			throw runtime_error("A disk light needs a normal.");
+	}
+	else if (type == "sphere")
+	{
+		shape.type = LightShape::Sphere;
+		shape.radius = node["radius"];
+	}
+	else
+		throw runtime_error("Unknown light shape: " + type + '.');
+
+	unsigned samples = node.value("samples", 16u);
+	unsigned probes = node.value("probes", 4u);
+	unsigned grid = max(1u, unsigned(ceil(sqrt(double(samples)))));
+	unsigned probeGrid = unsigned(ceil(sqrt(double(probes))));
+	return Light(pos, col, shape, grid, probeGrid);
 }
 
 Material Raytracer::parseMaterialNode(json const &node) const
@@ -116,7 +301,48 @@ Material Raytracer::parseMaterialNode(json const &node) const
 		string const file = node["texture"];
 		string append = "../Scenes/";
 		append = append + file;
-		return Material(append, ka, kd, ks, n);
+
+		Texture::Compression compression = Texture::Compression::None;
+		if (node.find("compression") != node.end() && node["compression"] == "bc1")
+			compression = Texture::Compression::Bc1;
+		// trilinear filtering samples the mip pyramid, which is only built
+		// when it is needed
+		string filter = node.find("filter") != node.end() ? node["filter"].get<string>() : "nearest";
+		bool mipmaps = filter == "trilinear";
+		string layout = node.find("layout") != node.end() ? node["layout"].get<string>() : "morton";
+
+		// Scenes that use the file with the same settings share the texture
+		string key = append + '|' + (compression == Texture::Compression::Bc1 ? "bc1" : "")
+		           + '|' + filter + '|' + layout + '|'
+		           + (tiledTextures ? textureCacheDirectory : string());
+		TexturePtr texture = resources->texture(key, [&]
+		{
+			TexturePtr loaded;
+			if (tiledTextures)
+			{
+				// converted once, then mapped; tiles always carry the mip levels
+				string tiles = textureCacheDirectory + '/' + file + ".tiles";
+				TiledTexture::convert(append, tiles);
+				loaded = make_shared<Texture>(make_shared<TiledTexture>(tiles));
+			}
+			else
+				loaded = make_shared<Texture>(append, compression, mipmaps,
+				                              layout == "linear" ? Texture::Layout::Linear
+				                                                 : Texture::Layout::Morton);
+			if (filter == "bilinear")
+				loaded->setFilter(Texture::Filter::Bilinear);
+			else if (filter == "trilinear")
+				loaded->setFilter(Texture::Filter::Trilinear);
+
+			*messages << "Loaded texture " << file << " (" << loaded->width() << 'x'
+			          << loaded->height() << ", " << loaded->levels() << " levels, ";
+			if (loaded->tiled())
+				*messages << "tiled).\n";
+			else
+				*messages << loaded->bytes() / 1024 << " KiB).\n";
+			return loaded;
+		});
+		return Material(texture, ka, kd, ks, n);
 	}
 	return Material();
 }
@@ -127,23 +353,110 @@ try
 	// Read and parse input json file
 	ifstream infile(ifname);
 	if (!infile) throw runtime_error("Could not open input file for reading.");
-	json jsonscene;
-	infile >> jsonscene;
+	string text{istreambuf_iterator<char>(infile), istreambuf_iterator<char>()};
+	json jsonscene = json::parse(text);
+
+	// A checkpoint only continues a render of the same scene and settings
+	ostringstream settings;
+	settings << text << '\n' << overrides.width << ' ' << overrides.height << ' '
+	         << overrides.samples << ' ' << overrides.recursionDepth << ' '
+	         << overrides.shadows << ' ' << overrides.crop.x0 << ' ' << overrides.crop.y0
+	         << ' ' << overrides.crop.x1 << ' ' << overrides.crop.y1;
+	string const inputs = settings.str();
+	fingerprint = Hasher().add(inputs.data(), inputs.size()).value();
 
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
 // =============================================================================
 
-	Point eye(jsonscene["Eye"]);
+	scene.setCamera(parseCamera(jsonscene));
 
 	if (jsonscene.find("Shadows") != jsonscene.end())
 		scene.setShadows(jsonscene["Shadows"]);
+	if (overrides.shadows >= 0)
+		scene.setShadows(overrides.shadows != 0);
+	// SuperSamplingFactor n is n x n samples per pixel
+	unsigned samples = 1;
 	if (jsonscene.find("SuperSamplingFactor") != jsonscene.end())
-		scene.setSamplingFactor(jsonscene["SuperSamplingFactor"]);
+	{
+		unsigned factor = jsonscene["SuperSamplingFactor"];
+		samples = factor * factor;
+	}
+	if (jsonscene.find("SamplesPerPixel") != jsonscene.end())
+		samples = jsonscene["SamplesPerPixel"];
+	if (overrides.samples != 0)
+		samples = overrides.samples;
+	uint32_t seed = 0;
+	if (jsonscene.find("SamplerSeed") != jsonscene.end())
+		seed = jsonscene["SamplerSeed"];
+	string sampler = "regular";
+	if (jsonscene.find("Sampler") != jsonscene.end())
+		sampler = jsonscene["Sampler"];
+	scene.setSampler(makeSampler(sampler, samples, seed));
 	if (jsonscene.find("MaxRecursionDepth") != jsonscene.end())
 		scene.setRecursionDepth(jsonscene["MaxRecursionDepth"]);
-
-	scene.setEye(eye);
+	if (overrides.recursionDepth >= 0)
+		scene.setRecursionDepth(overrides.recursionDepth);
+	if (jsonscene.find("Renderer") != jsonscene.end())
+		scene.setWavefront(jsonscene["Renderer"] == "wavefront");
+	if (jsonscene.find("Integrator") != jsonscene.end())
+	{
+		string integrator = jsonscene["Integrator"];
+		if (integrator != "whitted" && integrator != "path")
+			throw runtime_error("Unknown integrator: " + integrator + '.');
+		scene.setIntegrator(integrator == "path" ? Scene::Integrator::Path
+		                                         : Scene::Integrator::Whitted);
+	}
+	if (jsonscene.find("MaxPathLength") != jsonscene.end())
+		scene.setMaxPathLength(jsonscene["MaxPathLength"]);
+	if (jsonscene.find("SortBatchSize") != jsonscene.end())
+		scene.setSortBatchSize(jsonscene["SortBatchSize"]);
+	if (jsonscene.find("MathPrecision") != jsonscene.end())
+		precision = jsonscene["MathPrecision"] == "fast" ?
+			FastMath::Precision::Fast : FastMath::Precision::Exact;
+	if (jsonscene.find("ThroughputEpsilon") != jsonscene.end())
+		scene.setThroughputEpsilon(jsonscene["ThroughputEpsilon"]);
+	if (jsonscene.find("RussianRoulette") != jsonscene.end())
+		scene.setRussianRoulette(jsonscene["RussianRoulette"]);
+	if (jsonscene.find("TextureCacheMemory") != jsonscene.end())
+	{
+		tiledTextures = true;
+		size_t mebibytes = jsonscene["TextureCacheMemory"];
+		textureCacheBudget = mebibytes << 20;
+	}
+	if (jsonscene.find("TextureCacheDirectory") != jsonscene.end())
+		textureCacheDirectory = jsonscene["TextureCacheDirectory"];
+	// "IrradianceCache": {"accuracy", "rays", "minSpacing", "maxSpacing",
+	// "gradients", "precompute", "file"}, each optional
+	if (jsonscene.find("IrradianceCache") != jsonscene.end())
+	{
+		json const &node = jsonscene["IrradianceCache"];
+		irradiance.enabled = true;
+		irradiance.accuracy = node.value("accuracy", irradiance.accuracy);
+		irradiance.rays = node.value("rays", irradiance.rays);
+		irradiance.minSpacing = node.value("minSpacing", irradiance.minSpacing);
+		irradiance.maxSpacing = node.value("maxSpacing", irradiance.maxSpacing);
+		irradiance.gradients = node.value("gradients", irradiance.gradients);
+		irradiance.precompute = node.value("precompute", irradiance.precompute);
+		irradiance.file = node.value("file", irradiance.file);
+		if (irradiance.accuracy <= 0 || irradiance.rays == 0 || irradiance.minSpacing <= 0
+		    || irradiance.maxSpacing < irradiance.minSpacing)
+			throw runtime_error("IrradianceCache: accuracy, rays and minSpacing must be "
+			                    "positive and maxSpacing at least minSpacing.");
+	}
+	// "PhotonMap": {"caustics", "indirect", "nearest", "radius"}, each
+	// optional
+	if (jsonscene.find("PhotonMap") != jsonscene.end())
+	{
+		json const &node = jsonscene["PhotonMap"];
+		photons.enabled = true;
+		photons.caustics = node.value("caustics", photons.caustics);
+		photons.indirect = node.value("indirect", photons.indirect);
+		photons.nearest = node.value("nearest", photons.nearest);
+		photons.radius = node.value("radius", photons.radius);
+		if (photons.nearest == 0 || photons.radius < 0)
+			throw runtime_error("PhotonMap: nearest must be positive and radius not negative.");
+	}
 
 	// Read cube model
 	// OBJLoader model("../Scenes/cube.obj");
@@ -167,7 +480,9 @@ try
 		if (parseObjectNode(objectNode))
 			++objCount;
 
-	cout << "Parsed " << objCount << " objects.\n";
+	*messages << "Parsed " << objCount << " objects.\n";
+
+	scene.prepare();
 
 // =============================================================================
 // -- End of scene data reading ------------------------------------------------
@@ -181,13 +496,122 @@ catch (exception const &ex)
 	return false;
 }
 
+void Raytracer::activate() const
+{
+	FastMath::precision = precision;
+	if (tiledTextures)
+		TextureCache::instance().setBudget(textureCacheBudget);
+	parallelThreadLimit() = overrides.threads;
+}
+
 void Raytracer::renderToFile(string const &ofname)
 {
-	// TODO: the size may be a settings in your file
-	Image img(400, 400);
-	cout << "Tracing...\n";
-	scene.render(img);
-	cout << "Writing image to " << ofname << "...\n";
-	img.write_png(ofname);
-	cout << "Done.\n";
+	activate();
+	Camera const &camera = scene.getCamera();
+	Tile const &crop = camera.crop();
+	AccumImage img(crop.width(), crop.height());
+	*messages << "Kernels: " << Cpu::isa() << " for " << Cpu::kernels() << '\n';
+	*messages << "Film: " << camera.width() << 'x' << camera.height();
+	if (crop.width() != camera.width() || crop.height() != camera.height())
+		*messages << ", crop [" << crop.x0 << ", " << crop.x1 << ") x ["
+		     << crop.y0 << ", " << crop.y1 << ')';
+	*messages << ", " << scene.getSamplesPerPixel() << " samples per pixel.\n";
+	*messages << "Tracing...\n";
+	auto start = chrono::steady_clock::now();
+	if (scene.getWavefront() && scene.getIntegrator() == Scene::Integrator::Whitted
+	    && scene.hasAreaLights())
+		*messages << "The wavefront renderer has no area lights, rendering recursively.\n";
+	// the irradiance cache gathers the photons' indirect light
+	shared_ptr<PhotonMap> photonMap;
+	if (photons.enabled && scene.getIntegrator() == Scene::Integrator::Path)
+		*messages << "The path tracer traces caustics and indirect light, it needs no photon map.\n";
+	else if (photons.enabled && scene.getWavefront())
+		*messages << "The photon map needs the recursive renderer, rendering without it.\n";
+	else if (photons.enabled)
+	{
+		photonMap = make_shared<PhotonMap>(scene, photons);
+		photonMap->build();
+		chrono::duration<double> built = chrono::steady_clock::now() - start;
+		PhotonMap::Tree const &caustic = photonMap->causticMap();
+		PhotonMap::Tree const &global = photonMap->indirectMap();
+		*messages << "Photon map: " << caustic.size() << " caustic photons (of "
+		          << caustic.emittedPhotons() << " emitted) and " << global.size()
+		          << " indirect (of " << global.emittedPhotons() << "), "
+		          << (caustic.bytes() + global.bytes()) / 1024 << " KiB, built in "
+		          << built.count() << " s.\n";
+		scene.setPhotonMap(photonMap);
+	}
+	shared_ptr<IrradianceCache> indirect;
+	if (irradiance.enabled && scene.getIntegrator() == Scene::Integrator::Path)
+		*messages << "The path tracer traces the indirect light, it needs no irradiance cache.\n";
+	else if (irradiance.enabled && scene.getWavefront())
+		*messages << "The irradiance cache needs the recursive renderer, rendering without it.\n";
+	else if (irradiance.enabled)
+	{
+		indirect = make_shared<IrradianceCache>(scene, irradiance);
+		if (!irradiance.file.empty() && indirect->load(irradiance.file))
+			*messages << "Irradiance cache: loaded " << indirect->size() << " records from "
+			          << irradiance.file << ".\n";
+		if (irradiance.precompute != 0)
+		{
+			indirect->precompute(irradiance.precompute);
+			*messages << "Irradiance cache: " << indirect->size() << " records after the first pass.\n";
+		}
+		scene.setIrradianceCache(indirect);
+	}
+	string checkpointName = ofname + ".checkpoint";
+	if (checkpoint.enabled())
+		Checkpoint(scene, checkpointName, fingerprint, checkpoint).render(img);
+	else if (progressive.enabled())
+	{
+		// snapshots replace the extension of the output by -snapshot.png
+		string snapshotName = ofname.substr(0, ofname.find_last_of('.')) + "-snapshot.png";
+		Progressive(scene, progressive).render(img, [&](AccumImage const &partial)
+		{
+			resolve(partial).write_png(snapshotName);
+			*messages << "Wrote snapshot " << snapshotName << ".\n";
+		});
+	}
+	else if (!tileCacheDirectory.empty())
+		TileCache(scene, tileCacheDirectory).render(img);
+	else if (!gbufferFile.empty())
+		GBuffer(scene, gbufferFile).render(img);
+	else
+		scene.render(img);
+	chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+	RayStats const &stats = scene.getStats();
+	*messages << "Traced " << stats.total() << " rays (" << stats.primary
+	     << " primary, " << stats.shadow << " shadow, "
+	     << stats.reflected << " reflected";
+	if (stats.indirect != 0)
+		*messages << ", " << stats.indirect << " indirect";
+	if (stats.photon != 0)
+		*messages << ", " << stats.photon << " photon";
+	*messages << ").\n";
+	if (stats.areaLit != 0)
+		*messages << "Shadows: " << double(stats.shadow) / stats.shaded
+		          << " rays per shading point, " << 100.0 * stats.penumbra / stats.areaLit
+		          << "% of the area lit points in a penumbra.\n";
+	if (indirect)
+	{
+		*messages << "Irradiance cache: " << indirect->size() << " records, "
+		     << indirect->computedLookups() << " lookups computed, "
+		     << indirect->interpolatedLookups() << " interpolated.\n";
+		scene.setIrradianceCache(nullptr);
+		if (!irradiance.file.empty())
+			indirect->save(irradiance.file);
+	}
+	scene.setPhotonMap(nullptr);
+	*messages << "Rendered in " << seconds.count() << " s, "
+	     << stats.total() / seconds.count() << " rays/s.\n";
+	TextureCache &cache = TextureCache::instance();
+	if (!cache.empty())
+		*messages << "Texture cache: " << cache.faults() << " tiles read, "
+		     << cache.evictions() << " evicted, peak " << cache.peak() / 1024
+		     << " KiB resident (budget " << cache.budget() / 1024 << " KiB).\n";
+	*messages << "Writing image to " << ofname << "...\n";
+	resolve(img).write_png(ofname);
+	if (checkpoint.enabled())
+		remove(checkpointName.c_str());    // the render is complete
+	*messages << "Done.\n";
 }
@@ -1,31 +1,88 @@
 #ifndef RAYTRACER_H_
 #define RAYTRACER_H_
 
+#include "checkpoint.h"
+#include "irradiancecache.h"
+#include "fastmath.h"
+#include "photonmap.h"
+#include "progressive.h"
+#include "resources.h"
+#include "sampler.h"
 #include "scene.h"
 
+#include <iostream>
+#include <memory>
 #include <string>
 
 // Forward declerations
 class Light;
 class Material;
+struct Motion;
 
 #include "json/json_fwd.h"
 
+// Settings that replace those of the scene file (given on the command
+// line); the defaults keep the scene's
+struct RenderOverrides
+{
+    unsigned width = 0;             // resolution; without a height the
+    unsigned height = 0;            // aspect ratio is kept
+    unsigned samples = 0;           // per pixel
+    int recursionDepth = -1;
+    int shadows = -1;               // 0 or 1
+    unsigned threads = 0;
+    Tile crop{0, 0, 0, 0};          // film pixels, empty is the whole film
+};
+
 class Raytracer
 {
     Scene scene;
+    RenderOverrides overrides;
+    ProgressiveSettings progressive;
+    CheckpointSettings checkpoint;
+    IrradianceSettings irradiance;
+    PhotonSettings photons;
+    std::string tileCacheDirectory;     // empty: no tile cache
+    std::string gbufferFile;            // empty: no G-buffer
+    uint64_t fingerprint = 0;           // of the scene file and overrides
+    bool tiledTextures = false;         // load textures through TextureCache
+    std::string textureCacheDirectory = ".";
+    std::shared_ptr<ResourceCache> resources = std::make_shared<ResourceCache>();
+    std::ostream *messages = &std::cout;
+
+    // Process wide settings of the scene, applied by activate()
+    FastMath::Precision precision = FastMath::Precision::Exact;
+    size_t textureCacheBudget = 0;      // bytes
 
     public:
 
+        // Reads the scene, without changing process wide state, so one
+        // scene can be read while another renders
         bool readScene(std::string const &ifname);
+        // Applies the scene's math precision, texture cache budget and
+        // thread limit; renderToFile calls it
+        void activate() const;
         void renderToFile(std::string const &ofname);
 
+        Scene &getScene() { return scene; };
+        void setProgressive(ProgressiveSettings const &set) { progressive = set; };
+        void setOverrides(RenderOverrides const &set) { overrides = set; }; // before readScene
+        void setCheckpoint(CheckpointSettings const &set) { checkpoint = set; };
+        void setTileCache(std::string const &set) { tileCacheDirectory = set; };
+        void setGBuffer(std::string const &set) { gbufferFile = set; };
+        void setResources(std::shared_ptr<ResourceCache> const &set) { resources = set; };
+        void setLog(std::ostream &set) { messages = &set; };
+
     private:
 
         bool parseObjectNode(nlohmann::json const &node);
 
+        Camera parseCamera(nlohmann::json const &jsonscene) const;
         Light parseLightNode(nlohmann::json const &node) const;
+        Motion parseMotionNode(nlohmann::json const &node, Point const &pivot) const;
         Material parseMaterialNode(nlohmann::json const &node) const;
+        SamplerPtr makeSampler(std::string const &type, unsigned samples,
+                               uint32_t seed) const;
 };
 
 #endif
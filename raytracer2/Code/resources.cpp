@@ -0,0 +1,43 @@
+#include "resources.h"
+
+#include "objloader.h"
+
+using namespace std;
+
+// Loading happens outside the lock, so other resources can be looked up
+// meanwhile; if two threads load the same one, the first stored is kept
+TexturePtr ResourceCache::texture(string const &key, function<TexturePtr()> const &load)
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        auto cached = d_textures.find(key);
+        if (cached != d_textures.end())
+        {
+            ++d_hits;
+            return cached->second;
+        }
+    }
+
+    TexturePtr loaded = load();
+    lock_guard<mutex> lock(d_mutex);
+    ++d_loads;
+    return d_textures.emplace(key, loaded).first->second;
+}
+
+ResourceCache::MeshPtr ResourceCache::mesh(string const &filename)
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        auto cached = d_meshes.find(filename);
+        if (cached != d_meshes.end())
+        {
+            ++d_hits;
+            return cached->second;
+        }
+    }
+
+    MeshPtr loaded = make_shared<vector<Vertex> const>(OBJLoader(filename).vertex_data());
+    lock_guard<mutex> lock(d_mutex);
+    ++d_loads;
+    return d_meshes.emplace(filename, loaded).first->second;
+}
@@ -0,0 +1,42 @@
+#ifndef RESOURCES_H_
+#define RESOURCES_H_
+
+#include "texture.h"
+#include "vertex.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Decoded textures and meshes, shared by the scenes that use the same files
+// (and settings), so that a batch of scenes reads and decodes every file
+// once. Textures and meshes are not changed after loading, scenes rendered
+// at the same time can share them. Thread safe.
+class ResourceCache
+{
+    public:
+        typedef std::shared_ptr<std::vector<Vertex> const> MeshPtr;
+
+    private:
+        std::mutex d_mutex;
+        std::map<std::string, TexturePtr> d_textures;
+        std::map<std::string, MeshPtr> d_meshes;
+        unsigned long long d_loads = 0;
+        unsigned long long d_hits = 0;
+
+    public:
+        // The texture cached under key (the file and its settings), which
+        // load is called for if there is none
+        TexturePtr texture(std::string const &key, std::function<TexturePtr()> const &load);
+
+        // The triangles of an OBJ file, three vertices each
+        MeshPtr mesh(std::string const &filename);
+
+        unsigned long long loads() const { return d_loads; };
+        unsigned long long hits() const { return d_hits; };
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <cstdint>
+#include <memory>
+
+class Sampler;
+typedef std::shared_ptr<Sampler> SamplerPtr;
+
+// Places the samples of a pixel. A sample position depends only on the
+// pixel, the sample index and the seed, never on the thread or tile that
+// renders the pixel, so renders are reproducible bit for bit.
+class Sampler
+{
+    public:
+        unsigned const samples;     // per pixel
+        uint32_t const seed;
+
+        Sampler(unsigned samples, uint32_t seed)
+        :
+            samples(samples),
+            seed(seed)
+        {}
+
+        virtual ~Sampler() = default;
+
+        // Position of sample index (< samples) in pixel (x, y), in [0, 1)^2
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const = 0;
+
+        // Time of sample index in pixel (x, y), in [0, 1), for motion blur.
+        // The samples of a pixel take one stratum of [0, 1) each, jittered;
+        // the strata are shuffled per pixel, so a sample's time does not
+        // follow its position.
+        virtual float time(unsigned x, unsigned y, unsigned index) const
+        {
+            uint32_t stream = hash(pixelSeed(x, y) ^ 0x9e3779b9);
+            return (permute(index, samples, stream) + unit(hash(stream + index))) / samples;
+        }
+
+    protected:
+        // Integer hash with good avalanche (Wellons' lowbias32)
+        static uint32_t hash(uint32_t value)
+        {
+            value ^= value >> 16;
+            value *= 0x7feb352d;
+            value ^= value >> 15;
+            value *= 0x846ca68b;
+            value ^= value >> 16;
+            return value;
+        }
+
+        // Seed of the random stream of pixel (x, y)
+        uint32_t pixelSeed(unsigned x, unsigned y) const
+        {
+            return hash(x + hash(y + hash(seed)));
+        }
+
+        // Element index of a random permutation of [0, length) chosen by
+        // seed (Kensler, Correlated Multi-Jittered Sampling, 2013)
+        static uint32_t permute(uint32_t index, uint32_t length, uint32_t seed)
+        {
+            uint32_t mask = length - 1;
+            mask |= mask >> 1;
+            mask |= mask >> 2;
+            mask |= mask >> 4;
+            mask |= mask >> 8;
+            mask |= mask >> 16;
+            do
+            {
+                index ^= seed;
+                index *= 0xe170893d;
+                index ^= seed >> 16;
+                index ^= (index & mask) >> 4;
+                index ^= seed >> 8;
+                index *= 0x0929eb3f;
+                index ^= seed >> 23;
+                index ^= (index & mask) >> 1;
+                index *= 1 | seed >> 27;
+                index *= 0x6935fa69;
+                index ^= (index & mask) >> 11;
+                index *= 0x74dcb303;
+                index ^= (index & mask) >> 2;
+                index *= 0x9e501cc3;
+                index ^= (index & mask) >> 2;
+                index *= 0xc860a3df;
+                index &= mask;
+                index ^= index >> 5;
+            }
+            while (index >= length);
+            return (index + seed) % length;
+        }
+
+        // The top 24 bits as a float in [0, 1)
+        static float unit(uint32_t bits)
+        {
+            return (bits >> 8) * (1.0f / (1 << 24));
+        }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "bluenoise.h"
+#include "sobol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+namespace
+{
+    unsigned const Size = BlueNoiseSampler::MaskSize;
+    unsigned const Count = Size * Size;
+
+    // Gaussian energy of a pattern of points on the Size x Size torus, kept
+    // up to date as points are added and removed
+    class Energy
+    {
+        vector<float> d_kernel;     // by toroidal offset
+        vector<float> d_energy;
+
+        public:
+            Energy()
+            :
+                d_kernel(Count),
+                d_energy(Count)
+            {
+                float const sigma = 1.5;
+                for (unsigned dy = 0; dy != Size; ++dy)
+                {
+                    for (unsigned dx = 0; dx != Size; ++dx)
+                    {
+                        float x = min(dx, Size - dx);
+                        float y = min(dy, Size - dy);
+                        d_kernel[dy * Size + dx] = exp(-(x * x + y * y) / (2 * sigma * sigma));
+                    }
+                }
+            }
+
+            void update(unsigned point, float sign)
+            {
+                unsigned px = point % Size;
+                unsigned py = point / Size;
+                for (unsigned y = 0; y != Size; ++y)
+                {
+                    float const *kernel = &d_kernel[(y + Size - py) % Size * Size];
+                    float *energy = &d_energy[y * Size];
+                    for (unsigned x = 0; x != Size; ++x)
+                        energy[x] += sign * kernel[(x + Size - px) % Size];
+                }
+            }
+
+            // The point with the highest energy (tightest cluster) among
+            // those set in pattern, or the lowest (largest void) among the
+            // ones not set
+            unsigned extreme(vector<bool> const &pattern, bool cluster) const
+            {
+                unsigned best = Count;
+                for (unsigned point = 0; point != Count; ++point)
+                {
+                    if (pattern[point] != cluster)
+                        continue;
+                    if (best == Count || (cluster ? d_energy[point] > d_energy[best]
+                                                  : d_energy[point] < d_energy[best]))
+                        best = point;
+                }
+                return best;
+            }
+    };
+
+    vector<float> voidAndCluster(uint32_t seed)
+    {
+        // Initial pattern: a tenth of the points, spread out by moving the
+        // tightest cluster to the largest void until that changes nothing
+        mt19937 rng(seed);
+        vector<bool> pattern(Count);
+        Energy energy;
+        unsigned ones = 0;
+        while (ones != Count / 10)
+        {
+            unsigned point = rng() % Count;
+            if (!pattern[point])
+            {
+                pattern[point] = true;
+                energy.update(point, 1);
+                ++ones;
+            }
+        }
+        while (true)
+        {
+            unsigned cluster = energy.extreme(pattern, true);
+            pattern[cluster] = false;
+            energy.update(cluster, -1);
+            unsigned hole = energy.extreme(pattern, false);
+            pattern[hole] = true;
+            energy.update(hole, 1);
+            if (hole == cluster)
+                break;
+        }
+
+        // The points of the initial pattern are ranked by removing the
+        // tightest clusters, the others by filling the largest voids
+        vector<unsigned> rank(Count);
+        vector<bool> removing = pattern;
+        Energy removed = energy;
+        for (unsigned r = ones; r-- != 0; )
+        {
+            unsigned cluster = removed.extreme(removing, true);
+            removing[cluster] = false;
+            removed.update(cluster, -1);
+            rank[cluster] = r;
+        }
+        for (unsigned r = ones; r != Count; ++r)
+        {
+            unsigned hole = energy.extreme(pattern, false);
+            pattern[hole] = true;
+            energy.update(hole, 1);
+            rank[hole] = r;
+        }
+
+        vector<float> mask(Count);
+        for (unsigned point = 0; point != Count; ++point)
+            mask[point] = (rank[point] + 0.5f) / Count;
+        return mask;
+    }
+
+    float wrap(float value)
+    {
+        return value < 1 ? value : value - 1;
+    }
+}
+
+BlueNoiseSampler::BlueNoiseSampler(unsigned samples, uint32_t seed)
+:
+    Sampler(samples, seed),
+    offsetX(hash(seed) % Size),
+    offsetY(hash(seed + 1) % Size)
+{}
+
+vector<float> const &BlueNoiseSampler::mask(unsigned which)
+{
+    static vector<float> const masks[2] = {voidAndCluster(1), voidAndCluster(2)};
+    return masks[which];
+}
+
+void BlueNoiseSampler::position(unsigned x, unsigned y, unsigned index,
+                                float &sx, float &sy) const
+{
+    unsigned texel = (y + offsetY) % Size * Size + (x + offsetX) % Size;
+    uint32_t px, py;
+    SobolSampler::point(index, px, py);
+    sx = wrap(unit(px) + mask(0)[texel]);
+    sy = wrap(unit(py) + mask(1)[texel]);
+}
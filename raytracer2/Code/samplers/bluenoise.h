@@ -0,0 +1,32 @@
+#ifndef BLUENOISE_H_
+#define BLUENOISE_H_
+
+#include "../sampler.h"
+
+#include <vector>
+
+// Sobol points, shifted per pixel by the values of two blue noise masks
+// (Georgiev and Fajardo, "Blue-noise Dithered Sampling", 2016). Pixels near
+// each other get very different shifts, so the error of neighbouring pixels
+// is uncorrelated at low frequencies and looks like fine grain rather than
+// blotches; with few samples per pixel it is the least visible.
+class BlueNoiseSampler: public Sampler
+{
+    public:
+        static unsigned const MaskSize = 64;
+
+        BlueNoiseSampler(unsigned samples, uint32_t seed = 0);
+
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const;
+
+    private:
+        // MaskSize x MaskSize ranks in [0, 1), made by void and cluster
+        // (Ulichney 1993) once, shared by all samplers
+        static std::vector<float> const &mask(unsigned which);
+
+        unsigned const offsetX;         // toroidal offset of the masks,
+        unsigned const offsetY;         // from the seed
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include "halton.h"
+
+namespace
+{
+    // index with its base digits mirrored around the radix point
+    float radicalInverse(unsigned base, unsigned index)
+    {
+        float inverse = 0;
+        float digit = 1.0f / base;
+        for (; index != 0; index /= base, digit /= base)
+            inverse += (index % base) * digit;
+        return inverse;
+    }
+
+    float wrap(float value)
+    {
+        return value < 1 ? value : value - 1;
+    }
+}
+
+HaltonSampler::HaltonSampler(unsigned samples, uint32_t seed)
+:
+    Sampler(samples, seed)
+{}
+
+void HaltonSampler::position(unsigned x, unsigned y, unsigned index,
+                             float &sx, float &sy) const
+{
+    uint32_t stream = pixelSeed(x, y);
+    sx = wrap(radicalInverse(2, index) + unit(hash(stream)));
+    sy = wrap(radicalInverse(3, index) + unit(hash(stream + 1)));
+}
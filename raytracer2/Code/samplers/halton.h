@@ -0,0 +1,17 @@
+#ifndef HALTON_H_
+#define HALTON_H_
+
+#include "../sampler.h"
+
+// The Halton sequence in bases 2 and 3, toroidally shifted by a random
+// offset per pixel (Cranley-Patterson rotation)
+class HaltonSampler: public Sampler
+{
+    public:
+        HaltonSampler(unsigned samples, uint32_t seed = 0);
+
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "regular.h"
+#include "sobol.h"
+
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    // The largest divisor of samples that is at most its square root
+    unsigned gridColumns(unsigned samples)
+    {
+        unsigned columns = std::sqrt(samples);
+        while (columns > 1 && samples % columns != 0)
+            --columns;
+        return columns == 0 ? 1 : columns;
+    }
+}
+
+RegularSampler::RegularSampler(unsigned samples, uint32_t seed)
+:
+    Sampler(samples, seed),
+    columns(gridColumns(samples)),
+    rows(samples / columns)
+{
+    // For power of two grids every Sobol point falls in its own cell; other
+    // grids take the nearest free one
+    bool powerOfTwo = (samples & (samples - 1)) == 0;
+    std::vector<bool> taken(samples);
+    for (unsigned index = 0; index != samples; ++index)
+    {
+        uint32_t px, py;
+        SobolSampler::point(index, px, py);
+        float x = unit(px) * columns;
+        float y = unit(py) * rows;
+        if (powerOfTwo)
+        {
+            cells.push_back(unsigned(x) * rows + unsigned(y));
+            continue;
+        }
+
+        unsigned nearest = 0;
+        float distance = std::numeric_limits<float>::infinity();
+        for (unsigned cell = 0; cell != samples; ++cell)
+        {
+            if (taken[cell])
+                continue;
+            float dx = cell / rows + 0.5f - x;
+            float dy = cell % rows + 0.5f - y;
+            if (dx * dx + dy * dy < distance)
+            {
+                distance = dx * dx + dy * dy;
+                nearest = cell;
+            }
+        }
+        taken[nearest] = true;
+        cells.push_back(nearest);
+    }
+}
+
+void RegularSampler::position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const
+{
+    unsigned cell = cells[index];
+    sx = (cell / rows + 0.5f) / columns;
+    sy = (cell % rows + 0.5f) / rows;
+}
@@ -0,0 +1,27 @@
+#ifndef REGULAR_H_
+#define REGULAR_H_
+
+#include "../sampler.h"
+
+#include <vector>
+
+// The centers of a columns x rows grid, the most square grid of exactly
+// samples cells. The cells are visited in the order of the Sobol points
+// they are nearest to, so that every prefix of the samples (a pass of a
+// progressive render) is spread over the pixel.
+class RegularSampler: public Sampler
+{
+    public:
+        RegularSampler(unsigned samples, uint32_t seed = 0);
+
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const;
+
+        unsigned const columns;
+        unsigned const rows;
+
+    protected:
+        std::vector<unsigned> cells;    // by sample index, column major
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "sobol.h"
+
+namespace
+{
+    uint32_t reverseBits(uint32_t value)
+    {
+        value = (value << 16) | (value >> 16);
+        value = ((value & 0x00ff00ff) << 8) | ((value & 0xff00ff00) >> 8);
+        value = ((value & 0x0f0f0f0f) << 4) | ((value & 0xf0f0f0f0) >> 4);
+        value = ((value & 0x33333333) << 2) | ((value & 0xcccccccc) >> 2);
+        value = ((value & 0x55555555) << 1) | ((value & 0xaaaaaaaa) >> 1);
+        return value;
+    }
+
+    // Owen scrambling of the bits of value, most significant bit first
+    uint32_t scramble(uint32_t value, uint32_t seed)
+    {
+        value = reverseBits(value);
+        value += seed;
+        value ^= value * 0x6c50b47c;
+        value ^= value * 0xb82f1e52;
+        value ^= value * 0xc7afe638;
+        value ^= value * 0x8d22f6e6;
+        return reverseBits(value);
+    }
+}
+
+SobolSampler::SobolSampler(unsigned samples, uint32_t seed)
+:
+    Sampler(samples, seed)
+{}
+
+// Dimension 0 is the van der Corput sequence, dimension 1 has the direction
+// numbers v(k) = v(k-1) ^ v(k-1) >> 1
+void SobolSampler::point(uint32_t index, uint32_t &px, uint32_t &py)
+{
+    px = reverseBits(index);
+    py = 0;
+    for (uint32_t direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+        if (index & 1)
+            py ^= direction;
+}
+
+void SobolSampler::position(unsigned x, unsigned y, unsigned index,
+                            float &sx, float &sy) const
+{
+    uint32_t stream = pixelSeed(x, y);
+    uint32_t px, py;
+    point(scramble(index, hash(stream)), px, py);
+    sx = unit(scramble(px, hash(stream + 1)));
+    sy = unit(scramble(py, hash(stream + 2)));
+}
@@ -0,0 +1,22 @@
+#ifndef SOBOL_H_
+#define SOBOL_H_
+
+#include "../sampler.h"
+
+// The first two dimensions of the Sobol sequence, a (0, 2)-sequence: every
+// power of two prefix is stratified in all elementary intervals. Each pixel
+// gets its own Owen scrambling of the points and of their order (Burley,
+// "Practical Hash-based Owen Scrambling", 2020), which keeps that property.
+class SobolSampler: public Sampler
+{
+    public:
+        SobolSampler(unsigned samples, uint32_t seed = 0);
+
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const;
+
+        // Unscrambled point index of the sequence, as 32 bit fractions
+        static void point(uint32_t index, uint32_t &px, uint32_t &py);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#include "stratified.h"
+
+StratifiedSampler::StratifiedSampler(unsigned samples, uint32_t seed)
+:
+    RegularSampler(samples, seed)
+{}
+
+void StratifiedSampler::position(unsigned x, unsigned y, unsigned index,
+                                 float &sx, float &sy) const
+{
+    unsigned cell = cells[index];
+    uint32_t stream = pixelSeed(x, y) + 2 * index;
+    sx = (cell / rows + unit(hash(stream))) / columns;
+    sy = (cell % rows + unit(hash(stream + 1))) / rows;
+}
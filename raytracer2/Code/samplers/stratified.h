@@ -0,0 +1,16 @@
+#ifndef STRATIFIED_H_
+#define STRATIFIED_H_
+
+#include "regular.h"
+
+// One uniformly random sample in every cell of the RegularSampler grid
+class StratifiedSampler: public RegularSampler
+{
+    public:
+        StratifiedSampler(unsigned samples, uint32_t seed = 0);
+
+        virtual void position(unsigned x, unsigned y, unsigned index,
+                              float &sx, float &sy) const;
+};
+
+#endif
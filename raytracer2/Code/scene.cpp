@@ -1,125 +1,250 @@
 #include "scene.h"
 
+#include "cpu.h"
+#include "fastmath.h"
+#include "hash.h"
 #include "hit.h"
 #include "image.h"
+#include "irradiancecache.h"
 #include "material.h"
+#include "parallel.h"
+#include "pathtracer.h"
+#include "photonmap.h"
+#include "random.h"
 #include "ray.h"
+#include "samplers/regular.h"
+#include "wavefront.h"
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <iostream>
 
 using namespace std;
 
+namespace
+{
+  // Dependencies of the tile the thread renders, if they are recorded
+  thread_local TileDependencies *recording = nullptr;
+}
+
 
-Color Scene::reflectRay(int depth, Hit min_hit, Ray ray, ObjectPtr obj)
+Color Scene::reflectRay(int depth, Hit min_hit, Ray ray, ObjectPtr obj, double throughput,
+                        RayDifferential const &diff)
 {
   Material &material = obj->material;
-  Point hit = ray.at(min_hit.t - 0.0000000001);             //the hit point
+  Point hit = ray.at(min_hit.t - Hit::offset());             //the hit point
   Vector N = min_hit.N;
 
   Vector R = 2 * (N.dot(-ray.D)) * N + ray.D;
   Vector V = -ray.D;
   R.normalize();
-  Ray reflectedRay{hit, R};
+  Ray reflectedRay{hit, R, ray.time};
 
+  // ks * ks bounds the weight of the reflection (the specular term is <= 1)
+  throughput *= material.ks * material.ks;
+  double weight = 1;
+  if (!survives(reflectedRay, throughput, weight))
+    return Color(0, 0, 0);
+  ++counts().reflected;
+
+  // The reflected footprint widens with the curvature of the surface
+  RayDifferential reflectedDiff;
+  if (differentials)
+  {
+    Vector dPdx, dPdy;
+    diff.transfer(ray, min_hit.t, N, dPdx, dPdy);
+    reflectedDiff = diff.reflect(ray, N, dPdx, dPdy,
+                                 obj->normalDifferential(hit, dPdx),
+                                 obj->normalDifferential(hit, dPdy));
+  }
+
+  // The closest hit overall is what gets shaded, the closest hit on another
+  // object acts as the reflected light source; they differ only if the
+  // reflected ray hits obj itself.
   Hit min_reflectedHit(numeric_limits<double>::infinity(), Vector());
-  ObjectPtr refObj = nullptr;
-  for (unsigned idx = 0; idx != objects.size(); ++idx)
+  Hit min_tracedHit(numeric_limits<double>::infinity(), Vector());
+  unsigned refIdx = 0;
+  unsigned tracedIdx = 0;
+  ObjectPtr tracedObj = intersect(reflectedRay, min_tracedHit, tracedIdx);
+  ObjectPtr refObj = tracedObj;
+  if (tracedObj != obj)
   {
-    Hit hit2(objects[idx]->intersect(reflectedRay));
-    if (hit2.t < min_reflectedHit.t && objects[idx] != obj)
-    {
-      min_reflectedHit = hit2;
-      refObj = objects[idx];
-    }
+    min_reflectedHit = min_tracedHit;
+    refIdx = tracedIdx;
+  }
+  else
+    refObj = intersect(reflectedRay, min_reflectedHit, refIdx, obj.get());
+  if (recording)
+  {
+    if (tracedObj)
+      recording->hit(tracedIdx, reflectedRay.at(min_tracedHit.t));
+    else
+      recording->escaped = true;
+    if (refObj)
+      recording->hit(refIdx, reflectedRay.at(min_reflectedHit.t));
   }
   if (refObj != nullptr)
   {
     Point reflectedHit = reflectedRay.at(min_reflectedHit.t);
-    Light reflectedLight(reflectedHit, trace(reflectedRay, depth + 1) * material.ks);
-    Vector L = (reflectedLight.position - hit).normalized();
+    Vector L = (reflectedHit - hit).normalized();
     R = 2 * (N.dot(L)) * N - L;
+    double specular = FastMath::pow(fmax(0 ,V.dot(R)), material.n);
+
+    Color reflectedColor = shadeHit(reflectedRay, min_tracedHit, tracedObj, depth + 1,
+                                    throughput * specular, reflectedDiff, nullptr);
+    Light reflectedLight(reflectedHit, reflectedColor * material.ks);
 
-    return Color(pow(fmax(0 ,V.dot(R)), material.n) * reflectedLight.color * material.ks);
+    return Color(specular * reflectedLight.color * material.ks * weight);
   }
   return Color(0, 0, 0);
 }
 
-Color Scene::trace(Ray const &ray, int depth)
+Color Scene::trace(Ray const &ray, int depth, RayDifferential const &diff)
 {
 	// Find hit object and distance
 	Hit min_hit(numeric_limits<double>::infinity(), Vector());
-	ObjectPtr obj = nullptr;
-	for (unsigned idx = 0; idx != objects.size(); ++idx)
-	{
-		Hit hit(objects[idx]->intersect(ray));
-		if (hit.t < min_hit.t)
-		{
-			min_hit = hit;
-			obj = objects[idx];
-		}
-	}
+	unsigned objIdx = 0;
+	ObjectPtr obj = intersect(ray, min_hit, objIdx);
 	// No hit? Return background color.
 	if (!obj) return Color(0.0, 0.0, 0.0);
+	if (recording)
+		recording->hit(objIdx, ray.at(min_hit.t));
+
+	return shadeHit(ray, min_hit, obj, depth, 1.0, diff, nullptr);
+}
 
+ObjectPtr Scene::intersect(Ray const &ray, Hit &min_hit, unsigned &index,
+                           Object const *skip) const
+{
+	return bvh.intersect(objects, ray, min_hit, index, skip);
+}
+
+Color Scene::shade(Ray const &ray, Hit const &min_hit, ObjectPtr obj, int depth, double throughput,
+                   RayDifferential const &diff, ShadowMask *mask)
+{
+	return shadeHit(ray, min_hit, obj, depth, throughput, diff, mask);
+}
+
+RAY_MULTI_ISA
+Color Scene::shadeHit(Ray const &ray, Hit const &min_hit, ObjectPtr const &obj, int depth,
+                      double throughput, RayDifferential const &diff, ShadowMask *mask)
+{
   Material &material = obj->material;         //the hit objects material
   Point hit;       //the hit point
   Vector V = -ray.D;
   Vector R;
   Vector N = min_hit.N;
-  hit = ray.at(min_hit.t - 0.0000000001);          //the hit point
+  hit = ray.at(min_hit.t - Hit::offset());          //the hit point
 
 
+  // texture color is kept local: the material is shared by all hits
+  Color surface = material.color;
   if (material.isTextured())
   {
-    material.color = obj->textureColorAt(hit, obj->isRotated());
+    if (differentials)
+    {
+      Vector dPdx, dPdy;
+      diff.transfer(ray, min_hit.t, N, dPdx, dPdy);
+      surface = obj->textureColorAt(obj->atRest(hit, ray.time), dPdx, dPdy, obj->isRotated());
+    }
+    else
+      surface = obj->textureColorAt(obj->atRest(hit, ray.time), obj->isRotated());
   }
 
-  Color Ia = material.color * material.ka;
+  if (recording)
+    recording->shaded = true;
+  if (shadows)
+    ++counts().shaded;
+
+  Color Ia = surface * material.ka;
   Color Id(0, 0, 0);
+
+  // Indirect diffuse light; the hemisphere rays of the cache shade their
+  // hits at depth recursionDepth + 1, without it
+  if (irradiance && depth <= recursionDepth && material.kd > 0)
+  {
+    double const InvPi = 1 / 3.14159265358979323846;
+    Id += irradiance->at(hit, N.dot(V) < 0 ? -N : N) * surface * (material.kd * InvPi);
+  }
+
+  // Caustics, and the indirect light where the cache does not gather it
+  if (photons && material.kd > 0)
+  {
+    double const InvPi = 1 / 3.14159265358979323846;
+    Vector facing = N.dot(V) < 0 ? -N : N;
+    Color E = photons->caustics(hit, facing);
+    if (!irradiance || depth > recursionDepth)
+      E += photons->indirect(hit, facing);
+    Id += E * surface * (material.kd * InvPi);
+  }
 	Color Is(0, 0, 0);
 
-	for (auto const light : lights)
+  // The reflection does not depend on the light, so it is traced at most
+  // once and added for every light that reaches the hit point.
+  Color reflection(0, 0, 0);
+  bool reflected = false;
+
+	for (size_t lightIdx = 0; lightIdx != lights.size(); ++lightIdx)
 	{
-		//shadows calculations:
-		if (shadows)
+		LightPtr const &light = lights[lightIdx];
+		if (light->isArea())
 		{
-			Ray lightRay(light->position, -(light->position - hit).normalized());
-
-			Hit min_hit2(numeric_limits<double>::infinity(), Vector());
-			ObjectPtr blockingObj = nullptr;
-			for (unsigned idx = 0; idx != objects.size(); ++idx)
+			// the samples shade like point lights, and the mask does not
+			// keep their shadows
+			double diffuse, specular, visible;
+			sampleAreaLight(lightIdx, hit, N, V, obj, material.n, ray.time, diffuse, specular,
+			                visible);
+			Id += diffuse * surface * light->color * material.kd;
+			Is += specular * light->color * material.ks;
+			if (visible > 0 && depth < recursionDepth && material.ks > 0)
 			{
-				Hit checkHit(objects[idx]->intersect(lightRay));
-				if (checkHit.t < min_hit2.t)
+				if (!reflected)
 				{
-					min_hit2 = checkHit;
-					blockingObj = objects[idx];
+					reflection = reflectRay(depth, min_hit, ray, obj, throughput, diff);
+					reflected = true;
 				}
+				Is += visible * reflection;
 			}
-			if (blockingObj == obj)
+			continue;
+		}
+
+		uint32_t bit = lightIdx < 32 ? uint32_t(1) << lightIdx : 0;
+		//shadows calculations:
+		if (shadows && mask && (mask->known & bit))
+		{
+			if (!(mask->lit & bit))
+				continue;
+		}
+		else if (shadows)
+		{
+			bool lit = reaches(light->position, hit, obj, ray.time);
+			if (mask)
 			{
-				R = 2 * (N).dot((light->position - hit).normalized()) * N - (light->position - hit).normalized();
-				Id += fmax(0, ((light->position - hit).normalized()).dot(N.normalized())) * material.color * light->color * material.kd;
-				Is += pow(fmax(0, R.dot(V)), material.n) * light->color * material.ks;
-
-        if (depth < recursionDepth)
-        {
-            Is += reflectRay(depth, min_hit, ray, obj);
-        }
+				mask->known |= bit;
+				if (lit)
+					mask->lit |= bit;
 			}
+			if (!lit)
+				continue;
 		}
-		else
-		{
-      R = 2 * (N).dot((light->position - hit).normalized()) * N - (light->position - hit).normalized();
-			Id += fmax(0, ((light->position - hit).normalized()).dot(N.normalized())) * material.color * light->color * material.kd;
-			Is += pow(fmax(0, R.dot(V)), material.n) * light->color * material.ks;
-      if (depth < recursionDepth)
+
+    R = 2 * (N).dot((light->position - hit).normalized()) * N - (light->position - hit).normalized();
+		Id += fmax(0, ((light->position - hit).normalized()).dot(N.normalized())) * surface * light->color * material.kd;
+		Is += FastMath::pow(fmax(0, R.dot(V)), material.n) * light->color * material.ks;
+
+    // without a specular component there is nothing to reflect
+    if (depth < recursionDepth && material.ks > 0)
+    {
+      if (!reflected)
       {
-          Is += reflectRay(depth, min_hit, ray, obj);
+        reflection = reflectRay(depth, min_hit, ray, obj, throughput, diff);
+        reflected = true;
       }
-		}
+      Is += reflection;
+    }
 	}
 
 	Color color = Ia + Id + Is;
@@ -127,26 +252,319 @@ Color Scene::trace(Ray const &ray, int depth)
 	return color;
 }
 
-void Scene::render(Image &img)
+bool Scene::reaches(Point const &from, Point const &hit, ObjectPtr const &obj, Real time)
+{
+	Ray lightRay(from, -(from - hit).normalized(), time);
+	++counts().shadow;
+
+	Hit min_hit(numeric_limits<double>::infinity(), Vector());
+	unsigned blockingIdx = 0;
+	ObjectPtr blockingObj = intersect(lightRay, min_hit, blockingIdx);
+	if (recording)
+	{
+		recording->extend(from);
+		if (blockingObj)
+			recording->hit(blockingIdx, lightRay.at(min_hit.t));
+	}
+	return blockingObj == obj;
+}
+
+// The samples are jittered in the strata of the light's grid, from a hash
+// of the point, so a point is shaded alike in every render. The probes are
+// spread evenly over the grid; if their shadow rays agree, the other
+// samples are taken to agree with them.
+void Scene::sampleAreaLight(size_t lightIdx, Point const &hit, Vector const &N, Vector const &V,
+                            ObjectPtr const &obj, double n, Real time, double &diffuse,
+                            double &specular, double &visible)
+{
+	Light const &light = *lights[lightIdx];
+	unsigned const grid = light.grid;
+	size_t const count = size_t(grid) * grid;
+	thread_local vector<Point> points;
+	thread_local vector<char> lit;              // 0, 1, or 2: not traced yet
+	points.resize(count);
+	lit.assign(count, shadows ? 2 : 1);
+
+	Random jitter(Hasher().add(hit).add(lightIdx).value());
+	for (size_t idx = 0; idx != count; ++idx)
+	{
+		double u = (idx % grid + jitter.next()) / grid;
+		double v = (idx / grid + jitter.next()) / grid;
+		points[idx] = light.sample(hit, u, v);
+	}
+
+	if (shadows)
+	{
+		++counts().areaLit;
+		unsigned probes = light.probes;
+		if (probes != 0 && probes < grid)
+		{
+			unsigned reached = 0;
+			for (unsigned py = 0; py != probes; ++py)
+			{
+				for (unsigned px = 0; px != probes; ++px)
+				{
+					size_t idx = size_t((2 * py + 1) * grid / (2 * probes)) * grid
+					           + (2 * px + 1) * grid / (2 * probes);
+					lit[idx] = reaches(points[idx], hit, obj, time);
+					reached += lit[idx];
+				}
+			}
+			if (reached == 0 || reached == probes * probes)
+				replace(lit.begin(), lit.end(), char(2), char(reached != 0));
+			else
+				++counts().penumbra;
+		}
+		for (size_t idx = 0; idx != count; ++idx)
+			if (lit[idx] == 2)
+				lit[idx] = reaches(points[idx], hit, obj, time);
+	}
+
+	diffuse = specular = 0;
+	unsigned reached = 0;
+	for (size_t idx = 0; idx != count; ++idx)
+	{
+		if (!lit[idx])
+			continue;
+		Vector L = (points[idx] - hit).normalized();
+		Vector R = 2 * N.dot(L) * N - L;
+		diffuse += fmax(0, L.dot(N.normalized()));
+		specular += FastMath::pow(fmax(0, R.dot(V)), n);
+		++reached;
+	}
+	diffuse /= count;
+	specular /= count;
+	visible = double(reached) / count;
+}
+
+bool Scene::hasAreaLights() const
+{
+	for (LightPtr const &light : lights)
+		if (light->isArea())
+			return true;
+	return false;
+}
+
+RayStats &Scene::counts()
+{
+	static thread_local RayStats counts;
+	return counts;
+}
+
+void Scene::addCounts()
+{
+	RayStats &mine = counts();
+	lock_guard<mutex> lock(statsMutex);
+	stats += mine;
+	mine = RayStats();
+}
+
+void Scene::render(AccumImage &img)
+{
+  render(img, 0, sampler->samples);
+}
+
+void Scene::renderTile(AccumImage &img, Tile const &tile)
+{
+  renderTile(img, tile, 0, sampler->samples, Clock::time_point::max());
+  addCounts();
+}
+
+bool Scene::render(AccumImage &img, unsigned first, unsigned last,
+                   Clock::time_point deadline)
+{
+  return renderTiles(img, tiles(), first, last, deadline);
+}
+
+bool Scene::renderTiles(AccumImage &img, vector<Tile> const &tiles, unsigned first,
+                        unsigned last, Clock::time_point deadline,
+                        function<void(size_t)> const &done)
+{
+  if (wavefront && integrator == Integrator::Whitted && !hasAreaLights())
+  {
+    // one tile at a time, every stage runs on all cores
+    Wavefront renderer(*this);
+    for (size_t idx = 0; idx != tiles.size(); ++idx)
+    {
+      if (Clock::now() >= deadline)
+        return false;
+      renderer.render(img, tiles[idx], first, last);
+      addCounts();
+      if (done)
+        done(idx);
+    }
+    return true;
+  }
+
+  if (dependencies)
+    dependencies->assign(tiles.size(), TileDependencies());
+
+  // tiles cover disjoint pixels, so they can be traced concurrently
+  atomic<bool> complete{true};
+  parallelFor(tiles.size(), [&](size_t begin, size_t end)
+  {
+    for (size_t idx = begin; idx != end; ++idx)
+    {
+      if (dependencies)
+      {
+        recording = &(*dependencies)[idx];
+        recording->objects.assign(objects.size(), 0);
+      }
+      bool rendered = renderTile(img, tiles[idx], first, last, deadline);
+      recording = nullptr;
+      addCounts();
+      if (!rendered)
+        complete = false;
+      else if (done)
+        done(idx);
+    }
+  }, 1);
+  return complete;
+}
+
+// The deadline is checked for every row, so a render stops soon after it
+bool Scene::renderTile(AccumImage &img, Tile const &tile, unsigned first,
+                       unsigned last, Clock::time_point deadline)
 {
-	unsigned w = img.width();
-	unsigned h = img.height();
+  Tile const &crop = camera.crop();
+  Vector dx, dy;
+  sampleSpacing(dx, dy);
+  PathTracer path(*this);
   Color col{};
-  for (float i = 0.5 / samplingFactor; i < h; i += 1.0 / samplingFactor)
+  for (unsigned y = tile.y0; y != tile.y1; ++y)
   {
-    for (float j = 0.5 / samplingFactor; j < w; j += 1.0 / samplingFactor)
+    if (Clock::now() >= deadline)
+      return false;
+    for (unsigned x = tile.x0; x != tile.x1; ++x)
     {
-      Point pixel(i + 0.5, (h - 1 - j) + 0.5, 0);
-      Ray ray(eye, (pixel - eye).normalized());
-      col = trace(ray, 0);
-      col.clamp();
-      img((int)i, (int)j) += col / (samplingFactor * samplingFactor);
+      for (unsigned idx = first; idx != last; ++idx)
+      {
+        Vector toPixel;
+        Ray ray = primaryRay(x, y, idx, toPixel);
+        ++counts().primary;
+        if (integrator == Integrator::Path)
+          col = path.radiance(ray, x, y, idx);
+        else
+          col = trace(ray, 0, differentials ? RayDifferential::primary(toPixel, dx, dy)
+                                            : RayDifferential());
+        col.clamp();
+        img(x - crop.x0, y - crop.y0).add(col);
+      }
     }
   }
+  return true;
+}
+
+// Split the crop window in tiles of TileSize x TileSize pixels
+vector<Tile> Scene::makeTiles(Tile const &crop) const
+{
+  unsigned const TileSize = 64;
+
+  vector<Tile> tiles;
+  for (unsigned y = crop.y0; y < crop.y1; y += TileSize)
+    for (unsigned x = crop.x0; x < crop.x1; x += TileSize)
+      tiles.push_back(Tile{x, y, min(x + TileSize, crop.x1), min(y + TileSize, crop.y1)});
+  return tiles;
+}
+
+// The point on the image plane that sample index of film pixel (x, y) is
+// traced through
+Point Scene::samplePoint(unsigned x, unsigned y, unsigned index) const
+{
+  float sx, sy;
+  sampler->position(x, y, index, sx, sy);
+  return camera.filmPoint(x + Real(sx), y + Real(sy));
+}
+
+// Without motion, every ray is of time 0
+Ray Scene::primaryRay(unsigned x, unsigned y, unsigned index, Vector &toPixel) const
+{
+  if (!motion)
+  {
+    Point const &eye = camera.eye();
+    toPixel = samplePoint(x, y, index) - eye;
+    return Ray(eye, toPixel.normalized());
+  }
+
+  float sx, sy;
+  sampler->position(x, y, index, sx, sy);
+  Real time = sampler->time(x, y, index);
+  Point eye = camera.eye(time);
+  toPixel = camera.filmPoint(x + Real(sx), y + Real(sy), time) - eye;
+  return Ray(eye, toPixel.normalized(), time);
+}
+
+// Distance between neighbouring samples on the image plane, for the ray
+// differentials: the samples of a pixel cover it evenly
+void Scene::sampleSpacing(Vector &dx, Vector &dy) const
+{
+  Real spacing = 1 / sqrt(Real(sampler->samples));
+  dx = spacing * camera.right();
+  dy = -spacing * camera.up();
+}
+
+// A ray of the given path throughput is only worth casting if its
+// throughput is at least the epsilon. Below it the ray is dropped or, with
+// Russian roulette, kept with probability throughput / epsilon; a kept ray
+// is weighted by the inverse probability (returned in weight) so the
+// estimate stays unbiased, and its throughput grows accordingly.
+bool Scene::survives(Ray const &ray, double &throughput, double &weight) const
+{
+  weight = 1;
+  if (throughput >= throughputEpsilon)
+    return true;
+  if (!russianRoulette)
+    return false;
+
+  double probability = throughput / throughputEpsilon;
+  if (rouletteSample(ray) >= probability)
+    return false;
+
+  weight = 1 / probability;
+  throughput *= weight;
+  return true;
+}
+
+// Uniform number in [0, 1) derived from the bits of the ray, so a decision
+// does not depend on the thread or the order in which rays are traced
+double Scene::rouletteSample(Ray const &ray)
+{
+  uint64_t hash = 0;
+  for (double component : {ray.O.x, ray.O.y, ray.O.z, ray.D.x, ray.D.y, ray.D.z})
+  {
+    uint64_t bits;
+    memcpy(&bits, &component, sizeof bits);
+    hash ^= bits + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  }
+
+  // splitmix64 finalizer
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return (hash >> 11) * (1.0 / (1ULL << 53));
 }
 
 // --- Misc functions ----------------------------------------------------------
 
+void Scene::prepare()
+{
+	if (!sampler)
+		sampler = make_shared<RegularSampler>(1);
+
+	differentials = false;
+	motion = camera.moves();
+	for (ObjectPtr const &obj : objects)
+	{
+		obj->prepare();
+		if (obj->isMoving())
+			motion = true;
+		Material &material = obj->material;
+		if (material.isTextured() && material.texture->filter() == Texture::Filter::Trilinear)
+			differentials = true;
+	}
+	bvh.build(objects);
+}
+
 void Scene::addObject(ObjectPtr obj)
 {
 	objects.push_back(obj);
@@ -157,11 +575,6 @@ void Scene::addLight(Light const &light)
 	lights.push_back(LightPtr(new Light(light)));
 }
 
-void Scene::setEye(Triple const &position)
-{
-	eye = position;
-}
-
 unsigned Scene::getNumObject()
 {
 	return objects.size();
@@ -1,44 +1,242 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "bvh.h"
+#include "camera.h"
+#include "differential.h"
+#include "image.h"
 #include "light.h"
 #include "object.h"
+#include "ray.h"
+#include "sampler.h"
 #include "triple.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-// Forward declerations
-class Ray;
-class Image;
+class IrradianceCache;
+class PhotonMap;
+
+// Number of rays cast while rendering, per kind. Each thread counts into
+// its own (Scene::counts) and adds them to the scene's totals when it
+// finishes a tile or a chunk of work (Scene::addCounts), so the tracing
+// loops do not share a counter.
+struct RayStats
+{
+	unsigned long long primary = 0;
+	unsigned long long shadow = 0;
+	unsigned long long reflected = 0;
+	unsigned long long indirect = 0;     // of the irradiance cache
+	unsigned long long photon = 0;       // of the photon maps
+
+	// shading points (hits lit with shadows), not rays; of those lit by
+	// area lights, per light, and the ones the probes put in a penumbra
+	unsigned long long shaded = 0;
+	unsigned long long areaLit = 0;
+	unsigned long long penumbra = 0;
+
+	unsigned long long total() const { return primary + shadow + reflected + indirect + photon; };
+
+	RayStats &operator+=(RayStats const &other)
+	{
+		primary += other.primary;
+		shadow += other.shadow;
+		reflected += other.reflected;
+		indirect += other.indirect;
+		photon += other.photon;
+		shaded += other.shaded;
+		areaLit += other.areaLit;
+		penumbra += other.penumbra;
+		return *this;
+	}
+};
+
+// What the rays of a tile depended on, recorded for the TileCache: the
+// objects they hit (closest hits of all rays), whether the lights were
+// evaluated, and the bounds of the secondary rays
+struct TileDependencies
+{
+	std::vector<char> objects;      // per object: hit by a ray of the tile
+	bool shaded = false;            // a hit was lit
+	bool escaped = false;           // a reflected ray hit nothing
+	Point lower{std::numeric_limits<Real>::infinity(), std::numeric_limits<Real>::infinity(),
+	            std::numeric_limits<Real>::infinity()};
+	Point upper{-std::numeric_limits<Real>::infinity(), -std::numeric_limits<Real>::infinity(),
+	            -std::numeric_limits<Real>::infinity()};
+
+	// Extends the bounds, which hold all hit points and the lights that
+	// cast shadow rays, so every secondary ray segment lies inside them
+	void extend(Point const &point)
+	{
+		for (int axis = 0; axis != 3; ++axis)
+		{
+			lower.data[axis] = std::min(lower.data[axis], point.data[axis]);
+			upper.data[axis] = std::max(upper.data[axis], point.data[axis]);
+		}
+	}
+
+	void hit(unsigned object, Point const &point)
+	{
+		objects[object] = 1;
+		extend(point);
+	}
+};
+
+// Results of the shadow rays of a primary hit, for the first 32 lights: a
+// known light is lit or not without casting its ray, an unknown one is
+// traced and becomes known
+struct ShadowMask
+{
+	uint32_t known = 0;
+	uint32_t lit = 0;
+};
 
 class Scene
 {
+	friend class Wavefront;
+	friend class TileCache;
+	friend class GBuffer;
+	friend class IrradianceCache;
+	friend class PathTracer;
+	friend class PhotonMap;
+
+public:
+	// Whitted: Phong shading with shadows and mirror reflections; Path:
+	// path tracing with next-event estimation (see PathTracer)
+	enum class Integrator
+	{
+		Whitted,
+		Path
+	};
+
+private:
+
 	std::vector<ObjectPtr> objects;
+	Bvh bvh;                        // of the objects, built by prepare()
 	std::vector<LightPtr> lights; // no ptr needed, but kept for consistency
-	Point eye;
+	Camera camera;
 	bool shadows = false;
-	int samplingFactor = 1;
+	SamplerPtr sampler;             // regular, 1 sample per pixel if not set
 	int recursionDepth = 0;
+	bool wavefront = false;         // Whitted only
+	Integrator integrator = Integrator::Whitted;
+	unsigned maxPathLength = 8;     // hits of a path
+	size_t sortBatchSize = 0;       // of the wavefront renderer (RaySorter)
+	double throughputEpsilon = 0;   // reflections below this are not traced
+	bool russianRoulette = false;
+	bool differentials = false;     // set by prepare(): a texture needs a LOD
+	bool motion = false;            // set by prepare(): an object or the camera moves
+	RayStats stats;                 // totals of the threads' counts
+	std::mutex statsMutex;          // guards stats
+	// diffuse interreflection, if set (not by the wavefront renderer)
+	std::shared_ptr<IrradianceCache> irradiance;
+	// caustics and indirect light, if set (not by the wavefront renderer)
+	std::shared_ptr<PhotonMap> photons;
+	// per tile of renderTiles, recorded if set (not by the wavefront renderer)
+	std::vector<TileDependencies> *dependencies = nullptr;
 
 public:
 
 	// trace a ray into the scene and return the color
-	Color trace(Ray const &ray, int depth);
-	Color reflectRay(int depth, Hit min_hit, Ray ray, ObjectPtr obj);
+	Color trace(Ray const &ray, int depth, RayDifferential const &diff);
+	// shade a known hit of the ray on obj, throughput is the weight of the
+	// path up to the ray and diff its differentials; shadow rays use and
+	// fill the mask, if given
+	Color shade(Ray const &ray, Hit const &min_hit, ObjectPtr obj, int depth,
+	            double throughput, RayDifferential const &diff,
+	            ShadowMask *mask = nullptr);
+	Color reflectRay(int depth, Hit min_hit, Ray ray, ObjectPtr obj,
+	                 double throughput, RayDifferential const &diff);
+
+	typedef std::chrono::steady_clock Clock;
+
+	// render the crop window of the camera to the given image, which has
+	// its size; tiles are in film pixels
+	void render(AccumImage &img);
+	void renderTile(AccumImage &img, Tile const &tile);
 
-	// render the scene to the given image
-	void render(Image &img);
+	// render samples [first, last) of every pixel; work that would start
+	// after the deadline is skipped, and then false is returned
+	bool render(AccumImage &img, unsigned first, unsigned last,
+	            Clock::time_point deadline = Clock::time_point::max());
+	bool renderTile(AccumImage &img, Tile const &tile, unsigned first,
+	                unsigned last, Clock::time_point deadline);
 
+	// the tiles render() splits the crop window in
+	std::vector<Tile> tiles() const { return makeTiles(camera.crop()); };
+	// render samples [first, last) of the given tiles; done(index) is called
+	// by the thread that finished tiles[index]
+	bool renderTiles(AccumImage &img, std::vector<Tile> const &tiles,
+	                 unsigned first, unsigned last, Clock::time_point deadline,
+	                 std::function<void(size_t)> const &done = nullptr);
+
+
+	// prepare all objects for rendering, after the scene is complete
+	void prepare();
 
 	void addObject(ObjectPtr obj);
 	void addLight(Light const &light);
-	void setEye(Triple const &position);
+	void setCamera(Camera const &set) { camera = set; };
 	void setShadows(bool set) { shadows = set; };
-	void setSamplingFactor(int set) { samplingFactor = set; };
+	void setSampler(SamplerPtr const &set) { sampler = set; };
 	void setRecursionDepth(int set) { recursionDepth = set; };
+	void setWavefront(bool set) { wavefront = set; };
+	void setIntegrator(Integrator set) { integrator = set; };
+	void setMaxPathLength(unsigned set) { maxPathLength = set; };
+	void setSortBatchSize(size_t set) { sortBatchSize = set; };
+	void setThroughputEpsilon(double set) { throughputEpsilon = set; };
+	void setRussianRoulette(bool set) { russianRoulette = set; };
+	void setDependencies(std::vector<TileDependencies> *set) { dependencies = set; };
+	void setIrradianceCache(std::shared_ptr<IrradianceCache> const &set) { irradiance = set; };
+	void setPhotonMap(std::shared_ptr<PhotonMap> const &set) { photons = set; };
 
 	unsigned getNumObject();
 	unsigned getNumLights();
+	RayStats const &getStats() const { return stats; };
+
+	// the rays the calling thread cast since it last added them to the
+	// totals of a scene
+	static RayStats &counts();
+	// adds the counts of the calling thread to the totals and clears them
+	void addCounts();
+
+	Camera const &getCamera() const { return camera; };
+	bool getWavefront() const { return wavefront; };
+	bool hasAreaLights() const;
+	Integrator getIntegrator() const { return integrator; };
+	unsigned getSamplesPerPixel() const { return sampler->samples; };
+
+private:
+	// the closest object the ray hits (other than skip) and its index,
+	// nullptr if none
+	ObjectPtr intersect(Ray const &ray, Hit &min_hit, unsigned &index,
+	                    Object const *skip = nullptr) const;
+	// shade, built per ISA (cpu.h): other translation units call shade
+	Color shadeHit(Ray const &ray, Hit const &min_hit, ObjectPtr const &obj, int depth,
+	               double throughput, RayDifferential const &diff, ShadowMask *mask);
+	// whether the first object on the way from the light's point to hit
+	// is obj, which the shadow ray (of the given time) then reaches
+	bool reaches(Point const &from, Point const &hit, ObjectPtr const &obj, Real time);
+	// the mean diffuse and specular factors of the samples of an area
+	// light reaching hit, and the fraction of them that reach it
+	void sampleAreaLight(size_t lightIdx, Point const &hit, Vector const &N, Vector const &V,
+	                     ObjectPtr const &obj, double n, Real time, double &diffuse,
+	                     double &specular, double &visible);
+	std::vector<Tile> makeTiles(Tile const &crop) const;
+	Point samplePoint(unsigned x, unsigned y, unsigned index) const;
+	// the camera ray of sample index of film pixel (x, y), at the sample's
+	// time; toPixel is the vector from the eye to the image plane
+	Ray primaryRay(unsigned x, unsigned y, unsigned index, Vector &toPixel) const;
+	void sampleSpacing(Vector &dx, Vector &dy) const;
+
+	bool survives(Ray const &ray, double &throughput, double &weight) const;
+	static double rouletteSample(Ray const &ray);
 };
 
 #endif
@@ -1,65 +1,66 @@
 #include "cylinder.h"
-#include "plane.h"
+#include "../cpu.h"
 
 #include <cmath>
 
+void Cylinder::prepare()
+{
+    radius2 = radius * radius;
+    bottomY = center.y;
+    topY = center.y + height;
+}
+
 Hit Cylinder::intersect(Ray const &ray)
+{
+    return intersection(ray);
+}
+
+RAY_MULTI_ISA
+Hit Cylinder::intersection(Ray const &ray)
 {
   	Point rayT(ray.O.x-center.x, ray.O.y-center.y, ray.O.z-center.z);
 
     //check if we intersect the core
-	  double EPSILON = 0.0000001;
-    double a = pow(ray.D.x, 2) + pow(ray.D.z, 2);
-    double b = rayT.x * ray.D.x + ray.D.z * rayT.z;
-    double c = pow(rayT.x, 2) + pow(rayT.z, 2) - pow(radius, 2);
+	  Real EPSILON = 0.0000001;
+    Real a = ray.D.x * ray.D.x + ray.D.z * ray.D.z;
+    Real b = rayT.x * ray.D.x + ray.D.z * rayT.z;
+    Real c = rayT.x * rayT.x + rayT.z * rayT.z - radius2;
 
     if ((b * b - a * c) < EPSILON)
 		return Hit::NO_HIT();
 
-    double t0 = (-b + sqrt(b * b  - a * c)) / a;
-    double t1 = (-b - sqrt(b * b  - a * c)) / a;
+    Real t0 = (-b + sqrt(b * b  - a * c)) / a;
+    Real t1 = (-b - sqrt(b * b  - a * c)) / a;
 
-    double t = fmin(t0, t1);
+    Real t = fmin(t0, t1);
 
     if (t <= EPSILON)
 		return Hit::NO_HIT();
 
-    double y = rayT.y + t * ray.D.y;
+    Real y = rayT.y + t * ray.D.y;
 
     Point intersectionPoint = t * ray.D + ray.O;
     Vector N = (intersectionPoint - Point(center.x, intersectionPoint.y, center.z)).normalized();
 
 
   	// check if we intersect one of the bases
-    if (y < -EPSILON)
+    if (y < -EPSILON || y > height + EPSILON)
     {
-		Plane base(center, Vector(0, 1, 0));
-		Hit intersect = base.intersect(ray);
-		if (intersect.t < EPSILON)
+		if (ray.D.y == 0)   // parallel to the caps
 			return Hit::NO_HIT();
 
-		t = intersect.t;
-		intersectionPoint = intersect.t * ray.D + ray.O;
-
-		if (sqrt(pow(intersectionPoint.x - center.x, 2) + pow(intersectionPoint.z - center.z, 2)) > radius)
-			return Hit::NO_HIT();
-		else
-			N = Point(0, -1, 0);
-    }
-    if (y > height + EPSILON)
-    {
-		Plane base(Point(center.x, center.y + height, center.z), Vector(0, -1, 0));
-		Hit intersect = base.intersect(ray);
-		if (intersect.t < EPSILON)
+		bool bottom = y < -EPSILON;
+		t = ((bottom ? bottomY : topY) - ray.O.y) / ray.D.y;
+		if (t < EPSILON)
 			return Hit::NO_HIT();
 
-		t = intersect.t;
-		intersectionPoint = intersect.t * ray.D + ray.O;
-
-		if (sqrt(pow(intersectionPoint.x - center.x, 2) + pow(intersectionPoint.z - center.z, 2)) > radius)
+		intersectionPoint = t * ray.D + ray.O;
+		Real dx = intersectionPoint.x - center.x;
+		Real dz = intersectionPoint.z - center.z;
+		if (dx * dx + dz * dz > radius2)
 			return Hit::NO_HIT();
-		else
-			N = Point(0, 1, 0);
+
+		N = Point(0, bottom ? -1 : 1, 0);
     }
 
     return Hit(t, N);
@@ -68,3 +69,16 @@ Hit Cylinder::intersect(Ray const &ray)
 Cylinder::Cylinder(Point const &p, double r, double h)
 : center(p), radius(r), height(h)
 {}
+
+void Cylinder::hashGeometry(Hasher &hash) const
+{
+    hash.add(center).add(radius).add(height);
+}
+
+// The cylinder stands on center, along y
+bool Cylinder::bounds(Point &middle, Real &extent) const
+{
+    middle = center + Vector(0, height / 2, 0);
+    extent = std::sqrt(radius * radius + height * height / 4);
+    return true;
+}
@@ -8,14 +8,25 @@ class Cylinder: public Object
     public:
         Cylinder(Point const &p, double r, double h);
 
+        virtual void prepare();
         virtual Hit intersect(Ray const &ray);
         virtual Color textureColorAt(Point N, bool rotate){ return Color(); };
         virtual bool isRotated() { return false; };
         virtual Vector rotate(Point point) { return Vector(); };
+        virtual void hashGeometry(Hasher &hash) const;
+        virtual bool bounds(Point &center, Real &radius) const;
 
         Point const center;
         double const radius;
         double const height;
+
+    private:
+        Hit intersection(Ray const &ray);   // intersect, built per ISA (cpu.h)
+
+        // set by prepare()
+        Real radius2;       // radius squared
+        Real bottomY;       // the caps are the planes y = bottomY, y = topY
+        Real topY;
 };
 
 #endif
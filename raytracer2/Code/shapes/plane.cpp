@@ -1,17 +1,33 @@
 #include "plane.h"
+#include "../cpu.h"
 
 #include <cmath>
 
+void Plane::prepare()
+{
+    offset = point.dot(normal);
+}
+
 Hit Plane::intersect(Ray const &ray)
 {
-    double denom = (point - ray.O).dot(normal);
-    double nom = ray.D.dot(normal);
+    return intersection(ray);
+}
+
+RAY_MULTI_ISA
+Hit Plane::intersection(Ray const &ray)
+{
+    Real denom = offset - ray.O.dot(normal);
+    Real nom = ray.D.dot(normal);
 
     if (nom == 0) //no intersect or line is on the plane - infinite intersect
 		return Hit::NO_HIT();
 
-    double t = denom / nom;
-    Vector N = (normal + t * ray.D + ray.O).normalized();
+    Real t = denom / nom;
+    if (t < 0)  // behind the origin of the ray
+        return Hit::NO_HIT();
+
+    // the side facing the ray
+    Vector N = (nom > 0 ? -normal : normal).normalized();
 
     return Hit(t, N);
 }
@@ -19,3 +35,8 @@ Hit Plane::intersect(Ray const &ray)
 Plane::Plane(Point const &p, Vector const &n)
 : point(p), normal(n)
 {}
+
+void Plane::hashGeometry(Hasher &hash) const
+{
+    hash.add(point).add(normal);
+}
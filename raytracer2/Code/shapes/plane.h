@@ -8,13 +8,20 @@ class Plane: public Object
     public:
         Plane(Point const &p, Vector const &n);
 
+        virtual void prepare();
         virtual Hit intersect(Ray const &ray);
         virtual Color textureColorAt(Point N, bool rotate){ return Color(); };
         virtual bool isRotated() { return false; };
         virtual Vector rotate(Point point) { return Vector(); };
+        virtual void hashGeometry(Hasher &hash) const;     // unbounded
 
         Point const point;
         Vector const normal;
+
+    private:
+        Hit intersection(Ray const &ray);   // intersect, built per ISA (cpu.h)
+
+        Real offset;        // point.dot(normal), set by prepare()
 };
 
 #endif
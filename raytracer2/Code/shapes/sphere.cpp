@@ -1,54 +1,123 @@
 #include "sphere.h"
-#include "solvers.h"
+#include "../cpu.h"
+#include "../fastmath.h"
 
 #include <cmath>
 #include <iostream>
+#include <utility>
 
 using namespace std;
 
-Color Sphere::textureColorAt(Point point, bool shouldRotate)
+namespace
+{
+  double const PI = 3.14159265358979323846;
+}
+
+void Sphere::prepare()
+{
+  invR = 1 / r;
+
+  // Rodrigues' rotation formula as a matrix:
+  // cos * I + sin * [k]x + (1 - cos) * k k^T
+  Vector k = rotation.length_2() > 0 ? rotation.normalized() : Vector(0, 0, 1);
+  double radAngle = angle * (PI / 180);
+  double c = cos(radAngle);
+  double s = sin(radAngle);
+  double cross[3][3] = {{0, -k.z, k.y}, {k.z, 0, -k.x}, {-k.y, k.x, 0}};
+  for (int row = 0; row != 3; ++row)
+    for (int col = 0; col != 3; ++col)
+      rotationMatrix[row][col] = (row == col ? c : 0) + s * cross[row][col]
+                               + (1 - c) * k.data[row] * k.data[col];
+}
+
+void Sphere::textureCoordinates(Point point, bool shouldRotate, float &u, float &v)
 {
   Vector N = (point - position).normalized();
 
   if (shouldRotate)
     N = rotate(N);
 
-  double PI = acos(-1);
+  u = FastMath::atan2(-N.y, -N.x) * (0.5 / PI) + 0.5;
+  v = 0.5 - FastMath::asin(N.z) * (1 / PI);
+}
 
-  double u = atan2(-N.y, -N.x) / (2 * PI) + 0.5;
-  double v = 0.5 - asin(N.z) / PI;
+Color Sphere::textureColorAt(Point point, bool shouldRotate)
+{
+  float u;
+  float v;
+  textureCoordinates(point, shouldRotate, u, v);
 
-  Color color = material.texture.colorAt(u, v);
+  Color color = material.texture->colorAt(u, v);
 
   return color;
 }
 
-Vector Sphere::rotate(Vector normal)
+Color Sphere::textureColorAt(Point point, Vector const &dPdx, Vector const &dPdy,
+                             bool shouldRotate)
+{
+  Texture const &texture = *material.texture;
+  if (texture.filter() != Texture::Filter::Trilinear)
+    return textureColorAt(point, shouldRotate);
+
+  // The texture coordinate differentials are taken as finite differences
+  // over the footprint; u wraps around at the seam
+  float u, v, ux, vx, uy, vy;
+  textureCoordinates(point, shouldRotate, u, v);
+  textureCoordinates(point + dPdx, shouldRotate, ux, vx);
+  textureCoordinates(point + dPdy, shouldRotate, uy, vy);
+  float dudx = ux - u - round(ux - u);
+  float dudy = uy - u - round(uy - u);
+
+  return texture.colorAt(u, v, texture.lod(dudx, vx - v, dudy, vy - v));
+}
+
+Vector Sphere::normalDifferential(Point const &point, Vector const &dP)
 {
-  double radAngle = angle * (acos(-1) / 180);
+  return dP * invR;
+}
 
-  Vector rotatedNormal = normal * cos(radAngle) + ((rotation.normalized()).cross(normal)) * sin(radAngle) +
-          rotation.normalized() * (rotation.normalized()).dot(normal) * (1 - cos(radAngle));
+Vector Sphere::rotate(Vector normal)
+{
+  Real const (&m)[3][3] = rotationMatrix;
+  Vector rotatedNormal(m[0][0] * normal.x + m[0][1] * normal.y + m[0][2] * normal.z,
+                       m[1][0] * normal.x + m[1][1] * normal.y + m[1][2] * normal.z,
+                       m[2][0] * normal.x + m[2][1] * normal.y + m[2][2] * normal.z);
 
   return rotatedNormal.normalized();
 }
 
 
 Hit Sphere::intersect(Ray const &ray)
+{
+    return intersection(ray);
+}
+
+RAY_MULTI_ISA
+Hit Sphere::intersection(Ray const &ray)
 {
     // Sphere formula: ||x - position||^2 = r^2
     // Line formula:   x = ray.O + t * ray.D
 
+    // Solved as a t^2 + 2 fd t + c = 0. The discriminant fd^2 - a c is
+    // computed as a (r^2 - |perp|^2), with perp the part of L orthogonal to
+    // the ray, which avoids the cancellation of fd^2 - a c far from the
+    // sphere (needed when Real is float).
     Vector L = ray.O - position;
-    double a = ray.D.dot(ray.D);
-    double b = 2 * ray.D.dot(L);
-    double c = L.dot(L) - r * r;
-
-    double t0;
-    double t1;
-    if (!Solvers::quadratic(a, b, c, t0, t1))
+    Real a = ray.D.dot(ray.D);
+    Real fd = ray.D.dot(L);
+    Real c = L.dot(L) - r * r;
+    Vector perp = L - (fd / a) * ray.D;
+    Real discr = a * (r * r - perp.length_2());
+    if (discr < 0)
         return Hit::NO_HIT();
 
+    // q has the sign of -fd, so q / a and c / q do not cancel either
+    Real q = fd > 0 ? -(fd + sqrt(discr)) : -(fd - sqrt(discr));
+    Real t0 = q / a;
+    Real t1 = c / q;
+    if (t0 > t1)
+        swap(t0, t1);
+
     // t0 is closest hit
     if (t0 < 0)  // check if it is not behind the camera
     {
@@ -59,7 +128,7 @@ Hit Sphere::intersect(Ray const &ray)
 
     // calculate normal
     Point hit = ray.at(t0);
-    Vector N = (hit - position).normalized();
+    Vector N = (hit - position) * invR;
 
     // determine orientation of the normal
     if (N.dot(ray.D) > 0)
@@ -75,3 +144,16 @@ Sphere::Sphere(Point const &pos, double radius, Vector rot, int ang)
     rotation(rot),
     angle(ang)
 {}
+
+// The rotation only turns the texture, but is counted as geometry
+void Sphere::hashGeometry(Hasher &hash) const
+{
+    hash.add(position).add(r).add(rotation).add(angle);
+}
+
+bool Sphere::bounds(Point &center, Real &radius) const
+{
+    center = position;
+    radius = r;
+    return true;
+}
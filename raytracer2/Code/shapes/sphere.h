@@ -8,16 +8,31 @@ class Sphere: public Object
     public:
         Sphere(Point const &pos, double radius, Vector rotation, int angle);
 
+        virtual void prepare();
         virtual Hit intersect(Ray const &ray);
         virtual Color textureColorAt(Point N, bool rotate);
+        virtual Color textureColorAt(Point point, Vector const &dPdx,
+                                     Vector const &dPdy, bool rotate);
+        virtual Vector normalDifferential(Point const &point, Vector const &dP);
 
         virtual bool isRotated() { return (angle != -1); };
         virtual Vector rotate(Point point);
+        virtual void hashGeometry(Hasher &hash) const;
+        virtual bool bounds(Point &center, Real &radius) const;
 
         Point const position;
-        double const r;
+        Real const r;
         Vector rotation;
         int angle;
+
+    private:
+        Hit intersection(Ray const &ray);   // intersect, built per ISA (cpu.h)
+
+        void textureCoordinates(Point point, bool rotate, float &u, float &v);
+
+        // set by prepare()
+        Real invR;
+        Real rotationMatrix[3][3];    // rotation by angle around rotation
 };
 
 #endif
@@ -1,32 +1,46 @@
 #include "triangle.h"
+#include "../cpu.h"
 
-#include <cfloat>   // DBL_EPSILON
+#include <algorithm>
 #include <cmath>
+#include <limits>
+
+void Triangle::prepare()
+{
+    edge1 = v1 - v0;
+    edge2 = v2 - v0;
+}
 
 Hit Triangle::intersect(Ray const &ray)
 {
+    return intersection(ray);
+}
+
+RAY_MULTI_ISA
+Hit Triangle::intersection(Ray const &ray)
+{
+    Real const Epsilon = std::numeric_limits<Real>::epsilon();
+
     // Möller-Trumbore
-    Vector edge1(v1 - v0);
-    Vector edge2(v2 - v0);
     Vector h = ray.D.cross(edge2);
-    double a = edge1.dot(h);
-    if (a > -DBL_EPSILON && a < DBL_EPSILON)
+    Real a = edge1.dot(h);
+    if (a > -Epsilon && a < Epsilon)
         return Hit::NO_HIT();
 
-    double f = 1 / a;
+    Real f = 1 / a;
     Vector s = ray.O - v0;
-    double u = f * s.dot(h);
+    Real u = f * s.dot(h);
     if (u < 0.0 || u > 1.0)
         return Hit::NO_HIT();
 
     Vector q = s.cross(edge1);
-    double v = f * ray.D.dot(q);
+    Real v = f * ray.D.dot(q);
     if (v < 0.0 || u + v > 1.0)
         return Hit::NO_HIT();
 
-    double t = f * edge2.dot(q);
+    Real t = f * edge2.dot(q);
 
-    if (t <= DBL_EPSILON)    // line intersection (not ray)
+    if (t <= Epsilon)    // line intersection (not ray)
         return Hit::NO_HIT();
 
     // determine orientation of the normal
@@ -52,3 +66,16 @@ Triangle::Triangle(Point const &v0,
     N = U.cross(V);
     N.normalize();
 }
+
+void Triangle::hashGeometry(Hasher &hash) const
+{
+    hash.add(v0).add(v1).add(v2);
+}
+
+bool Triangle::bounds(Point &center, Real &radius) const
+{
+    center = (v0 + v1 + v2) / 3;
+    radius = std::sqrt(std::max({(v0 - center).length_2(), (v1 - center).length_2(),
+                                 (v2 - center).length_2()}));
+    return true;
+}
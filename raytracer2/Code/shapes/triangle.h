@@ -10,16 +10,26 @@ class Triangle: public Object
                  Point const &v1,
                  Point const &v2);
 
+        virtual void prepare();
         virtual Hit intersect(Ray const &ray);
         virtual Color textureColorAt(Point N, bool rotate){ return Color(); };
         virtual bool isRotated() { return false; };
         // virtual Ray rotate(Ray const &ray) { return Ray(); };
         virtual Vector rotate(Point point) { return Vector(); };
+        virtual void hashGeometry(Hasher &hash) const;
+        virtual bool bounds(Point &center, Real &radius) const;
 
         Point v0;
         Point v1;
         Point v2;
         Vector N;
+
+    private:
+        Hit intersection(Ray const &ray);   // intersect, built per ISA (cpu.h)
+
+        // set by prepare()
+        Vector edge1;       // v1 - v0
+        Vector edge2;       // v2 - v0
 };
 
 #endif
@@ -0,0 +1,338 @@
+#include "texture.h"
+
+#include "cpu.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+// --- Helpers -----------------------------------------------------------------
+
+namespace
+{
+    uint16_t pack565(float r, float g, float b)
+    {
+        auto quantize = [](float value, int levels)
+        {
+            return static_cast<uint16_t>(min(max(value, 0.0f), 255.0f) * levels / 255 + 0.5f);
+        };
+        return quantize(r, 31) << 11 | quantize(g, 63) << 5 | quantize(b, 31);
+    }
+
+    Rgba8 unpack565(uint16_t c)
+    {
+        Rgba8 rgba;
+        uint8_t r = c >> 11;
+        uint8_t g = (c >> 5) & 63;
+        uint8_t b = c & 31;
+        rgba.r = r << 3 | r >> 2;
+        rgba.g = g << 2 | g >> 4;
+        rgba.b = b << 3 | b >> 2;
+        return rgba;
+    }
+
+    // The four colors of a block: the end points and two blends
+    void palette(uint16_t c0, uint16_t c1, Rgba8 colors[4])
+    {
+        colors[0] = unpack565(c0);
+        colors[1] = unpack565(c1);
+        colors[2].r = (2 * colors[0].r + colors[1].r) / 3;
+        colors[2].g = (2 * colors[0].g + colors[1].g) / 3;
+        colors[2].b = (2 * colors[0].b + colors[1].b) / 3;
+        colors[3].r = (colors[0].r + 2 * colors[1].r) / 3;
+        colors[3].g = (colors[0].g + 2 * colors[1].g) / 3;
+        colors[3].b = (colors[0].b + 2 * colors[1].b) / 3;
+    }
+
+    float unit(float value)     // [0, 1], NaN -> 0
+    {
+        return value > 0 ? (value < 1 ? value : 1) : 0;
+    }
+
+    // The texels as BC1 blocks, row by row
+    vector<uint64_t> compressBc1(Rgba8Image const &texels)
+    {
+        unsigned width = texels.width();
+        unsigned height = texels.height();
+        unsigned blocksX = (width + 3) / 4;
+        unsigned blocksY = (height + 3) / 4;
+        vector<uint64_t> blocks(blocksX * blocksY);
+
+        for (unsigned by = 0; by != blocksY; ++by)
+        {
+            for (unsigned bx = 0; bx != blocksX; ++bx)
+            {
+                // The block's texels, repeating the last row and column at the
+                // edges of the texture
+                float block[16][3];
+                for (unsigned idx = 0; idx != 16; ++idx)
+                {
+                    Rgba8 t = texels(min(bx * 4 + idx % 4, width - 1),
+                                     min(by * 4 + idx / 4, height - 1));
+                    block[idx][0] = t.r;
+                    block[idx][1] = t.g;
+                    block[idx][2] = t.b;
+                }
+
+                // End points: the corners of the bounding box, with the
+                // diagonal oriented along the spread of the colors (the sign of
+                // the covariance of green and blue with red), inset by 1/16
+                float lo[3] = {255, 255, 255};
+                float hi[3] = {0, 0, 0};
+                float mean[3] = {0, 0, 0};
+                for (auto const &texel : block)
+                {
+                    for (int channel = 0; channel != 3; ++channel)
+                    {
+                        lo[channel] = min(lo[channel], texel[channel]);
+                        hi[channel] = max(hi[channel], texel[channel]);
+                        mean[channel] += texel[channel] / 16;
+                    }
+                }
+                for (int channel = 1; channel != 3; ++channel)
+                {
+                    float covariance = 0;
+                    for (auto const &texel : block)
+                        covariance += (texel[0] - mean[0]) * (texel[channel] - mean[channel]);
+                    if (covariance < 0)
+                        swap(lo[channel], hi[channel]);
+                }
+                for (int channel = 0; channel != 3; ++channel)
+                {
+                    float inset = (hi[channel] - lo[channel]) / 16;
+                    hi[channel] -= inset;
+                    lo[channel] += inset;
+                }
+
+                uint16_t c0 = pack565(hi[0], hi[1], hi[2]);
+                uint16_t c1 = pack565(lo[0], lo[1], lo[2]);
+                if (c0 < c1)
+                    swap(c0, c1);       // c0 > c1 selects the four color mode
+
+                uint64_t indices = 0;
+                if (c0 != c1)
+                {
+                    Rgba8 colors[4];
+                    palette(c0, c1, colors);
+                    for (unsigned idx = 0; idx != 16; ++idx)
+                    {
+                        uint64_t best = 0;
+                        float bestDistance = 1e30f;
+                        for (unsigned entry = 0; entry != 4; ++entry)
+                        {
+                            float dr = block[idx][0] - colors[entry].r;
+                            float dg = block[idx][1] - colors[entry].g;
+                            float db = block[idx][2] - colors[entry].b;
+                            float distance = dr * dr + dg * dg + db * db;
+                            if (distance < bestDistance)
+                            {
+                                bestDistance = distance;
+                                best = entry;
+                            }
+                        }
+                        indices |= best << (2 * idx);
+                    }
+                }
+                blocks[by * blocksX + bx] = c0 | uint64_t(c1) << 16 | indices << 32;
+            }
+        }
+        return blocks;
+    }
+}
+
+// --- Constructors ------------------------------------------------------------
+
+Texture::Texture(unsigned width, unsigned height)
+:
+    d_levels(1)
+{
+    d_levels[0].width = width;
+    d_levels[0].height = height;
+    store(d_levels[0], Rgba8Image(width, height));
+}
+
+Texture::Texture(string const &filename, Compression compression, bool mipmaps,
+                 Layout layout)
+:
+    Texture(Rgba8Image(filename), compression, mipmaps, layout)
+{}
+
+Texture::Texture(Rgba8Image const &texels, Compression compression, bool mipmaps,
+                 Layout layout)
+:
+    d_compression(compression),
+    d_layout(layout)
+{
+    Rgba8Image level = texels;
+    while (true)
+    {
+        d_levels.emplace_back();
+        Level &added = d_levels.back();
+        added.width = level.width();
+        added.height = level.height();
+        if (compression == Compression::Bc1)
+            added.blocks = compressBc1(level);
+        else
+            store(added, level);
+
+        if (!mipmaps || (level.width() <= 1 && level.height() <= 1))
+            break;
+        level = downsample(level);
+    }
+}
+
+Texture::Texture(shared_ptr<TiledTexture> const &tiled)
+:
+    d_levels(tiled->levels()),
+    d_tiled(tiled)
+{
+    for (unsigned level = 0; level != d_levels.size(); ++level)
+    {
+        d_levels[level].width = tiled->width(level);
+        d_levels[level].height = tiled->height(level);
+    }
+}
+
+// Copies the texels into the level in the texture's layout. Morton tiles at
+// the right and bottom edge are padded, the padding is never looked up.
+void Texture::store(Level &level, Rgba8Image const &texels) const
+{
+    level.tilesX = (texels.width() + TileSize - 1) / TileSize;
+    if (d_layout == Layout::Linear)
+        level.texels.resize(texels.size());
+    else
+        level.texels.resize(size_t(level.tilesX) * TileSize * TileSize
+                            * ((texels.height() + TileSize - 1) / TileSize));
+
+    for (unsigned y = 0; y != texels.height(); ++y)
+    {
+        Rgba8 const *row = texels.row(y);
+        for (unsigned x = 0; x != texels.width(); ++x)
+            level.texels[index(level, x, y)] = row[x];
+    }
+}
+
+// A tiled texture takes none: its resident tiles are in the TextureCache
+size_t Texture::bytes() const
+{
+    size_t bytes = 0;
+    for (Level const &level : d_levels)
+        bytes += level.blocks.size() * sizeof(uint64_t) + level.texels.size() * sizeof(Rgba8);
+    return bytes;
+}
+
+// Texels are hashed as stored, so a change of layout or compression
+// changes the digest too. A tiled texture has its digest in the file.
+uint64_t Texture::digest() const
+{
+    Hasher hash;
+    hash.add(d_filter).add(d_compression).add(d_layout);
+    if (d_tiled)
+        return hash.add(d_tiled->digest()).value();
+    for (Level const &level : d_levels)
+    {
+        hash.add(level.width).add(level.height);
+        hash.add(level.texels.data(), level.texels.size() * sizeof(Rgba8));
+        hash.add(level.blocks.data(), level.blocks.size() * sizeof(uint64_t));
+    }
+    return hash.value();
+}
+
+// --- Lookup ------------------------------------------------------------------
+
+float Texture::lod(float dudx, float dvdx, float dudy, float dvdy) const
+{
+    float w = width();
+    float h = height();
+    float footprint = max(hypot(dudx * w, dvdx * h), hypot(dudy * w, dvdy * h));
+    return footprint > 1 ? log2(footprint) : 0;
+}
+
+Color Texture::colorAt(float u, float v) const
+{
+    if (width() == 0 || height() == 0)
+        return Color(0, 0, 0);
+    return d_filter == Filter::Nearest ? nearest(u, v) : bilinear(0, u, v);
+}
+
+Color Texture::colorAt(float u, float v, float lod) const
+{
+    if (d_filter != Filter::Trilinear || width() == 0 || height() == 0)
+        return colorAt(u, v);
+
+    float maxLevel = d_levels.size() - 1;
+    lod = lod > 0 ? (lod < maxLevel ? lod : maxLevel) : 0;
+    unsigned level = static_cast<unsigned>(lod);
+    float blend = lod - level;
+
+    Color color = bilinear(level, u, v);
+    if (blend > 0)
+        color = (1 - blend) * color + blend * bilinear(level + 1, u, v);
+    return color;
+}
+
+Rgba8 Texture::texel(unsigned level, unsigned x, unsigned y) const
+{
+    if (d_tiled)
+        return d_tiled->texel(level, x, y);
+    Level const &mip = d_levels[level];
+    return d_compression == Compression::Bc1 ? texelBc1(mip, x, y)
+                                             : mip.texels[index(mip, x, y)];
+}
+
+// The texel grid spans [0, 1] from the first to the last texel center
+Color Texture::nearest(float u, float v) const
+{
+    Rgba8 t = texel(static_cast<unsigned>(unit(u) * (width() - 1)),
+                    static_cast<unsigned>(unit(v) * (height() - 1)));
+    return Color(t.r / Real(255), t.g / Real(255), t.b / Real(255));
+}
+
+RAY_MULTI_ISA
+Color Texture::bilinear(unsigned level, float u, float v) const
+{
+    unsigned w = d_levels[level].width;
+    unsigned h = d_levels[level].height;
+    float x = unit(u) * (w - 1);
+    float y = unit(v) * (h - 1);
+    unsigned x0 = static_cast<unsigned>(x);
+    unsigned y0 = static_cast<unsigned>(y);
+    unsigned x1 = min(x0 + 1, w - 1);
+    unsigned y1 = min(y0 + 1, h - 1);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    Rgba8 const texels[4] = {texel(level, x0, y0), texel(level, x1, y0),
+                             texel(level, x0, y1), texel(level, x1, y1)};
+    float const weights[4] = {(1 - fx) * (1 - fy), fx * (1 - fy),
+                              (1 - fx) * fy, fx * fy};
+
+    // The channels are blended as one vector of four floats, which the
+    // compiler maps onto a single SIMD register
+    float sum[4] = {0, 0, 0, 0};
+    for (int corner = 0; corner != 4; ++corner)
+    {
+        float const channels[4] = {float(texels[corner].r), float(texels[corner].g),
+                                   float(texels[corner].b), float(texels[corner].a)};
+        for (int channel = 0; channel != 4; ++channel)
+            sum[channel] += weights[corner] * channels[channel];
+    }
+    return Color(sum[0] / 255, sum[1] / 255, sum[2] / 255);
+}
+
+// --- BC1 ---------------------------------------------------------------------
+
+Rgba8 Texture::texelBc1(Level const &level, unsigned x, unsigned y) const
+{
+    uint64_t block = level.blocks[(y / 4) * ((level.width + 3) / 4) + x / 4];
+    uint16_t c0 = block & 0xffff;
+    uint16_t c1 = (block >> 16) & 0xffff;
+    unsigned index = (block >> (32 + 2 * ((y % 4) * 4 + x % 4))) & 3;
+
+    Rgba8 colors[4];
+    palette(c0, c1, colors);
+    return colors[index];
+}
@@ -0,0 +1,114 @@
+#ifndef TEXTURE_H_
+#define TEXTURE_H_
+
+#include "image.h"
+#include "morton.h"
+#include "texturecache.h"
+#include "triple.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only texture, sampled with texture coordinates in [0, 1]. Texels are
+// stored as RGBA8 or, compressed, as BC1 blocks: 4x4 texels in 8 bytes (two
+// RGB565 end points and a 2 bit palette index per texel), which are decoded
+// texel by texel on lookup. RGBA8 texels are laid out in tiles of TileSize x
+// TileSize texels (a 4 KiB page), in Z-order within a tile, so that lookups
+// that move vertically or diagonally stay in cache as well as horizontal
+// ones. A mipmapped texture also keeps the levels of its mip pyramid, each
+// half the size of the previous one (2x2 box filter).
+// A tiled texture reads its texels (and pyramid) from a TiledTexture file,
+// which is only paged in where it is sampled.
+class Texture
+{
+    public:
+        enum class Compression
+        {
+            None,       // RGBA8, 4 bytes per texel
+            Bc1         // 0.5 bytes per texel, no alpha
+        };
+
+        enum class Filter
+        {
+            Nearest,
+            Bilinear,
+            Trilinear   // bilinear on the two mip levels around the LOD
+        };
+
+        enum class Layout
+        {
+            Linear,     // row by row
+            Morton      // Z-order tiles
+        };
+
+    private:
+        static unsigned const TileSize = 32;
+
+        struct Level
+        {
+            unsigned width = 0;
+            unsigned height = 0;
+            unsigned tilesX = 0;            // Layout::Morton
+            std::vector<Rgba8> texels;      // Compression::None, in d_layout
+            std::vector<uint64_t> blocks;   // Compression::Bc1, row by row
+        };
+
+        Compression d_compression = Compression::None;
+        Layout d_layout = Layout::Morton;
+        Filter d_filter = Filter::Nearest;
+        std::vector<Level> d_levels;        // [0] is the full texture
+        std::shared_ptr<TiledTexture> d_tiled;  // holds the texels if set
+
+    public:
+        Texture(unsigned width = 0, unsigned height = 0);   // black
+        Texture(std::string const &filename,
+                Compression compression = Compression::None,
+                bool mipmaps = false, Layout layout = Layout::Morton);
+        Texture(Rgba8Image const &texels,
+                Compression compression = Compression::None,
+                bool mipmaps = false, Layout layout = Layout::Morton);
+        explicit Texture(std::shared_ptr<TiledTexture> const &tiled);
+
+        unsigned width() const { return d_levels[0].width; };
+        unsigned height() const { return d_levels[0].height; };
+        unsigned levels() const { return d_levels.size(); };
+        size_t bytes() const;               // memory taken by the texels
+        uint64_t digest() const;            // hash of the texels and filter
+        bool tiled() const { return d_tiled != nullptr; };
+
+        void setFilter(Filter filter) { d_filter = filter; };
+        Filter filter() const { return d_filter; };
+        Layout layout() const { return d_layout; };
+
+        // Level of detail of a sample whose footprint spans (dudx, dvdx)
+        // and (dudy, dvdy) in texture coordinates: log2 of its size in
+        // texels of level 0
+        float lod(float dudx, float dvdx, float dudy, float dvdy) const;
+
+        Color colorAt(float u, float v) const;  // with the set filter
+        Color colorAt(float u, float v, float lod) const;
+        Rgba8 texel(unsigned x, unsigned y) const { return texel(0, x, y); };
+        Rgba8 texel(unsigned level, unsigned x, unsigned y) const;
+
+    private:
+        void store(Level &level, Rgba8Image const &texels) const;
+        size_t index(Level const &level, unsigned x, unsigned y) const
+        {
+            if (d_layout == Layout::Linear)
+                return size_t(y) * level.width + x;
+            size_t tile = size_t(y / TileSize) * level.tilesX + x / TileSize;
+            return tile * TileSize * TileSize + mortonIndex(x % TileSize, y % TileSize);
+        }
+
+        Color nearest(float u, float v) const;
+        Color bilinear(unsigned level, float u, float v) const;
+
+        Rgba8 texelBc1(Level const &level, unsigned x, unsigned y) const;
+};
+
+typedef std::shared_ptr<Texture> TexturePtr;
+
+#endif
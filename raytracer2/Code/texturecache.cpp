@@ -0,0 +1,313 @@
+#include "texturecache.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// --- File format -------------------------------------------------------------
+
+namespace
+{
+    char const Magic[8] = {'R', 'A', 'Y', 'T', 'I', 'L', 'E', 'S'};
+    uint32_t const Version = 3;             // 1 had row major tiles, 2 no digest
+    size_t const Alignment = 4096;          // of the tile data
+    size_t const TileBytes = TiledTexture::TileSize * TiledTexture::TileSize * sizeof(Rgba8);
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levels;
+        uint32_t tileSize;
+        uint32_t padding;
+        uint64_t digest;        // of the level sizes and tiles, as written
+    };
+
+    struct LevelHeader
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+    };
+
+    size_t tilesOf(unsigned size)
+    {
+        return (size + TiledTexture::TileSize - 1) / TiledTexture::TileSize;
+    }
+
+    // Modification time, 0 if the file does not exist
+    time_t modified(string const &filename)
+    {
+        struct stat info;
+        return stat(filename.c_str(), &info) == 0 ? info.st_mtime : 0;
+    }
+
+    bool validHeader(string const &filename)
+    {
+        ifstream file(filename, ios::binary);
+        Header header;
+        return file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            && equal(Magic, Magic + 8, header.magic)
+            && header.version == Version
+            && header.tileSize == TiledTexture::TileSize;
+    }
+}
+
+// --- TiledTexture ------------------------------------------------------------
+
+void TiledTexture::write(Rgba8Image const &texels, string const &filename)
+{
+    vector<Rgba8Image> pyramid{texels};
+    while (pyramid.back().width() > 1 || pyramid.back().height() > 1)
+        pyramid.push_back(downsample(pyramid.back()));
+
+    Header header = {};
+    copy(Magic, Magic + 8, header.magic);
+    header.version = Version;
+    header.width = texels.width();
+    header.height = texels.height();
+    header.levels = pyramid.size();
+    header.tileSize = TileSize;
+
+    vector<LevelHeader> levels;
+    uint64_t offset = sizeof(Header) + pyramid.size() * sizeof(LevelHeader);
+    offset = (offset + Alignment - 1) / Alignment * Alignment;
+    for (Rgba8Image const &level : pyramid)
+    {
+        levels.push_back(LevelHeader{level.width(), level.height(), offset});
+        offset += tilesOf(level.width()) * tilesOf(level.height()) * TileBytes;
+    }
+
+    // Written next to the destination and renamed, so that a concurrent
+    // render never maps a partial file
+    string temporary = filename + ".tmp";
+    ofstream file(temporary, ios::binary | ios::trunc);
+    if (!file)
+        throw runtime_error("Could not open " + temporary + " for writing.");
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(levels.data()), levels.size() * sizeof(LevelHeader));
+
+    // The tiles are hashed as they are written, and the header written
+    // again with the digest, so that a render never reads the file to
+    // hash it
+    Hasher hash;
+    vector<Rgba8> tile(TileSize * TileSize);
+    for (size_t idx = 0; idx != pyramid.size(); ++idx)
+    {
+        Rgba8Image const &level = pyramid[idx];
+        hash.add(levels[idx].width).add(levels[idx].height);
+        file.seekp(levels[idx].offset);
+        for (unsigned ty = 0; ty != tilesOf(level.height()); ++ty)
+        {
+            for (unsigned tx = 0; tx != tilesOf(level.width()); ++tx)
+            {
+                for (unsigned y = 0; y != TileSize; ++y)
+                {
+                    Rgba8 const *row = level.row(min(ty * TileSize + y, level.height() - 1));
+                    for (unsigned x = 0; x != TileSize; ++x)
+                        tile[mortonIndex(x, y)] = row[min(tx * TileSize + x, level.width() - 1)];
+                }
+                file.write(reinterpret_cast<char const *>(tile.data()), TileBytes);
+                hash.add(tile.data(), TileBytes);
+            }
+        }
+    }
+    header.digest = hash.value();
+    file.seekp(0);
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0)
+        throw runtime_error("Could not write tiled texture " + filename + '.');
+}
+
+void TiledTexture::convert(string const &source, string const &filename)
+{
+    time_t converted = modified(filename);
+    if (converted != 0 && converted >= modified(source) && validHeader(filename))
+        return;
+    write(Rgba8Image(source), filename);
+}
+
+TiledTexture::TiledTexture(string const &filename)
+:
+    d_cache(TextureCache::instance())
+{
+    d_fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (d_fd < 0 || fstat(d_fd, &info) != 0)
+        throw runtime_error("Could not open tiled texture " + filename + '.');
+    d_bytes = info.st_size;
+
+    void *data = d_bytes == 0 ? MAP_FAILED
+                              : mmap(nullptr, d_bytes, PROT_READ, MAP_SHARED, d_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(d_fd);
+        throw runtime_error("Could not map tiled texture " + filename + '.');
+    }
+    d_data = static_cast<unsigned char const *>(data);
+
+    Header header = {};
+    if (d_bytes >= sizeof(header))
+        memcpy(&header, d_data, sizeof(header));
+    if (!equal(Magic, Magic + 8, header.magic) || header.version != Version
+        || header.tileSize != TileSize
+        || sizeof(header) + header.levels * sizeof(LevelHeader) > d_bytes)
+    {
+        munmap(data, d_bytes);
+        close(d_fd);
+        throw runtime_error(filename + " is not a tiled texture.");
+    }
+
+    d_digest = header.digest;
+
+    // Tiles are looked up at random, read ahead would only fill the budget
+    madvise(data, d_bytes, MADV_RANDOM);
+
+    for (uint32_t idx = 0; idx != header.levels; ++idx)
+    {
+        LevelHeader level;
+        memcpy(&level, d_data + sizeof(header) + idx * sizeof(LevelHeader), sizeof(level));
+        d_levels.push_back(Level{level.width, level.height,
+                                 static_cast<uint32_t>(tilesOf(level.width)),
+                                 level.offset, d_tileCount});
+        d_tileCount += tilesOf(level.width) * tilesOf(level.height);
+        if (level.offset + tilesOf(level.width) * tilesOf(level.height) * TileBytes > d_bytes)
+        {
+            munmap(data, d_bytes);
+            close(d_fd);
+            throw runtime_error("Tiled texture " + filename + " is truncated.");
+        }
+    }
+    d_tiles.reset(new Tile[d_tileCount]);
+    d_cache.add(this);
+}
+
+TiledTexture::~TiledTexture()
+{
+    d_cache.remove(this);
+    munmap(const_cast<unsigned char *>(d_data), d_bytes);
+    close(d_fd);
+}
+
+// The tile's data and size in bytes; tiles are numbered level by level
+unsigned char const *TiledTexture::tileData(size_t tile, size_t &bytes) const
+{
+    size_t level = 0;
+    while (level + 1 != d_levels.size() && d_levels[level + 1].firstTile <= tile)
+        ++level;
+    bytes = TileBytes;
+    return d_data + d_levels[level].offset + (tile - d_levels[level].firstTile) * TileBytes;
+}
+
+// Drops the tile's pages from the mapping and from the page cache. A lookup
+// that races with the eviction is still correct: it faults the page in again.
+void TiledTexture::evict(size_t tile) const
+{
+    size_t bytes;
+    unsigned char const *data = tileData(tile, bytes);
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(data) + page - 1) / page * page;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(data) + bytes) / page * page;
+    if (begin < end)
+    {
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+        posix_fadvise(d_fd, begin - reinterpret_cast<uintptr_t>(d_data), end - begin,
+                      POSIX_FADV_DONTNEED);
+    }
+    d_tiles[tile].resident = false;
+}
+
+// --- TextureCache ------------------------------------------------------------
+
+TextureCache &TextureCache::instance()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+void TextureCache::setBudget(size_t bytes)
+{
+    d_budget = bytes;
+    if (d_budget != 0 && d_resident > d_budget)
+        evict();
+}
+
+bool TextureCache::empty()
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_textures.empty();
+}
+
+void TextureCache::add(TiledTexture const *texture)
+{
+    lock_guard<mutex> lock(d_mutex);
+    d_textures.push_back(texture);
+}
+
+void TextureCache::remove(TiledTexture const *texture)
+{
+    lock_guard<mutex> lock(d_mutex);
+    d_textures.erase(std::remove(d_textures.begin(), d_textures.end(), texture),
+                     d_textures.end());
+}
+
+// Called by the lookup that found the tile not resident
+void TextureCache::fault(TiledTexture const &texture, size_t tile)
+{
+    // A new tick makes every tile touched before it older than this one
+    texture.d_tiles[tile].lastUse = ++d_clock;
+    ++d_faults;
+
+    // The whole tile is read at once instead of page by page
+    size_t bytes;
+    unsigned char const *data = texture.tileData(tile, bytes);
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) / page * page;
+    madvise(reinterpret_cast<void *>(begin), reinterpret_cast<uintptr_t>(data) + bytes - begin,
+            MADV_WILLNEED);
+
+    size_t resident = d_resident += bytes;
+    size_t peak = d_peak;
+    while (resident > peak && !d_peak.compare_exchange_weak(peak, resident))
+        ;
+    if (d_budget != 0 && resident > d_budget)
+        evict();
+}
+
+void TextureCache::evict()
+{
+    lock_guard<mutex> lock(d_mutex);
+    if (d_resident <= d_budget)
+        return;                             // another thread evicted already
+
+    vector<tuple<uint32_t, TiledTexture const *, size_t>> candidates;
+    for (TiledTexture const *texture : d_textures)
+        for (size_t tile = 0; tile != texture->d_tileCount; ++tile)
+            if (texture->d_tiles[tile].resident)
+                candidates.emplace_back(texture->d_tiles[tile].lastUse, texture, tile);
+    sort(candidates.begin(), candidates.end());
+
+    size_t target = d_budget - d_budget / 4;
+    for (auto const &candidate : candidates)
+    {
+        if (d_resident <= target)
+            break;
+        get<1>(candidate)->evict(get<2>(candidate));
+        d_resident -= TileBytes;
+        ++d_evictions;
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef TEXTURECACHE_H_
+#define TEXTURECACHE_H_
+
+#include "image.h"
+#include "morton.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TextureCache;
+
+// --- TiledTexture ------------------------------------------------------------
+
+// A texture and its mip pyramid in a file of TileSize x TileSize RGBA8 tiles,
+// which is memory mapped: a tile is only read from disk when a lookup falls
+// in it. The resident tiles of all tiled textures share the memory budget of
+// the TextureCache, which evicts the least recently used ones.
+//
+// File layout: a header (magic, version, size, levels, tile size and the
+// digest of the tiles, computed when the file is written), then per level
+// its size and the file offset of its tiles, which are stored row by row
+// from the first page boundary after the header on. The texels of a tile
+// are in Z-order, like those of an in-memory Texture. Edge tiles are padded
+// by repeating the last row and column.
+class TiledTexture
+{
+    friend class TextureCache;
+
+    public:
+        static unsigned const TileSize = 64;    // a tile is 16 KiB
+
+    private:
+        struct Level
+        {
+            uint32_t width;
+            uint32_t height;
+            uint32_t tilesX;
+            uint64_t offset;        // of the first tile in the file
+            size_t firstTile;       // index in d_tiles
+        };
+
+        struct Tile
+        {
+            std::atomic<uint32_t> lastUse{0};   // TextureCache clock
+            std::atomic<bool> resident{false};
+        };
+
+        TextureCache &d_cache;
+        int d_fd = -1;
+        unsigned char const *d_data = nullptr;
+        size_t d_bytes = 0;
+        std::vector<Level> d_levels;
+        std::unique_ptr<Tile[]> d_tiles;
+        size_t d_tileCount = 0;
+        uint64_t d_digest = 0;
+
+    public:
+        // Writes texels and their mip pyramid to filename
+        static void write(Rgba8Image const &texels, std::string const &filename);
+
+        // Converts the png source to filename, unless filename is a tiled
+        // texture that is newer than the source already
+        static void convert(std::string const &source, std::string const &filename);
+
+        explicit TiledTexture(std::string const &filename);   // maps the file
+        ~TiledTexture();
+
+        TiledTexture(TiledTexture const &) = delete;
+        TiledTexture &operator=(TiledTexture const &) = delete;
+
+        unsigned levels() const { return d_levels.size(); };
+        unsigned width(unsigned level) const { return d_levels[level].width; };
+        unsigned height(unsigned level) const { return d_levels[level].height; };
+        size_t fileBytes() const { return d_bytes; };
+        uint64_t digest() const { return d_digest; };  // from the header
+
+        Rgba8 texel(unsigned level, unsigned x, unsigned y) const
+        {
+            Level const &mip = d_levels[level];
+            size_t tile = (y / TileSize) * mip.tilesX + x / TileSize;
+            touch(mip.firstTile + tile);
+            size_t texel = tile * TileSize * TileSize
+                         + mortonIndex(x % TileSize, y % TileSize);
+            Rgba8 rgba;
+            std::memcpy(&rgba, d_data + mip.offset + texel * sizeof(Rgba8), sizeof(Rgba8));
+            return rgba;
+        }
+
+    private:
+        inline void touch(size_t tile) const;
+        unsigned char const *tileData(size_t tile, size_t &bytes) const;
+        void evict(size_t tile) const;
+};
+
+// --- TextureCache ------------------------------------------------------------
+
+// Budget for the resident tiles of all tiled textures. Every tile that is
+// faulted in ticks the clock; when the budget is exceeded, the tiles with
+// the oldest last use are evicted until a quarter of the budget is free
+// again. Evicted pages are dropped from the process and the page cache, a
+// later lookup reads them from disk again.
+class TextureCache
+{
+    friend class TiledTexture;
+
+    std::mutex d_mutex;                     // guards d_textures and eviction
+    std::vector<TiledTexture const *> d_textures;
+    size_t d_budget = 0;                    // bytes, 0 is unlimited
+    std::atomic<uint32_t> d_clock{1};
+    std::atomic<size_t> d_resident{0};
+    std::atomic<size_t> d_peak{0};
+    std::atomic<unsigned long long> d_faults{0};
+    std::atomic<unsigned long long> d_evictions{0};
+
+    public:
+        static TextureCache &instance();
+
+        void setBudget(size_t bytes);       // evicts down to it
+        size_t budget() const { return d_budget; };
+
+        bool empty();                       // no tiled textures loaded
+        size_t resident() const { return d_resident; };
+        size_t peak() const { return d_peak; };
+        unsigned long long faults() const { return d_faults; };
+        unsigned long long evictions() const { return d_evictions; };
+
+    private:
+        void add(TiledTexture const *texture);
+        void remove(TiledTexture const *texture);
+        void fault(TiledTexture const &texture, size_t tile);
+        void evict();
+};
+
+// A resident tile only has its last use updated (and only when the clock
+// moved), so lookups in a working set that fits the budget do not write to
+// shared memory
+inline void TiledTexture::touch(size_t tile) const
+{
+    Tile &state = d_tiles[tile];
+    uint32_t now = d_cache.d_clock.load(std::memory_order_relaxed);
+    if (state.lastUse.load(std::memory_order_relaxed) != now)
+        state.lastUse.store(now, std::memory_order_relaxed);
+    if (!state.resident.load(std::memory_order_relaxed)
+        && !state.resident.exchange(true))
+        d_cache.fault(*this, tile);
+}
+
+#endif
@@ -0,0 +1,406 @@
+#include "tilecache.h"
+
+#include "fastmath.h"
+#include "hash.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <typeinfo>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// --- File formats ------------------------------------------------------------
+
+// <key>.index: Magic, Version, the number of entries, then per entry its
+// hashes, flags, bounds and (geometry, material) pairs.
+// <content>.pixels: width, height and the RgbSum pixels of the tile.
+// <scene geometry>.scene: the number of geometry hashes and the sorted hashes.
+namespace
+{
+    char const Magic[8] = {'R', 'A', 'Y', 'T', 'C', 'I', 'D', 'X'};
+    uint32_t const Version = 1;
+
+    template <typename T>
+    void put(ostream &out, T const &value)
+    {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    bool get(istream &in, T &value)
+    {
+        return bool(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+    }
+
+    void putPoint(ostream &out, Point const &point)
+    {
+        for (double value : {double(point.x), double(point.y), double(point.z)})
+            put(out, value);
+    }
+
+    bool getPoint(istream &in, Point &point)
+    {
+        double x, y, z;
+        bool read = get(in, x) && get(in, y) && get(in, z);
+        point = Point(x, y, z);
+        return read;
+    }
+
+    // Written next to the file and renamed, so readers never see a part
+    template <typename Write>
+    void replace(string const &filename, Write write)
+    {
+        string temporary = filename + ".tmp";
+        ofstream file(temporary, ios::binary | ios::trunc);
+        write(file);
+        file.close();
+        if (!file || rename(temporary.c_str(), filename.c_str()) != 0)
+            cerr << "Could not write " << filename << ".\n";
+    }
+
+    bool exists(string const &filename)
+    {
+        struct stat info;
+        return stat(filename.c_str(), &info) == 0;
+    }
+
+    // Whether the sphere may reach into the box
+    bool touches(Point const &center, Real radius, Point const &lower, Point const &upper)
+    {
+        Real distance2 = 0;
+        for (int axis = 0; axis != 3; ++axis)
+        {
+            Real below = lower.data[axis] - center.data[axis];
+            Real above = center.data[axis] - upper.data[axis];
+            Real outside = max({below, above, Real(0)});
+            distance2 += outside * outside;
+        }
+        return lower.x <= upper.x && distance2 <= radius * radius;
+    }
+
+    // Whether the sphere may reach into the pyramid of the rays from the eye
+    // through the tile: it is outside if it lies behind one of the four
+    // side planes or behind the eye
+    bool touches(Point const &center, Real radius, Camera const &camera, Tile const &tile)
+    {
+        Point const &eye = camera.eye();
+        Point corners[4] = {camera.filmPoint(tile.x0, tile.y0), camera.filmPoint(tile.x1, tile.y0),
+                            camera.filmPoint(tile.x1, tile.y1), camera.filmPoint(tile.x0, tile.y1)};
+        Vector inside = camera.filmPoint((tile.x0 + tile.x1) / Real(2),
+                                         (tile.y0 + tile.y1) / Real(2)) - eye;
+        Vector offset = center - eye;
+        if (inside.normalized().dot(offset) < -radius)
+            return false;
+        for (int side = 0; side != 4; ++side)
+        {
+            Vector normal = (corners[side] - eye).cross(corners[(side + 1) % 4] - eye).normalized();
+            if (normal.dot(inside) < 0)
+                normal = -normal;
+            if (normal.dot(offset) < -radius)
+                return false;
+        }
+        return true;
+    }
+}
+
+// --- TileCache ---------------------------------------------------------------
+
+unsigned const TileCache::MaxEntries;
+
+TileCache::TileCache(Scene &scene, string const &directory)
+:
+    scene(scene),
+    directory(directory)
+{}
+
+double TileCache::render(AccumImage &img)
+{
+    if (scene.wavefront || scene.irradiance || scene.photons
+        || scene.integrator != Scene::Integrator::Whitted)
+    {
+        // only the recursive Whitted renderer records what the tiles depend on
+        cout << "The tile cache needs the recursive Whitted renderer without an irradiance "
+                "cache or photon map, rendering without it.\n";
+        scene.render(img);
+        return 0;
+    }
+    if (scene.camera.moves())
+    {
+        // the tiles' pyramids of rays are those of the camera at rest
+        cout << "The tile cache needs a camera at rest, rendering without it.\n";
+        scene.render(img);
+        return 0;
+    }
+
+    mkdir(directory.c_str(), 0777);     // may exist
+    hashScene();
+
+    vector<Tile> tiles = scene.tiles();
+    vector<Tile> todo;
+    for (Tile const &tile : tiles)
+        if (!reuse(tile, img))
+            todo.push_back(tile);
+
+    vector<TileDependencies> dependencies;
+    scene.setDependencies(&dependencies);
+    scene.renderTiles(img, todo, 0, scene.getSamplesPerPixel(), Scene::Clock::time_point::max());
+    scene.setDependencies(nullptr);
+    for (size_t idx = 0; idx != todo.size(); ++idx)
+        store(todo[idx], dependencies[idx], img);
+
+    size_t reused = tiles.size() - todo.size();
+    double fraction = tiles.empty() ? 0 : double(reused) / tiles.size();
+    cout << "Tile cache: " << reused << " of " << tiles.size() << " tiles reused ("
+         << 100 * fraction << "%), " << todo.size() << " rendered.\n";
+    return fraction;
+}
+
+// Everything a tile's pixels are a function of, hashed once per render
+void TileCache::hashScene()
+{
+    Camera const &camera = scene.camera;
+    Sampler const &sampler = *scene.sampler;
+    Hasher hash;
+    hash.add(Version).add(sizeof(Real));
+    hash.add(camera.eye()).add(camera.right()).add(camera.up()).add(camera.filmPoint(0, 0));
+    hash.add(string(typeid(sampler).name())).add(sampler.samples).add(sampler.seed);
+    hash.add(scene.shadows).add(scene.recursionDepth).add(scene.throughputEpsilon)
+        .add(scene.russianRoulette).add(scene.differentials).add(FastMath::precision);
+    settings = hash.value();
+
+    Hasher lightHash;
+    for (LightPtr const &light : scene.lights)
+        light->hash(lightHash);
+    lights = lightHash.value();
+
+    map<Texture const *, uint64_t> digests;
+    geometry.clear();
+    material.clear();
+    present.clear();
+    added.clear();
+    for (ObjectPtr const &obj : scene.objects)
+    {
+        Hasher shape;
+        shape.add(string(typeid(*obj).name()));
+        obj->hashGeometry(shape);
+        geometry.push_back(shape.value());
+
+        Material const &mat = obj->material;
+        Hasher look;
+        look.add(mat.color).add(mat.textured).add(mat.ka).add(mat.kd).add(mat.ks).add(mat.n);
+        if (mat.textured)
+        {
+            auto digest = digests.find(mat.texture.get());
+            if (digest == digests.end())
+                digest = digests.emplace(mat.texture.get(), mat.texture->digest()).first;
+            look.add(digest->second);
+        }
+        material.push_back(look.value());
+        present.emplace(geometry.back(), material.back());
+    }
+
+    vector<uint64_t> sorted = geometry;
+    sort(sorted.begin(), sorted.end());
+    Hasher sceneHash;
+    sceneHash.add(sorted.data(), sorted.size() * sizeof(uint64_t));
+    sceneGeometry = sceneHash.value();
+
+    string filename = path(sceneGeometry, "scene");
+    if (!exists(filename))
+        replace(filename, [&](ostream &out)
+        {
+            put(out, uint64_t(sorted.size()));
+            out.write(reinterpret_cast<char const *>(sorted.data()), sorted.size() * sizeof(uint64_t));
+        });
+}
+
+uint64_t TileCache::key(Tile const &tile) const
+{
+    return Hasher().add(settings).add(tile).value();
+}
+
+bool TileCache::valid(Entry const &entry, Tile const &tile)
+{
+    if (entry.shaded && entry.lights != lights)
+        return false;
+    for (auto const &object : entry.objects)
+        if (present.count(object) == 0)
+            return false;
+
+    for (size_t idx : addedSince(entry.sceneGeometry))
+    {
+        Point center;
+        Real radius;
+        if (entry.escaped || !scene.objects[idx]->bounds(center, radius))
+            return false;
+        // some slack for the hit points, which are moved off the surface
+        radius += Real(1e-4) * (radius + (center - scene.camera.eye()).length());
+        if (touches(center, radius, entry.lower, entry.upper)
+            || touches(center, radius, scene.camera, tile))
+            return false;
+    }
+    return true;
+}
+
+// Objects whose geometry was not in the earlier scene; all of them if that
+// scene is not in the cache
+vector<size_t> const &TileCache::addedSince(uint64_t earlier)
+{
+    auto cached = added.find(earlier);
+    if (cached != added.end())
+        return cached->second;
+
+    vector<uint64_t> before;
+    ifstream file(path(earlier, "scene"), ios::binary);
+    uint64_t count = 0;
+    if (get(file, count))
+    {
+        before.resize(count);
+        if (!file.read(reinterpret_cast<char *>(before.data()), count * sizeof(uint64_t)))
+            before.clear();
+    }
+
+    vector<size_t> &objects = added[earlier];
+    for (size_t idx = 0; idx != geometry.size(); ++idx)
+        if (!binary_search(before.begin(), before.end(), geometry[idx]))
+            objects.push_back(idx);
+    return objects;
+}
+
+bool TileCache::reuse(Tile const &tile, AccumImage &img)
+{
+    Tile const &crop = scene.camera.crop();
+    for (Entry const &entry : readIndex(key(tile)))
+    {
+        if (!valid(entry, tile))
+            continue;
+
+        ifstream file(path(entry.content, "pixels"), ios::binary);
+        uint32_t width = 0;
+        uint32_t height = 0;
+        if (!get(file, width) || !get(file, height)
+            || width != tile.width() || height != tile.height())
+            continue;
+        vector<RgbSum> pixels(size_t(width) * height);
+        if (!file.read(reinterpret_cast<char *>(pixels.data()), pixels.size() * sizeof(RgbSum)))
+            continue;
+        for (unsigned y = 0; y != height; ++y)
+            copy(pixels.begin() + y * width, pixels.begin() + (y + 1) * width,
+                 img.row(tile.y0 + y - crop.y0) + (tile.x0 - crop.x0));
+        return true;
+    }
+    return false;
+}
+
+void TileCache::store(Tile const &tile, TileDependencies const &dependencies,
+                      AccumImage const &img)
+{
+    Entry entry;
+    entry.sceneGeometry = sceneGeometry;
+    entry.lights = lights;
+    entry.shaded = dependencies.shaded;
+    entry.escaped = dependencies.escaped;
+    entry.lower = dependencies.lower;
+    entry.upper = dependencies.upper;
+    for (size_t idx = 0; idx != dependencies.objects.size(); ++idx)
+        if (dependencies.objects[idx])
+            entry.objects.emplace_back(geometry[idx], material[idx]);
+    sort(entry.objects.begin(), entry.objects.end());
+    entry.objects.erase(unique(entry.objects.begin(), entry.objects.end()), entry.objects.end());
+
+    uint64_t tileKey = key(tile);
+    Hasher content;
+    content.add(tileKey).add(entry.shaded ? lights : 0).add(entry.escaped);
+    content.add(entry.objects.data(), entry.objects.size() * sizeof(entry.objects[0]));
+    entry.content = content.value();
+
+    string pixels = path(entry.content, "pixels");
+    if (!exists(pixels))
+    {
+        Tile const &crop = scene.camera.crop();
+        replace(pixels, [&](ostream &out)
+        {
+            put(out, uint32_t(tile.width()));
+            put(out, uint32_t(tile.height()));
+            for (unsigned y = tile.y0; y != tile.y1; ++y)
+                out.write(reinterpret_cast<char const *>(img.row(y - crop.y0) + (tile.x0 - crop.x0)),
+                          tile.width() * sizeof(RgbSum));
+        });
+    }
+
+    // The latest renders of the tile, newest first. Equal pixels rendered
+    // in another scene stay, they may be valid for other changes
+    vector<Entry> entries = readIndex(tileKey);
+    entries.erase(remove_if(entries.begin(), entries.end(), [&](Entry const &old)
+    {
+        return old.content == entry.content && old.sceneGeometry == entry.sceneGeometry;
+    }), entries.end());
+    entries.insert(entries.begin(), entry);
+    if (entries.size() > MaxEntries)
+        entries.resize(MaxEntries);
+    writeIndex(tileKey, entries);
+}
+
+string TileCache::path(uint64_t hash, char const *extension) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return directory + '/' + name + '.' + extension;
+}
+
+vector<TileCache::Entry> TileCache::readIndex(uint64_t key) const
+{
+    vector<Entry> entries;
+    ifstream file(path(key, "index"), ios::binary);
+    char magic[8];
+    uint32_t version = 0;
+    uint32_t count = 0;
+    if (!file.read(magic, 8) || !equal(Magic, Magic + 8, magic)
+        || !get(file, version) || version != Version || !get(file, count))
+        return entries;
+
+    for (uint32_t idx = 0; idx != count; ++idx)
+    {
+        Entry entry;
+        uint32_t objects = 0;
+        if (!get(file, entry.content) || !get(file, entry.sceneGeometry) || !get(file, entry.lights)
+            || !get(file, entry.shaded) || !get(file, entry.escaped)
+            || !getPoint(file, entry.lower) || !getPoint(file, entry.upper)
+            || !get(file, objects))
+            break;
+        entry.objects.resize(objects);
+        if (!file.read(reinterpret_cast<char *>(entry.objects.data()),
+                       objects * sizeof(entry.objects[0])))
+            break;
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+void TileCache::writeIndex(uint64_t key, vector<Entry> const &entries) const
+{
+    replace(path(key, "index"), [&](ostream &out)
+    {
+        out.write(Magic, 8);
+        put(out, Version);
+        put(out, uint32_t(entries.size()));
+        for (Entry const &entry : entries)
+        {
+            put(out, entry.content);
+            put(out, entry.sceneGeometry);
+            put(out, entry.lights);
+            put(out, entry.shaded);
+            put(out, entry.escaped);
+            putPoint(out, entry.lower);
+            putPoint(out, entry.upper);
+            put(out, uint32_t(entry.objects.size()));
+            out.write(reinterpret_cast<char const *>(entry.objects.data()),
+                      entry.objects.size() * sizeof(entry.objects[0]));
+        }
+    });
+}
@@ -0,0 +1,86 @@
+#ifndef TILECACHE_H_
+#define TILECACHE_H_
+
+#include "camera.h"
+#include "image.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Scene;
+struct TileDependencies;
+
+// On-disk cache of rendered tiles, so that a render after a small change of
+// the scene only traces the tiles the change can affect.
+//
+// A tile is looked up by its key: the hash of everything its camera rays
+// depend on (camera, sampler, render settings and the tile's pixels). Under
+// the key, the cache keeps the dependencies of the last renders of the tile:
+// the geometry and material hashes of the objects its rays hit, the hash
+// of the lights if they were evaluated, and the bounds of its secondary
+// rays. A cached tile is reused when
+//   - every object it hit is still in the scene, unchanged,
+//   - the lights are unchanged (if it was lit),
+//   - no object whose geometry is new to the scene can be hit by its rays:
+//     the object's bounding sphere is outside the tile's view frustum and
+//     the bounds of its secondary rays (and no reflected ray escaped).
+// The pixels are stored under the hash of the key and the dependencies, so
+// equal tiles of different renders share a file. Only the recursive
+// renderer records dependencies.
+class TileCache
+{
+    public:
+        static unsigned const MaxEntries = 4;   // per key, the latest
+
+        // Hashes of what a tile depended on, stored under its key
+        struct Entry
+        {
+            uint64_t content;           // names the pixel file
+            uint64_t sceneGeometry;     // names the list of geometry hashes
+            uint64_t lights;
+            bool shaded;
+            bool escaped;
+            Point lower;
+            Point upper;
+            std::vector<std::pair<uint64_t, uint64_t>> objects;  // geometry, material
+        };
+
+    private:
+        Scene &scene;
+        std::string directory;
+
+        // Of the scene being rendered
+        uint64_t settings;
+        uint64_t lights;
+        uint64_t sceneGeometry;
+        std::vector<uint64_t> geometry;             // per object
+        std::vector<uint64_t> material;
+        std::set<std::pair<uint64_t, uint64_t>> present;
+        std::map<uint64_t, std::vector<size_t>> added;  // per earlier scene
+
+    public:
+        TileCache(Scene &scene, std::string const &directory);
+
+        // Renders img (the crop window), reusing the valid cached tiles and
+        // storing the others; returns the fraction of tiles reused
+        double render(AccumImage &img);
+
+    private:
+        void hashScene();
+        uint64_t key(Tile const &tile) const;
+        bool valid(Entry const &entry, Tile const &tile);
+        std::vector<size_t> const &addedSince(uint64_t earlier);
+        bool reuse(Tile const &tile, AccumImage &img);
+        void store(Tile const &tile, TileDependencies const &dependencies,
+                   AccumImage const &img);
+
+        std::string path(uint64_t hash, char const *extension) const;
+        std::vector<Entry> readIndex(uint64_t key) const;
+        void writeIndex(uint64_t key, std::vector<Entry> const &entries) const;
+};
+
+#endif
@@ -3,15 +3,30 @@
 
 #include "json/json_fwd.h"
 
+#include <cmath>
 #include <iosfwd>
 
+// The scalar type of the tracer: double, or float when configured with
+// -DRAY_PRECISION=float (see CMakeLists.txt)
+#ifdef RAY_SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 // Color, Point and Vector are all Triples (name them so)
-class Triple;
+template <typename T>
+class TripleT;
+
+typedef TripleT<Real> Triple;
 typedef Triple Color;
 typedef Triple Point;
 typedef Triple Vector;
 
-class Triple
+// Everything but the JSON constructor and the IO operators is defined
+// in this header so that it can be inlined
+template <typename T>
+class TripleT
 {
     public:
 // --- data members ------------------------------------------------------------
@@ -19,82 +34,229 @@ class Triple
         // union to acces the same elements by
         // x, y, z, or r, g, b or data[index]
         union {
-            double data[3];
+            T data[3];
             struct {
-                double x;
-                double y;
-                double z;
+                T x;
+                T y;
+                T z;
             };
             struct {
-                double r;
-                double g;
-                double b;
+                T r;
+                T g;
+                T b;
             };
         };
 
 // --- Constructors ------------------------------------------------------------
 
-        explicit Triple(double X = 0, double Y = 0, double Z = 0);
-        explicit Triple(nlohmann::json const &node);    // json -> Triple
+        explicit TripleT(T X = 0, T Y = 0, T Z = 0)
+        :
+            x(X),
+            y(Y),
+            z(Z)
+        {}
+
+        template <typename U>                   // float <-> double
+        explicit TripleT(TripleT<U> const &t)
+        :
+            x(static_cast<T>(t.x)),
+            y(static_cast<T>(t.y)),
+            z(static_cast<T>(t.z))
+        {}
+
+        explicit TripleT(nlohmann::json const &node);   // json -> Triple
 
 // --- Operators ---------------------------------------------------------------
 
-        Triple operator+(Triple const &t) const;// add two triples
-        Triple operator+(double f) const;       // add a value to each member
-                                                // of a triple
-        Triple operator-() const;               // negate
-        Triple operator-(Triple const &t) const;// subtract two triples
-        Triple operator-(double f) const;       // subtract a value from each
-                                                // member
+        TripleT operator+(TripleT const &t) const   // add two triples
+        {
+            return TripleT(x + t.x, y + t.y, z + t.z);
+        }
+
+        TripleT operator+(T f) const    // add a value to each member of a
+        {                               // triple
+            return TripleT(x + f, y + f, z + f);
+        }
 
-        Triple operator*(Triple const &t) const;// memberwise multiplication
-        Triple operator*(double f) const;       // multiply each member with a
-                                                // value
-        Triple operator/(double f) const;       // divide each member by a value
+        TripleT operator-() const       // negate
+        {
+            return TripleT(-x, -y, -z);
+        }
+
+        TripleT operator-(TripleT const &t) const   // subtract two triples
+        {
+            return TripleT(x - t.x, y - t.y, z - t.z);
+        }
+
+        TripleT operator-(T f) const    // subtract a value from each member
+        {
+            return TripleT(x - f, y - f, z - f);
+        }
+
+        TripleT operator*(TripleT const &t) const   // memberwise multiplication
+        {
+            return TripleT(x * t.x, y * t.y, z * t.z);
+        }
+
+        TripleT operator*(T f) const    // multiply each member with a value
+        {
+            return TripleT(x * f, y * f, z * f);
+        }
+
+        TripleT operator/(T f) const    // divide each member by a value
+        {
+            T invf = 1 / f;
+            return TripleT(x * invf, y * invf, z * invf);
+        }
 
 // --- Compound operators ------------------------------------------------------
 
-        Triple &operator+=(Triple const &t);
-        Triple &operator+=(double f);
+        TripleT &operator+=(TripleT const &t)
+        {
+            x += t.x;
+            y += t.y;
+            z += t.z;
+            return *this;
+        }
+
+        TripleT &operator+=(T f)
+        {
+            x += f;
+            y += f;
+            z += f;
+            return *this;
+        }
 
-        Triple &operator-=(Triple const &t);
-        Triple &operator-=(double f);
+        TripleT &operator-=(TripleT const &t)
+        {
+            x -= t.x;
+            y -= t.y;
+            z -= t.z;
+            return *this;
+        }
 
-        Triple &operator*=(double f);
-        Triple &operator/=(double f);
+        TripleT &operator-=(T f)
+        {
+            x -= f;
+            y -= f;
+            z -= f;
+            return *this;
+        }
+
+        TripleT &operator*=(T f)
+        {
+            x *= f;
+            y *= f;
+            z *= f;
+            return *this;
+        }
+
+        TripleT &operator/=(T f)
+        {
+            T invf = 1 / f;
+            x *= invf;
+            y *= invf;
+            z *= invf;
+            return *this;
+        }
 
 // --- Vector Operators --------------------------------------------------------
 
-        double dot(Triple const &t) const;      // dot product
-        Triple cross(Triple const &t) const;    // cross product
+        T dot(TripleT const &t) const           // dot product
+        {
+            return x * t.x + y * t.y + z * t.z;
+        }
+
+        TripleT cross(TripleT const &t) const   // cross product
+        {
+            return TripleT(y*t.z - z*t.y,
+                           z*t.x - x*t.z,
+                           x*t.y - y*t.x);
+        }
 
-        double length() const;
-        double length_2() const;                // length squared
+        T length() const
+        {
+            return std::sqrt(length_2());
+        }
+
+        T length_2() const                      // length squared
+        {
+            return x * x + y * y + z * z;
+        }
 
         // NOTE: normalized return a COPY, normalize does NOT
-        Triple normalized() const;              // normalized COPY
-        void normalize();                       // normalize THIS
+        TripleT normalized() const              // normalized COPY
+        {
+            return (*this) / length();
+        }
+
+        void normalize()                        // normalize THIS
+        {
+            T invlen = 1 / length();
+            x *= invlen;
+            y *= invlen;
+            z *= invlen;
+        }
 
 // --- Color functions ---------------------------------------------------------
 
-        void set(double f);                     // set all values to f
-        void set(double f, double maxValue);    // set all values to f / maxVal
-        void set(double red, double green, double blue);
-        void set(double red, double green, double blue, double maxValue);
+        void set(T f)                           // set all values to f
+        {
+            r = f;
+            g = f;
+            b = f;
+        }
 
-        void clamp(double maxValue = 1.0);      // clamp: fmin(val, maxValue)
+        void set(T f, T maxValue)               // set all values to f / maxVal
+        {
+            set(f / maxValue);
+        }
 
-};
+        void set(T red, T green, T blue)
+        {
+            r = red;
+            g = green;
+            b = blue;
+        }
+
+        void set(T red, T green, T blue, T maxValue)
+        {
+            set(red / maxValue, green / maxValue, blue / maxValue);
+        }
+
+        void clamp(T maxValue = 1)              // clamp: fmin(val, maxValue)
+        {
+            r = std::fmin(r, maxValue);
+            g = std::fmin(g, maxValue);
+            b = std::fmin(b, maxValue);
+        }
 
 // --- Free Operators ----------------------------------------------------------
 
-Triple operator+(double f, Triple const &t);
-Triple operator-(double f, Triple const &t);
-Triple operator*(double f, Triple const &t);
+        // NOTE: friends defined in the class are no templates, so mixed
+        // arguments such as 2 * Vector still convert to T
+        friend TripleT operator+(T f, TripleT const &t)
+        {
+            return TripleT(f + t.x, f + t.y, f + t.z);
+        }
+
+        friend TripleT operator-(T f, TripleT const &t)
+        {
+            return TripleT(f - t.x, f - t.y, f - t.z);
+        }
+
+        friend TripleT operator*(T f, TripleT const &t)
+        {
+            return TripleT(f * t.x, f * t.y, f * t.z);
+        }
+};
 
 // --- IO Operators ------------------------------------------------------------
 
-std::istream &operator>>(std::istream &is, Triple &t);
-std::ostream &operator<<(std::ostream &os, Triple const &t);
+template <typename T>
+std::istream &operator>>(std::istream &is, TripleT<T> &t);
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, TripleT<T> const &t);
 
 #endif
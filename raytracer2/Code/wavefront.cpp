@@ -0,0 +1,469 @@
+#include "wavefront.h"
+
+#include "fastmath.h"
+#include "hit.h"
+#include "image.h"
+#include "material.h"
+#include "parallel.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    // Samples processed as one batch: a 64x64 tile at 4 samples per pixel.
+    // The queues of a batch take about 700 bytes per sample.
+    size_t const BatchSamples = 16384;
+}
+
+// --- Queues ------------------------------------------------------------------
+
+void RayQueue::resize(size_t size)
+{
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &time, &nx, &ny, &nz, &vx, &vy, &vz})
+        v->resize(size);
+    for (auto *v : {&weight, &throughput, &shininess})
+        v->resize(size);
+    sample.resize(size);
+    parent.resize(size);
+    differential.resize(size);
+}
+
+Ray RayQueue::ray(size_t idx) const
+{
+    return Ray(Point(ox[idx], oy[idx], oz[idx]),
+               Vector(dx[idx], dy[idx], dz[idx]), time[idx]);
+}
+
+void RayQueue::setRay(size_t idx, Ray const &ray)
+{
+    ox[idx] = ray.O.x;
+    oy[idx] = ray.O.y;
+    oz[idx] = ray.O.z;
+    dx[idx] = ray.D.x;
+    dy[idx] = ray.D.y;
+    dz[idx] = ray.D.z;
+    time[idx] = ray.time;
+}
+
+void RayQueue::gather(RayQueue const &from, vector<unsigned> const &order)
+{
+    resize(order.size());
+    for (size_t pos = 0; pos != order.size(); ++pos)
+    {
+        size_t idx = order[pos];
+        ox[pos] = from.ox[idx];
+        oy[pos] = from.oy[idx];
+        oz[pos] = from.oz[idx];
+        dx[pos] = from.dx[idx];
+        dy[pos] = from.dy[idx];
+        dz[pos] = from.dz[idx];
+        time[pos] = from.time[idx];
+        weight[pos] = from.weight[idx];
+        throughput[pos] = from.throughput[idx];
+        sample[pos] = from.sample[idx];
+        parent[pos] = from.parent[idx];
+        differential[pos] = from.differential[idx];
+        nx[pos] = from.nx[idx];
+        ny[pos] = from.ny[idx];
+        nz[pos] = from.nz[idx];
+        vx[pos] = from.vx[idx];
+        vy[pos] = from.vy[idx];
+        vz[pos] = from.vz[idx];
+        shininess[pos] = from.shininess[idx];
+    }
+}
+
+void HitQueue::resize(size_t size)
+{
+    for (auto *v : {&t, &nx, &ny, &nz, &refT})
+        v->resize(size);
+    obj.resize(size);
+    refObj.resize(size);
+    ambient.resize(size);
+}
+
+void ShadowQueue::resize(size_t size)
+{
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &time})
+        v->resize(size);
+    target.resize(size);
+    lit.resize(size);
+    diffuse.resize(size);
+    phong.resize(size);
+    shininess.resize(size);
+}
+
+void ShadowQueue::gather(ShadowQueue const &from, vector<unsigned> const &order)
+{
+    resize(order.size());
+    for (size_t pos = 0; pos != order.size(); ++pos)
+    {
+        size_t idx = order[pos];
+        ox[pos] = from.ox[idx];
+        oy[pos] = from.oy[idx];
+        oz[pos] = from.oz[idx];
+        dx[pos] = from.dx[idx];
+        dy[pos] = from.dy[idx];
+        dz[pos] = from.dz[idx];
+        time[pos] = from.time[idx];
+        target[pos] = from.target[idx];
+    }
+}
+
+// --- Wavefront ---------------------------------------------------------------
+
+Wavefront::Wavefront(Scene &scene)
+:
+    scene(scene),
+    sorter(scene.sortBatchSize)
+{}
+
+void Wavefront::render(AccumImage &img, Tile const &tile, unsigned first, unsigned last)
+{
+    // Same sample order as Scene::renderTile, batch after batch
+    size_t const perPixel = last - first;
+    size_t const count = size_t(tile.width()) * tile.height() * perPixel;
+    Tile const &crop = scene.camera.crop();
+    for (size_t begin = 0; begin < count; begin += BatchSamples)
+    {
+        size_t size = min(BatchSamples, count - begin);
+        sampleX.resize(size);
+        sampleY.resize(size);
+        sampleIndex.resize(size);
+        for (size_t idx = 0; idx != size; ++idx)
+        {
+            size_t pixel = (begin + idx) / perPixel;
+            sampleX[idx] = tile.x0 + pixel % tile.width();
+            sampleY[idx] = tile.y0 + pixel / tile.width();
+            sampleIndex[idx] = first + (begin + idx) % perPixel;
+        }
+
+        generate();
+        for (int depth = 0; rays.size() != 0; ++depth)
+        {
+            intersectClosest(depth);
+            weighReflections();
+            shade();
+            if (scene.shadows)
+                intersectAnyHit();
+            emitReflections(depth);
+            swap(rays, nextRays);
+        }
+
+        for (size_t idx = 0; idx != size; ++idx)
+        {
+            Color col = sampleColor[idx];
+            col.clamp();
+            img(sampleX[idx] - crop.x0, sampleY[idx] - crop.y0).add(col);
+        }
+    }
+}
+
+// Fill the ray queue with the primary rays of all samples
+void Wavefront::generate()
+{
+    size_t count = sampleX.size();
+    rays.resize(count);
+    sampleColor.assign(count, Color(0, 0, 0));
+    Vector dx, dy;
+    scene.sampleSpacing(dx, dy);
+    parallelFor(count, [&](size_t first, size_t last)
+    {
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            Vector toPixel;
+            rays.setRay(idx, scene.primaryRay(sampleX[idx], sampleY[idx], sampleIndex[idx],
+                                              toPixel));
+            rays.weight[idx] = 1.0;
+            rays.throughput[idx] = 1.0;
+            rays.sample[idx] = idx;
+            rays.parent[idx] = -1;
+            rays.differential[idx] = scene.differentials
+                ? RayDifferential::primary(toPixel, dx, dy) : RayDifferential();
+        }
+    });
+    Scene::counts().primary += count;
+}
+
+// Closest hit of every ray, plus the closest hit that is not on the object
+// the ray leaves (used to weigh reflections), found as Scene::reflectRay
+// does. Primary rays are coherent already, only secondary rays are sorted.
+// The later stages reach a ray's sample through RayQueue::sample, so they
+// do not mind the new order.
+void Wavefront::intersectClosest(int depth)
+{
+    vector<ObjectPtr> const &objects = scene.objects;
+    double const inf = numeric_limits<double>::infinity();
+
+    if (depth != 0 && sorter.sorts())
+    {
+        sorter.order(rayOrder, rays.ox, rays.oy, rays.oz, rays.dx, rays.dy, rays.dz);
+        sortedRays.gather(rays, rayOrder);
+        swap(rays, sortedRays);
+    }
+
+    hits.resize(rays.size());
+    parallelFor(rays.size(), [&](size_t first, size_t last)
+    {
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            Ray ray = rays.ray(idx);
+            Hit hit(inf, Vector());
+            unsigned index = 0;
+            ObjectPtr obj = scene.intersect(ray, hit, index);
+            hits.t[idx] = hit.t;
+            hits.obj[idx] = obj ? int(index) : -1;
+            hits.nx[idx] = hit.N.x;
+            hits.ny[idx] = hit.N.y;
+            hits.nz[idx] = hit.N.z;
+
+            int parent = rays.parent[idx];
+            if (!obj || int(index) != parent)
+            {
+                hits.refT[idx] = hit.t;
+                hits.refObj[idx] = hits.obj[idx];
+                continue;
+            }
+            Hit other(inf, Vector());
+            ObjectPtr refObj = scene.intersect(ray, other, index, objects[parent].get());
+            hits.refT[idx] = other.t;
+            hits.refObj[idx] = refObj ? int(index) : -1;
+        }
+    });
+}
+
+// A reflected ray acts as a light on its parent hit, placed at the closest
+// hit on another object: scale the ray by the specular term of that light
+void Wavefront::weighReflections()
+{
+    parallelFor(rays.size(), [&](size_t first, size_t last)
+    {
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            if (rays.parent[idx] < 0)
+                continue;
+
+            if (hits.refObj[idx] < 0)
+            {
+                hits.obj[idx] = -1;     // no contribution at all
+                continue;
+            }
+
+            Ray ray = rays.ray(idx);
+            Vector N(rays.nx[idx], rays.ny[idx], rays.nz[idx]);
+            Vector V(rays.vx[idx], rays.vy[idx], rays.vz[idx]);
+            Vector L = (ray.at(hits.refT[idx]) - ray.O).normalized();
+            Vector R = 2 * (N.dot(L)) * N - L;
+            double specular = FastMath::pow(fmax(0, V.dot(R)), rays.shininess[idx]);
+            rays.weight[idx] *= specular;
+            rays.throughput[idx] *= specular;
+        }
+    });
+}
+
+// Ambient term of every hit, and the diffuse and specular terms of every
+// light together with the shadow ray that decides whether they count
+void Wavefront::shade()
+{
+    vector<ObjectPtr> const &objects = scene.objects;
+    vector<LightPtr> const &lights = scene.lights;
+    size_t numLights = lights.size();
+    bool shadows = scene.shadows;
+
+    shadowRays.resize(rays.size() * numLights);
+    parallelFor(rays.size(), [&](size_t first, size_t last)
+    {
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            int obj = hits.obj[idx];
+            if (obj < 0)
+            {
+                for (size_t l = 0; l != numLights; ++l)
+                {
+                    shadowRays.target[idx * numLights + l] = -1;
+                    shadowRays.lit[idx * numLights + l] = false;
+                    shadowRays.phong[idx * numLights + l] = 0;
+                    shadowRays.shininess[idx * numLights + l] = 1;
+                }
+                continue;
+            }
+
+            Material &material = objects[obj]->material;
+            Ray ray = rays.ray(idx);
+            Point hit = ray.at(hits.t[idx] - Hit::offset());
+            Vector N(hits.nx[idx], hits.ny[idx], hits.nz[idx]);
+            Vector V = -ray.D;
+
+            // a moving object is textured where the hit is at rest
+            Color color = material.color;
+            if (material.isTextured() && scene.differentials)
+            {
+                Vector dPdx, dPdy;
+                rays.differential[idx].transfer(ray, hits.t[idx], N, dPdx, dPdy);
+                color = objects[obj]->textureColorAt(objects[obj]->atRest(hit, ray.time), dPdx,
+                                                     dPdy, objects[obj]->isRotated());
+            }
+            else if (material.isTextured())
+                color = objects[obj]->textureColorAt(objects[obj]->atRest(hit, ray.time),
+                                                     objects[obj]->isRotated());
+
+            hits.ambient[idx] = color * material.ka;
+
+            for (size_t l = 0; l != numLights; ++l)
+            {
+                Light const &light = *lights[l];
+                size_t slot = idx * numLights + l;
+                Vector L = (light.position - hit).normalized();
+                Vector R = 2 * N.dot(L) * N - L;
+
+                shadowRays.diffuse[slot] = fmax(0, L.dot(N.normalized())) * color * light.color * material.kd;
+                shadowRays.phong[slot] = fmax(0, R.dot(V));
+                shadowRays.shininess[slot] = material.n;
+
+                shadowRays.ox[slot] = light.position.x;
+                shadowRays.oy[slot] = light.position.y;
+                shadowRays.oz[slot] = light.position.z;
+                shadowRays.dx[slot] = -L.x;
+                shadowRays.dy[slot] = -L.y;
+                shadowRays.dz[slot] = -L.z;
+                shadowRays.time[slot] = ray.time;
+                shadowRays.target[slot] = obj;
+                shadowRays.lit[slot] = !shadows;
+            }
+        }
+
+        // raise the specular terms of the whole chunk at once
+        size_t begin = first * numLights;
+        FastMath::pow(&shadowRays.phong[begin], &shadowRays.shininess[begin],
+                      &shadowRays.phong[begin], (last - first) * numLights);
+    });
+}
+
+// A light reaches a hit if the shadow ray from the light hits the target
+// object first, as in Scene::reaches
+void Wavefront::intersectAnyHit()
+{
+    double const inf = numeric_limits<double>::infinity();
+    unsigned long long cast = 0;
+
+    for (int target : shadowRays.target)
+        cast += target >= 0;
+
+    // the results go back to the slots in shadowRays that emitReflections reads
+    bool const sorts = sorter.sorts();
+    if (sorts)
+    {
+        sorter.order(shadowOrder, shadowRays.ox, shadowRays.oy, shadowRays.oz,
+                     shadowRays.dx, shadowRays.dy, shadowRays.dz);
+        sortedShadowRays.gather(shadowRays, shadowOrder);
+    }
+    ShadowQueue const &queue = sorts ? sortedShadowRays : shadowRays;
+    parallelFor(queue.size(), [&](size_t first, size_t last)
+    {
+        for (size_t pos = first; pos != last; ++pos)
+        {
+            int target = queue.target[pos];
+            if (target < 0)
+                continue;
+
+            Ray ray(Point(queue.ox[pos], queue.oy[pos], queue.oz[pos]),
+                    Vector(queue.dx[pos], queue.dy[pos], queue.dz[pos]), queue.time[pos]);
+            Hit hit(inf, Vector());
+            unsigned index = 0;
+            bool lit = scene.intersect(ray, hit, index) && int(index) == target;
+            shadowRays.lit[sorts ? shadowOrder[pos] : pos] = lit;
+        }
+    });
+    Scene::counts().shadow += cast;
+}
+
+// Add the shaded hits to their samples and queue a reflected ray for every
+// hit that is reached by at least one light
+void Wavefront::emitReflections(int depth)
+{
+    vector<ObjectPtr> const &objects = scene.objects;
+    vector<LightPtr> const &lights = scene.lights;
+    size_t numLights = lights.size();
+    vector<unsigned> litCount(rays.size());
+
+    parallelFor(rays.size(), [&](size_t first, size_t last)
+    {
+        for (size_t idx = first; idx != last; ++idx)
+        {
+            if (hits.obj[idx] < 0)
+                continue;
+
+            Material const &material = objects[hits.obj[idx]]->material;
+            Color Id(0, 0, 0);
+            Color Is(0, 0, 0);
+            for (size_t l = 0; l != numLights; ++l)
+            {
+                size_t slot = idx * numLights + l;
+                if (!shadowRays.lit[slot])
+                    continue;
+                Id += shadowRays.diffuse[slot];
+                Is += shadowRays.phong[slot] * lights[l]->color * material.ks;
+                ++litCount[idx];
+            }
+            sampleColor[rays.sample[idx]] += rays.weight[idx] * (hits.ambient[idx] + Id + Is);
+        }
+    });
+
+    nextRays.resize(0);
+    if (depth >= scene.recursionDepth)
+        return;
+
+    for (size_t idx = 0; idx != rays.size(); ++idx)
+    {
+        if (litCount[idx] == 0)
+            continue;
+
+        Material const &material = objects[hits.obj[idx]]->material;
+        if (material.ks <= 0)
+            continue;
+
+        Ray ray = rays.ray(idx);
+        Point hit = ray.at(hits.t[idx] - Hit::offset());
+        Vector N(hits.nx[idx], hits.ny[idx], hits.nz[idx]);
+        Vector R = 2 * (N.dot(-ray.D)) * N + ray.D;
+        R.normalize();
+        Ray reflectedRay(hit, R, ray.time);
+
+        // same termination rule as Scene::reflectRay
+        double throughput = rays.throughput[idx] * material.ks * material.ks;
+        double weight;
+        if (!scene.survives(reflectedRay, throughput, weight))
+            continue;
+
+        size_t next = nextRays.size();
+        nextRays.resize(next + 1);
+        nextRays.setRay(next, reflectedRay);
+        nextRays.weight[next] = rays.weight[idx] * material.ks * material.ks * litCount[idx] * weight;
+        nextRays.throughput[next] = throughput;
+        nextRays.sample[next] = rays.sample[idx];
+        nextRays.parent[next] = hits.obj[idx];
+        nextRays.nx[next] = N.x;
+        nextRays.ny[next] = N.y;
+        nextRays.nz[next] = N.z;
+        nextRays.vx[next] = -ray.D.x;
+        nextRays.vy[next] = -ray.D.y;
+        nextRays.vz[next] = -ray.D.z;
+        nextRays.shininess[next] = material.n;
+        if (scene.differentials)
+        {
+            Vector dPdx, dPdy;
+            RayDifferential const &diff = rays.differential[idx];
+            diff.transfer(ray, hits.t[idx], N, dPdx, dPdy);
+            ObjectPtr const &obj = objects[hits.obj[idx]];
+            nextRays.differential[next] = diff.reflect(ray, N, dPdx, dPdy,
+                                                       obj->normalDifferential(hit, dPdx),
+                                                       obj->normalDifferential(hit, dPdy));
+        }
+    }
+    Scene::counts().reflected += nextRays.size();
+}
@@ -0,0 +1,125 @@
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include "differential.h"
+#include "image.h"
+#include "ray.h"
+#include "raysorter.h"
+#include "triple.h"
+
+#include <vector>
+
+// Forward declerations
+class Scene;
+struct Tile;
+
+// Rays of one wave, stored as a structure of arrays
+struct RayQueue
+{
+    std::vector<Real> ox, oy, oz;       // origin
+    std::vector<Real> dx, dy, dz;       // direction
+    std::vector<Real> time;             // in the frame, see Ray
+    std::vector<double> weight;         // contribution to the sample color
+    std::vector<double> throughput;     // path weight, for early termination
+    std::vector<unsigned> sample;       // sample the ray belongs to
+    std::vector<int> parent;            // object the ray leaves, -1 if none
+    std::vector<RayDifferential> differential;  // when the scene needs them
+
+    // Data of the parent hit, needed to weigh a reflected ray once its
+    // own hit is known
+    std::vector<Real> nx, ny, nz;       // normal at the parent hit
+    std::vector<Real> vx, vy, vz;       // view vector at the parent hit
+    std::vector<double> shininess;      // specular exponent of the parent
+
+    void resize(size_t size);
+    size_t size() const { return ox.size(); };
+
+    Ray ray(size_t idx) const;
+    void setRay(size_t idx, Ray const &ray);
+
+    // Become the rays of from in the given order
+    void gather(RayQueue const &from, std::vector<unsigned> const &order);
+};
+
+// Closest hits of a RayQueue, index by index
+struct HitQueue
+{
+    std::vector<Real> t;
+    std::vector<int> obj;               // -1 if nothing was hit
+    std::vector<Real> nx, ny, nz;
+    std::vector<Real> refT;             // closest hit not on the parent
+    std::vector<int> refObj;
+    std::vector<Color> ambient;         // set by the shading stage
+
+    void resize(size_t size);
+};
+
+// Shadow rays, numLights consecutive rays per hit
+struct ShadowQueue
+{
+    std::vector<Real> ox, oy, oz;       // origin (the light)
+    std::vector<Real> dx, dy, dz;       // direction (towards the hit)
+    std::vector<Real> time;             // of the ray of the hit
+    std::vector<int> target;            // object that has to be hit first
+    std::vector<char> lit;              // result of the any-hit test
+    std::vector<Color> diffuse;         // contribution if lit
+    std::vector<double> phong;          // specular term: max(0, R.V)^n
+    std::vector<double> shininess;      // n, per ray for the array pow
+
+    void resize(size_t size);
+    size_t size() const { return ox.size(); };
+
+    // Become the rays (origin, direction, time and target) of from in the
+    // given order
+    void gather(ShadowQueue const &from, std::vector<unsigned> const &order);
+};
+
+// Breadth-first alternative to Scene::trace. The samples of a tile are
+// processed in batches of at most 16384, in the order of Scene::renderTile,
+// so the queues stay the same size whatever the samples per pixel. Each wave
+// of a batch passes through the stages generate, intersect closest, shade
+// (emitting shadow rays), intersect any-hit and emit reflections. Every stage
+// is a loop over a queue, run in parallel. Both intersection stages traverse
+// the scene's Bvh at the time of the ray, so their hits are those of
+// Scene::trace. With a RaySorter batch size, the secondary rays are moved
+// into its order before they are intersected, and shadow rays are intersected
+// from a sorted copy, so that the intersection loops read the queues front to
+// back.
+class Wavefront
+{
+    Scene &scene;
+    RaySorter sorter;
+
+    // Pixel and index of the samples and their accumulated color
+    std::vector<unsigned> sampleX;
+    std::vector<unsigned> sampleY;
+    std::vector<unsigned> sampleIndex;
+    std::vector<Color> sampleColor;
+
+    RayQueue rays;
+    RayQueue nextRays;
+    HitQueue hits;
+    ShadowQueue shadowRays;
+
+    // Sorting: the order of the RaySorter and the queues in that order
+    std::vector<unsigned> rayOrder;
+    std::vector<unsigned> shadowOrder;
+    RayQueue sortedRays;
+    ShadowQueue sortedShadowRays;
+
+    public:
+        Wavefront(Scene &scene);
+
+        // render samples [first, last) of the pixels of tile
+        void render(AccumImage &img, Tile const &tile, unsigned first, unsigned last);
+
+    private:
+        void generate();
+        void intersectClosest(int depth);
+        void weighReflections();
+        void shade();
+        void intersectAnyHit();
+        void emitReflections(int depth);
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "images.h"
+
+using namespace std;
+
+// Area lights, also in the path tracer, with one thread and seven, cropped
+// and resumed from a checkpoint
+bool testAreaLights()
+{
+    json scene = areaLights(load(Reflect));
+    string area = save(scene, "area");
+    scene["Integrator"] = "path";
+    string path = save(scene, "area-path");
+
+    bool passed = sameWithThreads(area, "area");
+    passed = sameWithThreads(path, "area-path") && passed;
+    passed = sameCropped(path, "area-path") && passed;
+    return sameResumed(path, "area-path") && passed;
+}
@@ -0,0 +1,52 @@
+#include "images.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+bool sameResumed(string const &scene, string const &name)
+{
+    string image = work + "/checkpoint-" + name + "-resumed.png";
+    string saved = image + ".checkpoint";
+    Options options = Small + Options{"--spp", "16"};
+
+    pid_t pid = start(options + Options{"--checkpoint", "0.001", scene, image});
+    struct stat info;
+    bool stopped = false;
+    while (!stopped)
+    {
+        if (stat(saved.c_str(), &info) == 0)
+        {
+            kill(pid, SIGKILL);
+            stopped = true;
+        }
+        else if (waitpid(pid, nullptr, WNOHANG) == pid)
+            break;
+        else
+            this_thread::sleep_for(chrono::milliseconds(2));
+    }
+    if (!stopped)
+    {
+        cout << "the render of " << name << " finished before its first checkpoint\n";
+        return false;
+    }
+    succeeded(pid);
+
+    string fresh = work + "/checkpoint-" + name + "-fresh.png";
+    return outcome(render(options + Options{"--resume"}, scene, image)
+                   && render(options, scene, fresh) && same(fresh, image),
+                   "resumed " + name);
+}
+
+// A render stopped after its first checkpoint and resumed, against one that
+// ran through
+bool testCheckpoint()
+{
+    return sameResumed(bundled(Reflect), "reflect");
+}
@@ -0,0 +1,35 @@
+#include "images.h"
+
+using namespace std;
+
+bool sameReshaded(json scene, string const &name)
+{
+    string buffer = work + '/' + name + ".gbuffer";
+
+    string original = save(scene, "gbuffer-" + name);
+    scene["Lights"][0]["color"] = {0.9, 0.3, 0.3};
+    scene["Objects"][2]["material"]["color"] = {0.1, 0.6, 1.0};
+    scene["Objects"][4]["material"]["ks"] = 0.1;
+    string edited = save(scene, "gbuffer-" + name + "-edited");
+
+    Options options = Small + Options{"--spp", "4"};
+    bool passed = true;
+    for (auto const &step : vector<pair<string, string>>{
+             {"captured", original}, {"re-shaded", edited}})
+    {
+        string reshaded = work + "/gbuffer-" + name + '-' + step.first + ".png";
+        string plain = work + "/gbuffer-" + name + '-' + step.first + "-fresh.png";
+        passed = outcome(render(options + Options{"--gbuffer", buffer}, step.second, reshaded)
+                         && render(options, step.second, plain) && same(plain, reshaded),
+                         "G-buffer " + name + ", " + step.first)
+                 && passed;
+    }
+    return passed;
+}
+
+// Re-shading from a G-buffer after light and material edits, against a
+// fresh render
+bool testGBuffer()
+{
+    return sameReshaded(load(Textured), "textured");
+}
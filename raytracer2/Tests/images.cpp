@@ -0,0 +1,161 @@
+#include "images.h"
+
+#include "image.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+string ray;
+string work;
+string baseline;
+
+string const Reflect = "scene01-reflect-lights-shadows";
+string const Textured = "scene01-texture-ss-reflect-lights-shadows";
+Options const Small = {"--resolution", "100"};
+
+Options operator+(Options one, Options const &other)
+{
+    one.insert(one.end(), other.begin(), other.end());
+    return one;
+}
+
+// --- Scenes ------------------------------------------------------------------
+
+json load(string const &name)
+{
+    ifstream file(name + ".json");
+    if (!file)
+        throw runtime_error("Could not read scene " + name + ".json.");
+    json scene;
+    file >> scene;
+    return scene;
+}
+
+string save(json const &scene, string const &name)
+{
+    string filename = work + '/' + name + ".json";
+    ofstream(filename) << scene.dump(4);
+    return filename;
+}
+
+string bundled(string const &name)
+{
+    return save(load(name), name);
+}
+
+json areaLights(json scene)
+{
+    scene["Lights"][0]["shape"] = "sphere";
+    scene["Lights"][0]["radius"] = 60;
+    scene["Lights"][1]["shape"] = "rect";
+    scene["Lights"][1]["edge1"] = {150, 0, 0};
+    scene["Lights"][1]["edge2"] = {0, 0, 150};
+    return scene;
+}
+
+void clear(string const &directory)
+{
+    mkdir(directory.c_str(), 0755);
+    DIR *dir = opendir(directory.c_str());
+    while (dirent *entry = dir ? readdir(dir) : nullptr)
+        if (entry->d_name[0] != '.')
+            remove((directory + '/' + entry->d_name).c_str());
+    if (dir)
+        closedir(dir);
+}
+
+// --- Rendering ---------------------------------------------------------------
+
+pid_t start(Options const &args, string const &executable)
+{
+    vector<char *> argv{const_cast<char *>(executable.c_str())};
+    for (string const &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int log = open((work + "/ray.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        execv(executable.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+bool succeeded(pid_t pid)
+{
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool render(Options options, string const &scene, string const &image,
+            string const &executable)
+{
+    options.push_back(scene);
+    options.push_back(image);
+    if (succeeded(start(options, executable)))
+        return true;
+    cout << executable << " failed on " << scene << ", see " << work << "/ray.log\n";
+    return false;
+}
+
+bool same(string const &image, string const &part, unsigned x0, unsigned y0)
+{
+    Rgba8Image whole(image);
+    Rgba8Image window(part);
+    if (window.width() == 0 || x0 + window.width() > whole.width()
+        || y0 + window.height() > whole.height()
+        || (x0 == 0 && y0 == 0 && window.width() != whole.width()))
+    {
+        cout << part << " (" << window.width() << 'x' << window.height()
+             << ") does not fit " << image << " (" << whole.width() << 'x'
+             << whole.height() << ")\n";
+        return false;
+    }
+
+    size_t differing = 0;
+    for (unsigned y = 0; y != window.height(); ++y)
+    {
+        for (unsigned x = 0; x != window.width(); ++x)
+        {
+            Rgba8 one = whole(x0 + x, y0 + y);
+            Rgba8 other = window(x, y);
+            if (memcmp(&one, &other, sizeof(Rgba8)) != 0 && differing++ == 0)
+                cout << "first difference at (" << x << ", " << y << ")\n";
+        }
+    }
+    if (differing != 0)
+        cout << part << " differs from " << image << " in " << differing << " pixels\n";
+    return differing == 0;
+}
+
+bool outcome(bool equal, string const &name)
+{
+    cout << (equal ? "same  " : "DIFFER") << "  " << name << '\n';
+    return equal;
+}
+
+bool compare(string const &scene, string const &name, Options const &one,
+             Options const &other)
+{
+    string first = work + '/' + name + "-1.png";
+    string second = work + '/' + name + "-2.png";
+    return outcome(render(one, scene, first) && render(other, scene, second)
+                   && same(first, second), name);
+}
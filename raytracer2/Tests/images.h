@@ -0,0 +1,100 @@
+#ifndef IMAGES_H_
+#define IMAGES_H_
+
+#include "json/json.h"
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Image equality tests: pairs of renders that have to give the same image,
+// bit for bit. Every test runs the ray executable (so that the options are
+// tested as well) on variations of the bundled scenes, at a small size.
+
+using json = nlohmann::json;
+using Options = std::vector<std::string>;
+
+// The executable under test and the (empty) directory of the test's scenes,
+// images and caches; baseline is ray with the baseline kernels only (cpu.h)
+extern std::string ray;
+extern std::string work;
+extern std::string baseline;
+
+extern std::string const Reflect;       // bundled scenes
+extern std::string const Textured;
+extern Options const Small;             // the film size of the tests
+
+Options operator+(Options one, Options const &other);
+
+// --- Scenes ------------------------------------------------------------------
+
+json load(std::string const &name);
+
+// Writes the scene to the work directory, returns its file name
+std::string save(json const &scene, std::string const &name);
+std::string bundled(std::string const &name);
+
+// The lights of the reflect scene as a sphere and a rect light
+json areaLights(json scene);
+
+// Creates the directory, or removes the files in it
+void clear(std::string const &directory);
+
+// --- Rendering ---------------------------------------------------------------
+
+// Starts ray (or another executable) with the arguments, its output appended
+// to work/ray.log
+pid_t start(Options const &args, std::string const &executable = ray);
+bool succeeded(pid_t pid);
+
+// Renders scene to image with the options
+bool render(Options options, std::string const &scene, std::string const &image,
+            std::string const &executable = ray);
+
+// Whether part equals the pixels of image from (x0, y0) on
+bool same(std::string const &image, std::string const &part, unsigned x0 = 0,
+          unsigned y0 = 0);
+
+// Prints the outcome of a comparison
+bool outcome(bool equal, std::string const &name);
+
+// Renders scene with both sets of options and compares the images
+bool compare(std::string const &scene, std::string const &name, Options const &one,
+             Options const &other);
+
+// --- Checks ----------------------------------------------------------------
+
+// The scene rendered with one thread and with seven
+bool sameWithThreads(std::string const &scene, std::string const &name);
+
+// A crop window of the scene and the same pixels of the whole film
+bool sameCropped(std::string const &scene, std::string const &name);
+
+// A render of the scene killed after its first checkpoint and resumed, and
+// one that ran through
+bool sameResumed(std::string const &scene, std::string const &name);
+
+// Renders of the scene through a tile cache and fresh ones: the first, after
+// an edit of a material and after none
+bool sameThroughTileCache(json scene, std::string const &name);
+
+// Renders of the scene capturing a G-buffer and re-shading it after edits of
+// a light and of materials, and fresh ones
+bool sameReshaded(json scene, std::string const &name);
+
+// --- Tests -------------------------------------------------------------------
+
+bool testWavefront();
+bool testThreads();
+bool testCrop();
+bool testOptions();
+bool testCheckpoint();
+bool testTileCache();
+bool testGBuffer();
+bool testPathTracer();
+bool testPhotonMap();
+bool testAreaLights();
+bool testMotion();
+bool testIsa();
+
+#endif
@@ -0,0 +1,31 @@
+#include "images.h"
+
+using namespace std;
+
+// The kernels of the instruction set level the CPU selects against the
+// baseline ones (ray-baseline): the shapes, textures, area lights (whose
+// jitter depends on the bits of the hit point) and the path tracer
+bool testIsa()
+{
+    json path = areaLights(load(Reflect));
+    path["Integrator"] = "path";
+    vector<pair<string, string>> scenes = {
+        {"reflect", bundled(Reflect)},
+        {"textured", bundled(Textured)},
+        {"area", save(areaLights(load(Reflect)), "area")},
+        {"path", save(path, "path")},
+    };
+
+    Options options = Small + Options{"--spp", "4"};
+    bool passed = true;
+    for (auto const &scene : scenes)
+    {
+        string selected = work + "/isa-" + scene.first + "-selected.png";
+        string fallback = work + "/isa-" + scene.first + "-baseline.png";
+        passed = outcome(render(options, scene.second, selected)
+                         && render(options, scene.second, fallback, baseline)
+                         && same(selected, fallback), "isa " + scene.first)
+                 && passed;
+    }
+    return passed;
+}
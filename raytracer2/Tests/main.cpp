@@ -0,0 +1,76 @@
+// Runs one image equality test (images.h).
+//
+// Usage: raytest ray-executable work-directory test [ray-baseline]
+// run from the Scenes directory, where the scenes find their textures. The
+// test starts with an empty subdirectory of the work directory. The isa test
+// needs ray-baseline, built with the baseline kernels only.
+
+#include "images.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+    struct Test
+    {
+        char const *name;
+        bool (*run)();
+        bool needsBaseline = false;
+    };
+
+    vector<Test> const tests =
+    {
+        {"wavefront", testWavefront},       // "Renderer": "wavefront"
+        {"threads", testThreads},           // --threads
+        {"crop", testCrop},                 // --crop
+        {"options", testOptions},           // --spp, --depth, --threads values
+        {"checkpoint", testCheckpoint},     // --checkpoint, --resume
+        {"tile-cache", testTileCache},      // --tile-cache
+        {"gbuffer", testGBuffer},           // --gbuffer
+        {"path", testPathTracer},           // "Integrator": "path"
+        {"photons", testPhotonMap},         // "PhotonMap"
+        {"area-lights", testAreaLights},    // "shape": "sphere", "rect"
+        {"motion", testMotion},             // "motion"
+        {"isa", testIsa, true},             // against ray-baseline
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 4 || argc == 5)
+    {
+        ray = argv[1];
+        work = string(argv[2]) + '/' + argv[3];
+        baseline = argc == 5 ? argv[4] : "";
+        mkdir(argv[2], 0755);
+        for (Test const &test : tests)
+        {
+            if (strcmp(argv[3], test.name) != 0 || test.needsBaseline != (argc == 5))
+                continue;
+            clear(work);
+            try
+            {
+                return test.run() ? 0 : 1;
+            }
+            catch (exception const &ex)
+            {
+                cout << ex.what() << '\n';
+                return 1;
+            }
+        }
+    }
+
+    cerr << "Usage: " << argv[0] << " ray-executable work-directory test [ray-baseline]\n"
+         << "Tests:";
+    for (Test const &test : tests)
+        cerr << ' ' << test.name;
+    cerr << '\n';
+    return 1;
+}
@@ -0,0 +1,62 @@
+#include "images.h"
+
+using namespace std;
+
+namespace
+{
+    // The first spheres moving, turning and growing during the frame
+    json moving(json scene)
+    {
+        scene["Objects"][0]["motion"] = {{"translate", {40, 0, 0}}};
+        scene["Objects"][1]["motion"] = {{"rotate", {0, 0, 1}}, {"angle", 30},
+                                         {"pivot", {200, 200, 0}}};
+        scene["Objects"][2]["motion"] = {{"scale", 1.5}};
+        return scene;
+    }
+
+    // Objects with a motion that does not move them against the static scene
+    bool sameWithoutMotion()
+    {
+        json scene = load(Textured);
+        string still = save(scene, "still");
+        for (json &object : scene["Objects"])
+            object["motion"] = {{"translate", {0, 0, 0}}, {"angle", 0}, {"scale", 1}};
+        string zero = save(scene, "zero-motion");
+
+        string first = work + "/motion-still.png";
+        string second = work + "/motion-zero.png";
+        Options options = Small + Options{"--spp", "4"};
+        return outcome(render(options, still, first) && render(options, zero, second)
+                       && same(first, second), "zero motion");
+    }
+
+    // The wavefront renderer against the recursive one
+    bool sameBreadthFirst(json scene, string const &name)
+    {
+        string recursive = save(scene, name);
+        scene["Renderer"] = "wavefront";
+        string breadthFirst = save(scene, name + "-wavefront");
+
+        string first = work + '/' + name + "-recursive.png";
+        string second = work + '/' + name + "-wavefront.png";
+        Options options = Small + Options{"--spp", "4"};
+        return outcome(render(options, recursive, first)
+                       && render(options, breadthFirst, second) && same(first, second),
+                       "wavefront " + name);
+    }
+}
+
+// Motion blur: a motion that does not move against none, and moving objects
+// in the wavefront renderer, with one thread and seven, cropped, through the
+// tile cache and re-shaded
+bool testMotion()
+{
+    string textured = save(moving(load(Textured)), "motion");
+    bool passed = sameWithoutMotion();
+    passed = sameBreadthFirst(moving(load(Reflect)), "motion-reflect") && passed;
+    passed = sameBreadthFirst(moving(load(Textured)), "motion-textured") && passed;
+    passed = sameWithThreads(textured, "motion") && passed;
+    passed = sameCropped(textured, "motion") && passed;
+    passed = sameThroughTileCache(moving(load(Reflect)), "motion") && passed;
+    return sameReshaded(moving(load(Textured)), "motion") && passed;
+}
@@ -0,0 +1,53 @@
+#include "images.h"
+
+#include <iostream>
+
+using namespace std;
+
+bool sameWithThreads(string const &scene, string const &name)
+{
+    return compare(scene, "threads-" + name, Small + Options{"--spp", "4", "--threads", "1"},
+                   Small + Options{"--spp", "4", "--threads", "7"});
+}
+
+bool sameCropped(string const &scene, string const &name)
+{
+    string whole = work + "/crop-" + name + "-whole.png";
+    string part = work + "/crop-" + name + "-part.png";
+    return outcome(render(Small + Options{"--spp", "4"}, scene, whole)
+                   && render(Small + Options{"--spp", "4", "--crop", "17,30,71,62"}, scene, part)
+                   && same(whole, part, 17, 30),
+                   "crop " + name);
+}
+
+// One thread against seven
+bool testThreads()
+{
+    bool passed = sameWithThreads(bundled(Reflect), "reflect");
+    return sameWithThreads(bundled(Textured), "textured") && passed;
+}
+
+// A crop window against the same pixels of the whole film
+bool testCrop()
+{
+    return sameCropped(bundled(Textured), "textured");
+}
+
+// Values of --spp, --depth and --threads out of their range, or not numbers,
+// are refused rather than ignored or wrapped around
+bool testOptions()
+{
+    string scene = bundled(Reflect);
+    bool passed = true;
+    for (Options const &options : vector<Options>{
+             {"--spp", "-1"}, {"--spp", "0"}, {"--spp", "abc"}, {"--spp", "4x"},
+             {"--depth", "-2"}, {"--depth", ""}, {"--threads", "-1"}, {"--threads", "2000"}})
+    {
+        bool refused = !succeeded(start(Small + options
+                                         + Options{scene, work + "/options.png"}));
+        cout << (refused ? "refused " : "ACCEPTED") << "  " << options[0] << " '"
+             << options[1] << "'\n";
+        passed = passed && refused;
+    }
+    return passed;
+}
@@ -0,0 +1,13 @@
+#include "images.h"
+
+using namespace std;
+
+// The path tracer with one thread and seven, and cropped
+bool testPathTracer()
+{
+    json scene = load(Reflect);
+    scene["Integrator"] = "path";
+    string path = save(scene, "path");
+    bool passed = sameWithThreads(path, "path");
+    return sameCropped(path, "path") && passed;
+}
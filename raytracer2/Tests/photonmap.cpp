@@ -0,0 +1,11 @@
+#include "images.h"
+
+using namespace std;
+
+// Photon maps with one thread and seven
+bool testPhotonMap()
+{
+    json scene = load(Reflect);
+    scene["PhotonMap"] = {{"caustics", 20000}, {"indirect", 20000}};
+    return sameWithThreads(save(scene, "photons"), "photons");
+}
@@ -0,0 +1,36 @@
+#include "images.h"
+
+using namespace std;
+
+bool sameThroughTileCache(json scene, string const &name)
+{
+    string cache = work + "/tiles-" + name;
+    clear(cache);
+
+    // the edit leaves some of the 16 tiles as they were
+    string original = save(scene, "tilecache-" + name);
+    scene["Objects"][1]["material"]["color"] = {0.2, 0.9, 0.4};
+    string edited = save(scene, "tilecache-" + name + "-edited");
+
+    Options fresh = {"--resolution", "200", "--spp", "4"};
+    Options cached = fresh + Options{"--tile-cache", cache};
+    bool passed = true;
+    for (auto const &step : vector<pair<string, string>>{
+             {"first", original}, {"edited", edited}, {"unchanged", edited}})
+    {
+        string through = work + "/tilecache-" + name + '-' + step.first + ".png";
+        string plain = work + "/tilecache-" + name + '-' + step.first + "-fresh.png";
+        passed = outcome(render(cached, step.second, through)
+                         && render(fresh, step.second, plain) && same(plain, through),
+                         "tile cache " + name + ", " + step.first)
+                 && passed;
+    }
+    return passed;
+}
+
+// Renders through the tile cache, after an edit and without one, against
+// fresh renders
+bool testTileCache()
+{
+    return sameThroughTileCache(load(Reflect), "reflect");
+}
@@ -0,0 +1,32 @@
+#include "images.h"
+
+using namespace std;
+
+namespace
+{
+    bool sameBreadthFirst(string const &name, string const &label, Options const &options)
+    {
+        json scene = load(name);
+        string recursive = save(scene, label);
+        scene["Renderer"] = "wavefront";
+        string breadthFirst = save(scene, label + "-wavefront");
+
+        string first = work + '/' + label + "-recursive.png";
+        string second = work + '/' + label + "-wavefront.png";
+        return outcome(render(options, recursive, first)
+                       && render(options, breadthFirst, second) && same(first, second),
+                       label);
+    }
+}
+
+// The wavefront renderer against the recursive one, also with batches that
+// end within the samples of a pixel (a 64x64 tile at 5 samples per pixel)
+bool testWavefront()
+{
+    bool passed = true;
+    for (string const &name : vector<string>{"scene01-shadows", "scene01-lights-shadows",
+                                             Reflect, "scene01-ss", Textured})
+        passed = sameBreadthFirst(name, name, Small) && passed;
+    return sameBreadthFirst(Reflect, Reflect + "-5spp", Small + Options{"--spp", "5"})
+           && passed;
+}